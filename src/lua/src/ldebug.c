@@ -434,6 +434,17 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
         if (reg >= a) last = pc;  /* affect all registers above base */
         break;
       }
+      case OP_CALLBUILTIN: {
+        check(b > 0);
+        checkreg(pt, a+b-1);
+        if (reg >= a) last = pc;  /* affect all registers above base */
+        break;
+      }
+      case OP_CALLBUILTIN1: {
+        checkreg(pt, a+1);
+        if (reg == a+1) last = pc;  /* a regular call puts RK(B) here */
+        break;
+      }
       case OP_RETURN: {
         b--;  /* b = num. returns */
         if (b > 0) checkreg(pt, a+b-1);
@@ -547,7 +558,14 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
     return NULL;  /* calling function is not Lua (or is unknown) */
   ci--;  /* calling function */
   i = ci_func(ci)->l.p->code[currentpc(L, ci)];
-  if (GET_OPCODE(i) == OP_CALL || GET_OPCODE(i) == OP_TAILCALL ||
+  if (GET_OPCODE(i) == OP_CALLBUILTIN || GET_OPCODE(i) == OP_CALLBUILTIN1) {
+    const global_State *g = G(L);
+    if (GETARG_C(i) >= g->nbuiltins)
+      return NULL;
+    *name = g->builtininfo[GETARG_C(i)].name;
+    return "builtin";
+  }
+  else if (GET_OPCODE(i) == OP_CALL || GET_OPCODE(i) == OP_TAILCALL ||
       GET_OPCODE(i) == OP_TFORLOOP)
     return getobjname(L, ci, GETARG_A(i), name);
   else
@@ -0,0 +1,70 @@
+/*
+** $Id: ljumptab.h $
+** Jump table for threaded dispatch in luaV_execute
+** See Copyright Notice in lua.h
+*/
+
+/*
+** Only for lvm.c, which includes this inside luaV_execute when
+** LUAI_COMPUTEDGOTO is on. Every instruction ends by fetching the next
+** one and jumping straight to its label, so there is one indirect jump
+** per opcode for the branch predictor to learn, instead of one shared
+** by all of them.
+*/
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+
+#define vmdispatch(x)	goto *disptab[x];
+
+#define vmcase(l)	L_##l:
+
+#define vmbreak		{ vmfetch(); vmdispatch(GET_OPCODE(i)); }
+
+
+/* ORDER OP */
+
+static const void *const disptab[NUM_OPCODES] = {
+&&L_OP_MOVE,
+&&L_OP_LOADK,
+&&L_OP_LOADBOOL,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_GETGLOBAL,
+&&L_OP_GETTABLE,
+&&L_OP_SETGLOBAL,
+&&L_OP_SETUPVAL,
+&&L_OP_SETTABLE,
+&&L_OP_NEWTABLE,
+&&L_OP_SELF,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_MUL,
+&&L_OP_DIV,
+&&L_OP_MOD,
+&&L_OP_POW,
+&&L_OP_UNM,
+&&L_OP_NOT,
+&&L_OP_LEN,
+&&L_OP_CONCAT,
+&&L_OP_JMP,
+&&L_OP_EQ,
+&&L_OP_LT,
+&&L_OP_LE,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&L_OP_CALL,
+&&L_OP_TAILCALL,
+&&L_OP_RETURN,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSE,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_TRAP,
+&&L_OP_CALLBUILTIN,
+&&L_OP_CALLBUILTIN1
+};
@@ -52,6 +52,9 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "TRAP",
+  "CALLBUILTIN",
+  "CALLBUILTIN1",
   NULL
 };
 
@@ -98,5 +101,8 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 0, OpArgN, OpArgN, iABx)		/* OP_TRAP */
+ ,opmode(0, 1, OpArgU, OpArgU, iABC)		/* OP_CALLBUILTIN */
+ ,opmode(0, 1, OpArgK, OpArgU, iABC)		/* OP_CALLBUILTIN1 */
 };
 
@@ -204,11 +204,15 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+OP_TRAP,/*		i := G->trap(L, pc); execute i			*/
+OP_CALLBUILTIN,/* A B C	R(A) := G->builtins[C](R(A+1), ... ,R(A+B-1))	*/
+OP_CALLBUILTIN1/* A B C	R(A) := G->builtins[C](RK(B))			*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_CALLBUILTIN1) + 1)
 
 
 
@@ -223,6 +227,17 @@ OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
 
   (*) In OP_RETURN, if (B == 0) then return up to `top'
 
+  (*) OP_CALLBUILTIN always leaves exactly one result. Builtins with a fast
+      path (see lua_Builtin) are called directly when their arguments allow.
+
+  (*) OP_CALLBUILTIN1 is OP_LOADK or OP_MOVE followed by OP_CALLBUILTIN,
+      for calls with one argument. It uses R(A+1) if it makes a regular call.
+      Toby only emits it with LUAI_SUPERINSTRUCTIONS.
+
+  (*) With LUAI_SUPERINSTRUCTIONS, when OP_FORLOOP jumps back to an OP_MOVE
+      from R(A+3), it runs that too (unless there's a line or count hook),
+      saving a dispatch.
+
   (*) In OP_SETLIST, if (B == 0) then B = `top';
       if (C == 0) then next `instruction' is real C
 
@@ -166,6 +166,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
+  g->trap = NULL;
+  g->trapud = NULL;
+  g->builtins = NULL;
+  g->builtininfo = NULL;
+  g->nbuiltins = 0;
   g->gcstate = GCSpause;
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
@@ -62,6 +62,30 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+/*
+** called by OP_TRAP; returns the instruction the trap replaced
+*/
+typedef Instruction (*lua_Trap) (lua_State *L, const Instruction *pc);
+
+
+/*
+** a builtin's fast path: OP_CALLBUILTIN calls this instead of the builtin's
+** C function when it has exactly `nargs' arguments, all of them numbers.
+** There is no CallInfo for it and nothing on the stack; it can still raise
+** errors. Returns 1 if it set `*ret', 0 to return nil.
+*/
+typedef int (*lua_FastBuiltin) (lua_State *L, const lua_Number *args,
+                                lua_Number *ret);
+
+#define LUA_MAXFASTARGS	4
+
+typedef struct lua_Builtin {
+  const char *name;
+  lua_FastBuiltin fast;  /* NULL if there's no fast path */
+  int nargs;  /* arguments `fast' takes, at most LUA_MAXFASTARGS */
+} lua_Builtin;
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -86,6 +110,11 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   lua_CFunction panic;  /* to be called in unprotected errors */
+  lua_Trap trap;  /* to be called by OP_TRAP */
+  void *trapud;  /* auxiliary data for `trap' */
+  struct Table *builtins;  /* functions for OP_CALLBUILTIN (kept elsewhere) */
+  const lua_Builtin *builtininfo;  /* their names and fast paths */
+  int nbuiltins;
   TValue l_registry;
   struct lua_State *mainthread;
   UpVal uvhead;  /* head of double-linked list of all open upvalues */
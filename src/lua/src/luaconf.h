@@ -625,6 +625,35 @@ union luai_Cast { double l_d; long l_l; };
 #endif
 
 
+/*
+@@ LUAI_COMPUTEDGOTO makes the VM jump from each instruction straight to
+@* the next one's code through a table of labels ("threaded" dispatch),
+@* instead of going back around to one big switch.
+** CHANGE it (define it as 0) if your compiler has labels as values but
+** you want the switch anyway. Only GCC-compatible compilers have them.
+*/
+#if !defined(LUAI_COMPUTEDGOTO)
+#if defined(__GNUC__)
+#define LUAI_COMPUTEDGOTO	1
+#else
+#define LUAI_COMPUTEDGOTO	0
+#endif
+#endif
+
+
+/*
+@@ LUAI_SUPERINSTRUCTIONS fuses some common pairs of instructions into
+@* one (see OP_CALLBUILTIN1 and OP_FORLOOP in lopcodes.h). They're only
+@* on by default with threaded dispatch; the switch gained nothing from
+@* them in benchmarks over programs/.
+** CHANGE it (define it as 0 or 1) to pick either way. The VM still runs
+** OP_CALLBUILTIN1 without them, for code from the bytecode cache.
+*/
+#if !defined(LUAI_SUPERINSTRUCTIONS)
+#define LUAI_SUPERINSTRUCTIONS	LUAI_COMPUTEDGOTO
+#endif
+
+
 /*
 @@ LUA_MAXCAPTURES is the maximum number of captures that a pattern
 @* can do during pattern-matching.
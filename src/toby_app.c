@@ -13,6 +13,8 @@
 #include <assert.h>
 #include <ctype.h>  /* !!! FIXME: lose this with tolower/toupper... */
 #include "toby_app.h"
+#include "toby_compiler.h"
+#include "toby_thread.h"
 
 typedef enum TobyExecState
 {
@@ -24,30 +26,271 @@ typedef enum TobyExecState
 } TobyExecState;
 
 
-/* TurtlesSpace state... */
-static int currentTurtleIndex = -1;
-static int totalTurtles = 0;
-static Turtle *turtles = NULL;
-static int fenceEnabled = 1;
-static int halted = 0;
-static TurtleRGB background = { 0, 0, 0 };
-static TobyDebugInfo *callstack = NULL;
-static int callstackCount = 0;
-static TobyDebugInfo *varList = NULL;
-static int varCount = 0;
-static lua_State *luaState = NULL;
-static int turtleSpaceIsDirty = 0;
-static int executingLine = 0;
-static TobyExecState execState = EXEC_STOPPED;
-static long delayPerLine = 0;
-static long nextPumpTicks = 0;
-
-
-void TOBY_background(int *r, int *g, int *b)
-{
-    *r = background.r;
-    *g = background.g;
-    *b = background.b;
+/*
+ * One primitive in the display list. Everything drawn by the current (or
+ *  last) program is kept here, so it can be redrawn at any size without
+ *  running the program again. The item type lives in the top 8 bits of
+ *  (type_rgb), the pen color in the low 24. Coordinates are TurtleSpace
+ *  units (0 to 999), so floats are plenty precise.
+ */
+typedef enum DisplayItemType
+{
+    DISPLAYITEM_LINE,
+    DISPLAYITEM_STRING,
+    DISPLAYITEM_POLYGON,
+    DISPLAYITEM_FLOODFILL,
+    DISPLAYITEM_POINT,
+} DisplayItemType;
+
+typedef struct DisplayItem
+{
+    unsigned int type_rgb;
+    union
+    {
+        struct { float x1, y1, x2, y2; } line;
+        struct { float x, y, angle; unsigned int offset; } string;
+        struct { unsigned int offset, count; } polygon;
+        struct { float x, y; } floodfill;
+        struct { float x, y; } point;
+    } u;
+} DisplayItem;
+
+/* Past this, a program has drawn too much to keep around (about 80 megs). */
+#define MAX_DISPLAY_ITEMS (4 * 1024 * 1024)
+
+/*
+ * Turtles almost always turn by whole degrees, so keep a table of headings
+ *  for those, which makes turnRight(1) and friends a lookup instead of a
+ *  trip through sin() and cos(). The table holds exactly what sin() and
+ *  cos() return, so drawings come out the same either way.
+ */
+#ifndef TOBY_HEADING_TABLE
+#define TOBY_HEADING_TABLE 1
+#endif
+
+/*
+ * Keep each context's Lua state between runs, with the builtins already
+ *  registered, so Run doesn't start from nothing every time. Each run gets
+ *  its own, empty, globals, so nothing a program defines outlives it.
+ *  A state that's using more than TOBY_WARM_STATE_BYTES when its run ends
+ *  is closed instead, since collecting it would cost more than that.
+ */
+#ifndef TOBY_WARM_STATE
+#define TOBY_WARM_STATE 1
+#endif
+
+#ifndef TOBY_WARM_STATE_BYTES
+#define TOBY_WARM_STATE_BYTES (512 * 1024)
+#endif
+
+/*
+ * Every turtle, as a structure of arrays, so programs can have tens of
+ *  thousands of them: passes over all the turtles only touch the fields
+ *  they need, and the math over them vectorizes. Turtles are numbered from
+ *  zero, and are only ever added. Frontends get a Turtle filled in from
+ *  these when one needs drawing.
+ */
+typedef struct TurtleArrays
+{
+    int count;
+    int allocated;
+    lua_Number *x;
+    lua_Number *y;
+    lua_Number *angle;
+    lua_Number *headingX;  /* cos(angle). */
+    lua_Number *headingY;  /* sin(angle). */
+    TurtleRGB *pen;
+    unsigned char *flags;  /* TURTLEFLAG_* */
+    TobyRect *shown;  /* where each one was at the last putToScreen. */
+    int *changed;  /* turtles with TURTLEFLAG_CHANGED set, in no order. */
+    int changedCount;
+} TurtleArrays;
+
+#define TURTLEFLAG_PENDOWN (1 << 0)
+#define TURTLEFLAG_VISIBLE (1 << 1)
+#define TURTLEFLAG_CHANGED (1 << 2)  /* must be repainted at putToScreen. */
+
+/* All turtles are the same size. */
+#define TURTLE_WIDTH N(20)
+#define TURTLE_HEIGHT N(20)
+
+/* TurtlesSpace state, and everything else about a program run... */
+struct TobyContext
+{
+    TobyCallbacks callbacks;
+    void *userdata;
+    int currentTurtleIndex;
+    TurtleArrays turtles;
+    int fenceEnabled;
+    int halted;
+    TurtleRGB background;
+    TobyDebugInfo *callstack;
+    int callstackCount;
+    TobyDebugInfo *varList;
+    int varCount;
+    lua_State *luaState;
+    int turtleSpaceIsDirty;
+    TobyRect dirtyRect;  /* changed since the last putToScreen. */
+    int executingLine;
+    volatile TobyExecState execState;  /* TOBY_haltProgram() can be async. */
+    volatile long delayPerLine;  /* ...and so can setting this. */
+    TobyLineSegment lineQueue[512];
+    int lineQueueCount;
+    TobyPoint pointQueue[1024];
+    int pointQueueCount;
+    TobyThread *watchdogThread;
+    TobyEvent *watchdogWake;  /* lives as long as the context does. */
+    volatile int watchdogQuit;
+    DisplayItem *displayList;
+    int displayListCount;
+    int displayListAllocated;
+    char *displayStrings;
+    size_t displayStringsLen;
+    size_t displayStringsAllocated;
+    TurtlePoint *displayPoints;  /* corners of recorded polygons. */
+    int displayPointsCount;
+    int displayPointsAllocated;
+    int displayListBroken;
+    int displayListFinished;
+    Turtle *finalTurtles;
+    int finalTurtleCount;
+    TurtlePoint *path;  /* where turtle (pathTurtle) went since startPolygon */
+    int pathCount;
+    int pathAllocated;
+    int pathTurtle;  /* -1 if not recording a polygon. */
+    int *breakpointLines;  /* sorted, no duplicates. */
+    int breakpointLineCount;
+    int steppedOntoLine;
+    volatile int frameDue;  /* set by the watchdog. */
+    #if TOBY_HEADING_TABLE
+    TurtlePoint wholeDegrees[360];  /* heading for each whole-degree angle. */
+    #endif
+    int countInstructions;
+    TobyArena *arena;  /* everything the Lua state allocates. */
+    lua_State *warmState;  /* kept from the last run, if anything. */
+    size_t luaMemory;
+    TobyRunStats stats;
+};
+
+/* How often the watchdog hands control back to the UI. */
+#define WATCHDOG_TICKS 50
+
+
+/*
+ * Every Lua state we make hands its context to the allocator. The memory
+ *  comes from the context's arena, which gets it all back at once when the
+ *  run is over.
+ */
+static void *luaAllocator(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    TobyContext *ctx = (TobyContext *) ud;
+    void *retval = TOBY_arenaAlloc(ctx->arena, ptr, osize, nsize);
+
+    if ((retval == NULL) && (nsize != 0))
+        return NULL;  /* Lua keeps the old block on failure. */
+
+    ctx->luaMemory = (ctx->luaMemory - osize) + nsize;
+    if (ctx->luaMemory > ctx->stats.peakMemory)
+        ctx->stats.peakMemory = (unsigned long) ctx->luaMemory;
+    return retval;
+} /* luaAllocator */
+
+
+static inline TobyContext *getContext(lua_State *L)
+{
+    void *ud = NULL;
+    lua_getallocf(L, &ud);
+    return (TobyContext *) ud;
+} /* getContext */
+
+
+static inline void calculateHeading(lua_Number angle, TurtlePoint *heading);
+
+/* Empty, so that marking any point in it makes it just that point. */
+static inline void clearRect(TobyRect *rect)
+{
+    rect->x1 = rect->y1 = N(1000000);
+    rect->x2 = rect->y2 = N(-1000000);
+} /* clearRect */
+
+
+static inline void addPointToRect(TobyRect *rect, lua_Number x, lua_Number y)
+{
+    if (x < rect->x1) rect->x1 = x;
+    if (x > rect->x2) rect->x2 = x;
+    if (y < rect->y1) rect->y1 = y;
+    if (y > rect->y2) rect->y2 = y;
+} /* addPointToRect */
+
+
+static inline void addRectToRect(TobyRect *rect, const TobyRect *add)
+{
+    if (add->x1 <= add->x2)  /* not empty? */
+    {
+        addPointToRect(rect, add->x1, add->y1);
+        addPointToRect(rect, add->x2, add->y2);
+    } /* if */
+} /* addRectToRect */
+
+
+static inline void markAllDirty(TobyContext *ctx)
+{
+    addPointToRect(&ctx->dirtyRect, N(0), N(0));
+    addPointToRect(&ctx->dirtyRect, N(1000), N(1000));
+} /* markAllDirty */
+
+
+TobyContext *TOBY_createContext(const TobyCallbacks *callbacks, void *userdata)
+{
+    TobyContext *ctx = (TobyContext *) calloc(1, sizeof (TobyContext));
+    if (ctx != NULL)
+    {
+        ctx->arena = TOBY_createArena();
+        if (ctx->arena == NULL)
+        {
+            free(ctx);
+            return NULL;
+        } /* if */
+
+        ctx->watchdogWake = TOBY_createEvent();
+        if (ctx->watchdogWake == NULL)
+        {
+            TOBY_destroyArena(ctx->arena);
+            free(ctx);
+            return NULL;
+        } /* if */
+
+        memcpy(&ctx->callbacks, callbacks, sizeof (TobyCallbacks));
+        ctx->userdata = userdata;
+        ctx->currentTurtleIndex = -1;
+        ctx->pathTurtle = -1;
+        ctx->fenceEnabled = 1;
+        ctx->execState = EXEC_STOPPED;
+        ctx->steppedOntoLine = -1;
+        #if TOBY_HEADING_TABLE
+        {
+            int i;
+            for (i = 0; i < 360; i++)
+                calculateHeading((lua_Number) i, &ctx->wholeDegrees[i]);
+        }
+        #endif
+        clearRect(&ctx->dirtyRect);
+    } /* if */
+    return ctx;
+} /* TOBY_createContext */
+
+
+void *TOBY_getContextUserData(TobyContext *ctx)
+{
+    return ctx->userdata;
+} /* TOBY_getContextUserData */
+
+
+void TOBY_background(TobyContext *ctx, int *r, int *g, int *b)
+{
+    *r = ctx->background.r;
+    *g = ctx->background.g;
+    *b = ctx->background.b;
 } /* TOBY_background */
 
 
@@ -60,7 +303,7 @@ static inline void throwError(lua_State *L, const char *err)
 
 static inline void haltProgram(lua_State *L)
 {
-    halted = 1;
+    getContext(L)->halted = 1;
     throwError(L, "program halted");
 } /* haltProgram */
 
@@ -94,20 +337,44 @@ static inline void sinAndCos(lua_Number x, lua_Number *sval, lua_Number *cval)
 } /* sinAndCos */
 
 
-static inline void calculateLine(lua_Number heading, lua_Number distance,
+static inline void calculateHeading(lua_Number angle, TurtlePoint *heading)
+{
+    sinAndCos(degreesToRadians(angle), &heading->y, &heading->x);
+} /* calculateHeading */
+
+
+/* (heading) is a unit vector, like Turtle::heading. */
+static inline void calculateLine(const TurtlePoint *heading,
+                                 lua_Number distance,
                                  lua_Number startX, lua_Number startY,
                                  lua_Number *endX, lua_Number *endY)
 {
-    const lua_Number rad = degreesToRadians(heading);
-    lua_Number sinrad, cosrad;
-
     /* !!! FIXME: fixed point... */
-    sinAndCos(rad, &sinrad, &cosrad);
-    *endY = (sinrad * distance) + startY;
-    *endX = (cosrad * distance) + startX;
+    *endY = (heading->y * distance) + startY;
+    *endX = (heading->x * distance) + startX;
 } /* calculateLine */
 
 
+/* Point turtle (t)'s heading along its angle, which must be in [0, 360). */
+static inline void updateHeading(TobyContext *ctx, int t)
+{
+    TurtleArrays *turtles = &ctx->turtles;
+    const lua_Number angle = turtles->angle[t];
+    TurtlePoint heading;
+
+    #if TOBY_HEADING_TABLE
+    const int whole = (int) angle;
+    if (((lua_Number) whole) == angle)
+        heading = ctx->wholeDegrees[whole];
+    else
+    #endif
+    calculateHeading(angle, &heading);
+
+    turtles->headingX[t] = heading.x;
+    turtles->headingY[t] = heading.y;
+} /* updateHeading */
+
+
 #if 0   /* not used, yet. */
 static inline lua_Number pythagorian(lua_Number s1, lua_Number hypotenuse)
 {
@@ -175,6 +442,11 @@ int TOBY_clipLine(lua_Number *_x1, lua_Number *_y1,
     lua_Number minimum = N(0);
     lua_Number maximum = N(1);
 
+    /* NaN fails every test below, so it would go through unclipped. */
+    if ( ((x1 - x1) != N(0)) || ((y1 - y1) != N(0)) ||
+         ((x2 - x2) != N(0)) || ((y2 - y2) != N(0)) )
+        return 0;  /* not finite: nothing to draw. */
+
     if (clip(&minimum, &maximum, -px, x1 - N(0)))
     {
         if (clip(&minimum, &maximum, px, w - x1))
@@ -204,286 +476,1260 @@ int TOBY_clipLine(lua_Number *_x1, lua_Number *_y1,
 } /* TOBY_clipLine */
 
 
-static inline int checkWholeNum(lua_State *L, int idx)
+static inline int wholeNum(lua_State *L, lua_Number num)
 {
-    const lua_Number num = luaL_checknumber(L, idx);
     const int intnum = (int) num;
     if ( ((lua_Number) intnum) != num )
         throwError(L, "Expected whole number");
 
     return intnum;
+} /* wholeNum */
+
+
+static inline int checkWholeNum(lua_State *L, int idx)
+{
+    return wholeNum(L, luaL_checknumber(L, idx));
 } /* checkWholeNum */
 
 
-static int allocateTurtle(lua_State *L)
+/*
+ * Builtins that only take numbers have a fast path, which the VM calls
+ *  directly when a program passes it the right count of numbers (see
+ *  TobyFastBuiltin). Their lua_CFunction just checks the arguments and
+ *  calls the fast path, so the two can't behave differently.
+ */
+static int callFastBuiltin(lua_State *L, TobyFastBuiltin fast, int nargs)
 {
-    Turtle *ptr;
+    lua_Number args[TOBY_MAX_FAST_ARGS];
+    lua_Number ret = N(0);
+    int i;
 
-    ptr = (Turtle *) realloc(turtles, sizeof (Turtle) * (totalTurtles + 1));
-    if (ptr == NULL)
-        throwError(L, "Out of memory");
+    for (i = 0; i < nargs; i++)
+        args[i] = luaL_checknumber(L, i + 1);
+
+    if (!fast(L, args, &ret))
+        return 0;
+    lua_pushnumber(L, ret);
+    return 1;
+} /* callFastBuiltin */
+
+
+static void freeTurtles(TurtleArrays *turtles)
+{
+    free(turtles->x);
+    free(turtles->y);
+    free(turtles->angle);
+    free(turtles->headingX);
+    free(turtles->headingY);
+    free(turtles->pen);
+    free(turtles->flags);
+    free(turtles->shown);
+    free(turtles->changed);
+    memset(turtles, '\0', sizeof (TurtleArrays));
+} /* freeTurtles */
+
+
+/* Resize every array in (turtles) to hold (total). Returns zero on failure. */
+static int growTurtles(TurtleArrays *turtles, int total)
+{
+    #define GROW_TURTLE_ARRAY(field) { \
+        void *ptr = realloc(turtles->field, sizeof (*turtles->field) * total); \
+        if (ptr == NULL) return 0; \
+        turtles->field = ptr; \
+    }
+    GROW_TURTLE_ARRAY(x);
+    GROW_TURTLE_ARRAY(y);
+    GROW_TURTLE_ARRAY(angle);
+    GROW_TURTLE_ARRAY(headingX);
+    GROW_TURTLE_ARRAY(headingY);
+    GROW_TURTLE_ARRAY(pen);
+    GROW_TURTLE_ARRAY(flags);
+    GROW_TURTLE_ARRAY(shown);
+    GROW_TURTLE_ARRAY(changed);
+    #undef GROW_TURTLE_ARRAY
+
+    turtles->allocated = total;
+    return 1;
+} /* growTurtles */
+
+
+/* Turtle (t) has to be repainted (or erased) at the next putToScreen. */
+static inline void turtleChanged(TobyContext *ctx, int t)
+{
+    TurtleArrays *turtles = &ctx->turtles;
+    if ((turtles->flags[t] & TURTLEFLAG_CHANGED) == 0)
+    {
+        turtles->flags[t] |= TURTLEFLAG_CHANGED;
+        turtles->changed[turtles->changedCount++] = t;
+    } /* if */
+    ctx->turtleSpaceIsDirty = 1;
+} /* turtleChanged */
+
+
+/* Turtle (t) moved or turned; only matters if you can see it. */
+static inline void turtleMoved(TobyContext *ctx, int t)
+{
+    if (ctx->turtles.flags[t] & TURTLEFLAG_VISIBLE)
+        turtleChanged(ctx, t);
+} /* turtleMoved */
 
-    turtles = ptr;
-    ptr = &turtles[totalTurtles];
-    memset(ptr, '\0', sizeof (Turtle));
 
-    ptr->pos.x = ptr->pos.y = N(500);   /* center of turtlespace. */
-    ptr->width = ptr->height = N(20);
-    ptr->pen.r = ptr->pen.g = ptr->pen.b = 255;  /* white. */
-    ptr->angle = 270;  /* due north. */
-    ptr->penDown = 1;
-    ptr->recalcPoints = 1;
-    ptr->visible = 1;
+static int allocateTurtle(lua_State *L)
+{
+    TobyContext *ctx = getContext(L);
+    TurtleArrays *turtles = &ctx->turtles;
+    const int t = turtles->count;
 
-    return totalTurtles++;
+    if (t == turtles->allocated)
+    {
+        if (!growTurtles(turtles, (turtles->allocated * 2) + 4))
+            throwError(L, "Out of memory");
+    } /* if */
+
+    turtles->x[t] = turtles->y[t] = N(500);   /* center of turtlespace. */
+    turtles->pen[t].r = turtles->pen[t].g = turtles->pen[t].b = 255; /* white */
+    turtles->angle[t] = 270;  /* due north. */
+    turtles->flags[t] = TURTLEFLAG_PENDOWN | TURTLEFLAG_VISIBLE;
+    clearRect(&turtles->shown[t]);
+    updateHeading(ctx, t);
+    turtles->count++;
+    turtleChanged(ctx, t);
+
+    return t;
 } /* allocateTurtle */
 
 
-static inline Turtle *getTurtle(lua_State *L)
+/* The index of the current turtle. */
+static inline int getTurtle(lua_State *L)
 {
-    if (currentTurtleIndex < 0)
+    TobyContext *ctx = getContext(L);
+    if (ctx->currentTurtleIndex < 0)
         throwError(L, "No current turtle");
-    return &turtles[currentTurtleIndex];
+    return ctx->currentTurtleIndex;
 } /* getTurtle */
 
 
 /*
- * See comments in Turtle::calcTriangle() for detailed discussion:
+ * Figure the corners of a turtle facing (fwdX,fwdY), relative to its
+ *  position: nose, left and right corners, and the middle of the tail.
+ *  See comments in Turtle::calcTriangle() for detailed discussion:
  *  http://svn.icculus.org/toby/branches/toby_rewrite_4/src/turtlespace/Turtle.cpp?view=markup
  */
-static inline void calculateTurtleTriangle(Turtle *turtle)
+static inline void calculateTurtleTriangle(const lua_Number fwdX,
+                                           const lua_Number fwdY,
+                                           TurtlePoint *pt)
+{
+    const lua_Number halfW = TURTLE_WIDTH / N(2);
+    const lua_Number halfH = TURTLE_HEIGHT / N(2);
+    const lua_Number tailX = (-fwdX * halfH) + N(0);
+    const lua_Number tailY = (-fwdY * halfH) + N(0);
+
+    pt[0].x = (fwdX * TURTLE_HEIGHT) + tailX;
+    pt[0].y = (fwdY * TURTLE_HEIGHT) + tailY;
+    pt[1].x = (-fwdY * halfW) + tailX;  /* turned +90. */
+    pt[1].y = (fwdX * halfW) + tailY;
+    pt[2].x = (fwdY * halfW) + tailX;  /* turned -90. */
+    pt[2].y = (-fwdX * halfW) + tailY;
+    pt[3].x = tailX;
+    pt[3].y = tailY;
+} /* calculateTurtleTriangle */
+
+
+/*
+ * Triangles for (count) turtles at once, from contiguous headings. There's
+ *  no branching in here, so the compiler can vectorize it.
+ */
+static void calculateTurtleTriangles(const lua_Number *fwdX,
+                                     const lua_Number *fwdY, int count,
+                                     TurtlePoint *pts)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        calculateTurtleTriangle(fwdX[i], fwdY[i], &pts[i * 4]);
+} /* calculateTurtleTriangles */
+
+
+/* Fill in a Turtle for the frontend from turtle (t), except its points. */
+static void fillTurtle(const TurtleArrays *turtles, int t, Turtle *turtle)
+{
+    const int flags = turtles->flags[t];
+    turtle->pos.x = turtles->x[t];
+    turtle->pos.y = turtles->y[t];
+    turtle->width = TURTLE_WIDTH;
+    turtle->height = TURTLE_HEIGHT;
+    turtle->angle = turtles->angle[t];
+    turtle->heading.x = turtles->headingX[t];
+    turtle->heading.y = turtles->headingY[t];
+    turtle->pen = turtles->pen[t];
+    turtle->penDown = ((flags & TURTLEFLAG_PENDOWN) != 0);
+    turtle->visible = ((flags & TURTLEFLAG_VISIBLE) != 0);
+    turtle->index = t;
+} /* fillTurtle */
+
+
+/*
+ * Hand over whatever lines or points are queued. Only one of the queues is
+ *  ever non-empty: queueing either kind flushes the other first, so
+ *  everything reaches the frontend in the order it was drawn.
+ */
+static void flushDrawing(TobyContext *ctx)
 {
-    if (turtle->recalcPoints)
+    if (ctx->lineQueueCount > 0)
     {
-        const lua_Number w = turtle->width;
-        const lua_Number h = turtle->height;
-        const lua_Number angle = turtle->angle;
-        const lua_Number halfW = w / N(2);
-        TurtlePoint *pt = turtle->points;
-        lua_Number tailX, tailY;
+        ctx->callbacks.drawLines(ctx, ctx->lineQueue, ctx->lineQueueCount);
+        ctx->lineQueueCount = 0;
+    } /* if */
 
-        calculateLine(angle + N(180), h / N(2), N(0), N(0), &tailX, &tailY);
-        calculateLine(angle, h, tailX, tailY, &pt[0].x, &pt[0].y);
-        calculateLine(angle + N(90), halfW, tailX, tailY, &pt[1].x, &pt[1].y);
-        calculateLine(angle - N(90), halfW, tailX, tailY, &pt[2].x, &pt[2].y);
-        pt[3].x = tailX;
-        pt[3].y = tailY;
+    else if (ctx->pointQueueCount > 0)
+    {
+        ctx->callbacks.drawPoints(ctx, ctx->pointQueue, ctx->pointQueueCount);
+        ctx->pointQueueCount = 0;
+    } /* else if */
+} /* flushDrawing */
+
+
+static inline void queueLine(TobyContext *ctx, lua_Number x1, lua_Number y1,
+                             lua_Number x2, lua_Number y2,
+                             const TurtleRGB *color)
+{
+    TobyLineSegment *seg;
+    if ( (ctx->pointQueueCount > 0) ||
+         (ctx->lineQueueCount == (int) STATICARRAYLEN(ctx->lineQueue)) )
+        flushDrawing(ctx);
+    seg = &ctx->lineQueue[ctx->lineQueueCount++];
+    addPointToRect(&ctx->dirtyRect, x1, y1);
+    addPointToRect(&ctx->dirtyRect, x2, y2);
+    seg->x1 = x1;
+    seg->y1 = y1;
+    seg->x2 = x2;
+    seg->y2 = y2;
+    seg->color = *color;
+} /* queueLine */
+
+
+static inline void queuePoint(TobyContext *ctx, lua_Number x, lua_Number y,
+                              const TurtleRGB *color)
+{
+    TobyPoint *pt;
+    if ( (ctx->lineQueueCount > 0) ||
+         (ctx->pointQueueCount == (int) STATICARRAYLEN(ctx->pointQueue)) )
+        flushDrawing(ctx);
+    pt = &ctx->pointQueue[ctx->pointQueueCount++];
+    addPointToRect(&ctx->dirtyRect, x, y);
+    pt->x = x;
+    pt->y = y;
+    pt->color = *color;
+} /* queuePoint */
+
+
+static void freeDisplayList(TobyContext *ctx)
+{
+    free(ctx->displayList);
+    ctx->displayList = NULL;
+    ctx->displayListCount = ctx->displayListAllocated = 0;
+    free(ctx->displayStrings);
+    ctx->displayStrings = NULL;
+    ctx->displayStringsLen = ctx->displayStringsAllocated = 0;
+    free(ctx->displayPoints);
+    ctx->displayPoints = NULL;
+    ctx->displayPointsCount = ctx->displayPointsAllocated = 0;
+    free(ctx->finalTurtles);
+    ctx->finalTurtles = NULL;
+    ctx->finalTurtleCount = 0;
+    ctx->displayListBroken = 0;
+    ctx->displayListFinished = 0;
+} /* freeDisplayList */
+
+
+/* Out of memory: give up on replaying this run, but keep the program going. */
+static void breakDisplayList(TobyContext *ctx)
+{
+    freeDisplayList(ctx);
+    ctx->displayListBroken = 1;
+} /* breakDisplayList */
+
+
+static DisplayItem *addDisplayItem(TobyContext *ctx, DisplayItemType type,
+                                   const TurtleRGB *c)
+{
+    DisplayItem *item;
+
+    if (ctx->displayListBroken)
+        return NULL;
 
-        turtle->recalcPoints = 0;
+    if (ctx->displayListCount >= ctx->displayListAllocated)
+    {
+        const int newalloc = (ctx->displayListAllocated + 512) * 2;
+        void *ptr = NULL;
+        if (ctx->displayListAllocated < MAX_DISPLAY_ITEMS)
+            ptr = realloc(ctx->displayList, sizeof (DisplayItem) * newalloc);
+        if (ptr == NULL)
+        {
+            breakDisplayList(ctx);
+            return NULL;
+        } /* if */
+        ctx->displayList = (DisplayItem *) ptr;
+        ctx->displayListAllocated = newalloc;
     } /* if */
-} /* calculateTurtleTriangle */
+
+    item = &ctx->displayList[ctx->displayListCount++];
+    item->type_rgb = ( (((unsigned int) type) << 24) |
+                       ((((unsigned int) c->r) & 0xFF) << 16) |
+                       ((((unsigned int) c->g) & 0xFF) << 8) |
+                       ((((unsigned int) c->b) & 0xFF)) );
+    return item;
+} /* addDisplayItem */
+
+
+static inline DisplayItemType displayItemType(const DisplayItem *item)
+{
+    return (DisplayItemType) (item->type_rgb >> 24);
+} /* displayItemType */
+
+
+static inline void displayItemColor(const DisplayItem *item, TurtleRGB *c)
+{
+    c->r = (int) ((item->type_rgb >> 16) & 0xFF);
+    c->g = (int) ((item->type_rgb >> 8) & 0xFF);
+    c->b = (int) (item->type_rgb & 0xFF);
+} /* displayItemColor */
+
+
+static void recordLine(TobyContext *ctx, lua_Number x1, lua_Number y1,
+                       lua_Number x2, lua_Number y2, const TurtleRGB *color)
+{
+    DisplayItem *item = addDisplayItem(ctx, DISPLAYITEM_LINE, color);
+    if (item != NULL)
+    {
+        item->u.line.x1 = (float) x1;
+        item->u.line.y1 = (float) y1;
+        item->u.line.x2 = (float) x2;
+        item->u.line.y2 = (float) y2;
+    } /* if */
+} /* recordLine */
+
+
+static void recordString(TobyContext *ctx, int t, const char *utf8str)
+{
+    const TurtleArrays *turtles = &ctx->turtles;
+    const size_t len = strlen(utf8str) + 1;
+    DisplayItem *item;
+
+    if (ctx->displayListBroken)
+        return;
+
+    if (ctx->displayStringsLen + len > ctx->displayStringsAllocated)
+    {
+        const size_t newalloc = (ctx->displayStringsLen + len) * 2;
+        void *ptr = realloc(ctx->displayStrings, newalloc);
+        if (ptr == NULL)
+        {
+            breakDisplayList(ctx);
+            return;
+        } /* if */
+        ctx->displayStrings = (char *) ptr;
+        ctx->displayStringsAllocated = newalloc;
+    } /* if */
+
+    item = addDisplayItem(ctx, DISPLAYITEM_STRING, &turtles->pen[t]);
+    if (item != NULL)
+    {
+        item->u.string.x = (float) turtles->x[t];
+        item->u.string.y = (float) turtles->y[t];
+        item->u.string.angle = (float) turtles->angle[t];
+        item->u.string.offset = (unsigned int) ctx->displayStringsLen;
+        memcpy(ctx->displayStrings + ctx->displayStringsLen, utf8str, len);
+        ctx->displayStringsLen += len;
+    } /* if */
+} /* recordString */
+
+
+static void recordPolygon(TobyContext *ctx, const TurtlePoint *pts, int count,
+                          const TurtleRGB *color)
+{
+    DisplayItem *item;
+
+    if (ctx->displayListBroken)
+        return;
+
+    if (ctx->displayPointsCount + count > ctx->displayPointsAllocated)
+    {
+        const int newalloc = (ctx->displayPointsCount + count) * 2;
+        const size_t len = sizeof (TurtlePoint) * newalloc;
+        void *ptr = realloc(ctx->displayPoints, len);
+        if (ptr == NULL)
+        {
+            breakDisplayList(ctx);
+            return;
+        } /* if */
+        ctx->displayPoints = (TurtlePoint *) ptr;
+        ctx->displayPointsAllocated = newalloc;
+    } /* if */
+
+    item = addDisplayItem(ctx, DISPLAYITEM_POLYGON, color);
+    if (item != NULL)
+    {
+        const size_t len = sizeof (TurtlePoint) * count;
+        item->u.polygon.offset = (unsigned int) ctx->displayPointsCount;
+        item->u.polygon.count = (unsigned int) count;
+        memcpy(ctx->displayPoints + ctx->displayPointsCount, pts, len);
+        ctx->displayPointsCount += count;
+    } /* if */
+} /* recordPolygon */
+
+
+static void recordPoint(TobyContext *ctx, lua_Number x, lua_Number y,
+                        const TurtleRGB *color)
+{
+    DisplayItem *item = addDisplayItem(ctx, DISPLAYITEM_POINT, color);
+    if (item != NULL)
+    {
+        item->u.point.x = (float) x;
+        item->u.point.y = (float) y;
+    } /* if */
+} /* recordPoint */
+
+
+static void recordFloodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                            const TurtleRGB *color)
+{
+    DisplayItem *item = addDisplayItem(ctx, DISPLAYITEM_FLOODFILL, color);
+    if (item != NULL)
+    {
+        item->u.floodfill.x = (float) x;
+        item->u.floodfill.y = (float) y;
+    } /* if */
+} /* recordFloodFill */
+
+
+/* Keep a copy of the turtles as the program left them, for replays. */
+static void recordFinalTurtles(TobyContext *ctx)
+{
+    const TurtleArrays *turtles = &ctx->turtles;
+    int i;
+
+    if ((ctx->displayListBroken) || (turtles->count == 0))
+        return;
+
+    ctx->finalTurtles = (Turtle *) malloc(sizeof (Turtle) * turtles->count);
+    if (ctx->finalTurtles == NULL)
+    {
+        breakDisplayList(ctx);
+        return;
+    } /* if */
+
+    for (i = 0; i < turtles->count; i++)
+    {
+        Turtle *turtle = &ctx->finalTurtles[i];
+        fillTurtle(turtles, i, turtle);
+        calculateTurtleTriangle(turtle->heading.x, turtle->heading.y,
+                                turtle->points);
+    } /* for */
+    ctx->finalTurtleCount = turtles->count;
+} /* recordFinalTurtles */
 
 
-void TOBY_renderAllTurtles(void *udata)
+/* Clear TurtleSpace. Anything still queued would be covered up anyhow. */
+static inline void cleanup(TobyContext *ctx)
 {
+    ctx->lineQueueCount = 0;
+    ctx->pointQueueCount = 0;
+    ctx->callbacks.cleanup(ctx, ctx->background.r, ctx->background.g,
+                           ctx->background.b);
+    markAllDirty(ctx);
+
+    /* everything recorded so far is covered up, too. */
+    ctx->displayListCount = 0;
+    ctx->displayStringsLen = 0;
+    ctx->displayPointsCount = 0;
+} /* cleanup */
+
+
+int TOBY_replayDisplayList(TobyContext *ctx, int for_printing)
+{
+    TurtleRGB *bg = &ctx->background;
+    TurtleRGB color;
     int i;
+
+    if (ctx->displayListBroken)
+        return 0;  /* ran out of memory at some point; caller must rerun. */
+
+    if (!TOBY_isRunning(ctx))
+    {
+        if (for_printing)
+            bg->r = bg->g = bg->b = 255;  /* white. */
+        else
+            bg->r = bg->g = bg->b = 0;  /* black. */
+    } /* if */
+
+    /* whatever is queued was recorded already; start clean. */
+    ctx->lineQueueCount = 0;
+    ctx->pointQueueCount = 0;
+    ctx->callbacks.cleanup(ctx, bg->r, bg->g, bg->b);
+    markAllDirty(ctx);
+
+    for (i = 0; i < ctx->displayListCount; i++)
+    {
+        const DisplayItem *item = &ctx->displayList[i];
+        displayItemColor(item, &color);
+        switch (displayItemType(item))
+        {
+            case DISPLAYITEM_LINE:
+                queueLine(ctx, item->u.line.x1, item->u.line.y1,
+                          item->u.line.x2, item->u.line.y2, &color);
+                break;
+
+            case DISPLAYITEM_STRING:
+                flushDrawing(ctx);
+                markAllDirty(ctx);  /* only the frontend knows the font. */
+                ctx->callbacks.drawString(ctx, item->u.string.x,
+                                    item->u.string.y,
+                                    ctx->displayStrings + item->u.string.offset,
+                                    item->u.string.angle,
+                                    color.r, color.g, color.b);
+                break;
+
+            case DISPLAYITEM_POINT:
+                queuePoint(ctx, item->u.point.x, item->u.point.y, &color);
+                break;
+
+            case DISPLAYITEM_POLYGON:
+                flushDrawing(ctx);
+                ctx->callbacks.fillPolygon(ctx,
+                                ctx->displayPoints + item->u.polygon.offset,
+                                (int) item->u.polygon.count,
+                                color.r, color.g, color.b);
+                break;
+
+            case DISPLAYITEM_FLOODFILL:
+                flushDrawing(ctx);
+                ctx->callbacks.floodFill(ctx, item->u.floodfill.x,
+                                         item->u.floodfill.y,
+                                         color.r, color.g, color.b);
+                break;
+        } /* switch */
+    } /* for */
+
+    flushDrawing(ctx);
+
+    /* a running program's turtles get drawn with the next screen update. */
+    if (!TOBY_isRunning(ctx))
+    {
+        for (i = 0; i < ctx->finalTurtleCount; i++)
+        {
+            if (ctx->finalTurtles[i].visible)
+                ctx->callbacks.drawTurtle(ctx, &ctx->finalTurtles[i], NULL);
+        } /* for */
+    } /* if */
+
+    ctx->turtleSpaceIsDirty = 1;
+    return 1;
+} /* TOBY_replayDisplayList */
+
+
+int TOBY_displayListComplete(TobyContext *ctx)
+{
+    return ((ctx->displayListFinished) && (!ctx->displayListBroken));
+} /* TOBY_displayListComplete */
+
+
+void TOBY_renderAllTurtles(TobyContext *ctx, void *udata)
+{
+    const TurtleArrays *turtles = &ctx->turtles;
+    TurtlePoint points[64 * 4];
+    Turtle turtle;
     int drewAtLeastOne = 0;
-    for (i = 0; i < totalTurtles; i++)
+    int i, j;
+
+    flushDrawing(ctx);  /* turtles go on top of everything drawn so far. */
+
+    /* Work out triangles a batch at a time, then draw the visible ones. */
+    for (i = 0; i < turtles->count; i += 64)
     {
-        Turtle *turtle = &turtles[i];
-        calculateTurtleTriangle(turtle);
-        if (turtle->visible)
+        const int total = turtles->count - i;
+        const int batch = (total < 64) ? total : 64;
+        calculateTurtleTriangles(turtles->headingX + i, turtles->headingY + i,
+                                 batch, points);
+        for (j = 0; j < batch; j++)
         {
-            TOBY_drawTurtle(turtle, udata);
-            drewAtLeastOne = 1;
-        } /* if */
+            if (turtles->flags[i + j] & TURTLEFLAG_VISIBLE)
+            {
+                fillTurtle(turtles, i + j, &turtle);
+                memcpy(turtle.points, &points[j * 4], sizeof (turtle.points));
+                ctx->callbacks.drawTurtle(ctx, &turtle, udata);
+                drewAtLeastOne = 1;
+            } /* if */
+        } /* for */
     } /* for */
 
     if ((drewAtLeastOne) && (udata == NULL))
-        turtleSpaceIsDirty = 1; /* put to backing store, must repaint... */
+        ctx->turtleSpaceIsDirty = 1; /* put to backing store, must repaint... */
 } /* TOBY_renderAllTurtles */
 
 
-static inline void putToScreen(void)
+void TOBY_renderChangedTurtles(TobyContext *ctx, void *udata)
 {
-    if (turtleSpaceIsDirty)
+    const TurtleArrays *turtles = &ctx->turtles;
+    Turtle turtle;
+    int i;
+
+    for (i = 0; i < turtles->changedCount; i++)
     {
-        TOBY_putToScreen();
-        turtleSpaceIsDirty = 0;
-    } /* if */
+        fillTurtle(turtles, turtles->changed[i], &turtle);
+        calculateTurtleTriangle(turtle.heading.x, turtle.heading.y,
+                                turtle.points);
+        ctx->callbacks.drawTurtle(ctx, &turtle, udata);
+    } /* for */
+} /* TOBY_renderChangedTurtles */
+
+
+int TOBY_getDirtyRect(TobyContext *ctx, TobyRect *rect)
+{
+    const TobyRect *dirty = &ctx->dirtyRect;
+    rect->x1 = (dirty->x1 < N(0)) ? N(0) : dirty->x1;
+    rect->y1 = (dirty->y1 < N(0)) ? N(0) : dirty->y1;
+    rect->x2 = (dirty->x2 > N(1000)) ? N(1000) : dirty->x2;
+    rect->y2 = (dirty->y2 > N(1000)) ? N(1000) : dirty->y2;
+    return ((rect->x1 <= rect->x2) && (rect->y1 <= rect->y2));
+} /* TOBY_getDirtyRect */
+
+
+/*
+ * Turtles that changed have to be erased where they were, and drawn where
+ *  they are. The ones that didn't change don't cost anything here.
+ */
+static void markTurtlesDirty(TobyContext *ctx)
+{
+    TurtleArrays *turtles = &ctx->turtles;
+    int i;
+
+    for (i = 0; i < turtles->changedCount; i++)
+    {
+        const int t = turtles->changed[i];
+        TobyRect *shown = &turtles->shown[t];
+        addRectToRect(&ctx->dirtyRect, shown);
+        clearRect(shown);
+        if (turtles->flags[t] & TURTLEFLAG_VISIBLE)
+        {
+            const lua_Number x = turtles->x[t];
+            const lua_Number y = turtles->y[t];
+            TurtlePoint pt[4];
+            calculateTurtleTriangle(turtles->headingX[t],
+                                    turtles->headingY[t], pt);
+            addPointToRect(shown, pt[0].x + x, pt[0].y + y);
+            addPointToRect(shown, pt[1].x + x, pt[1].y + y);
+            addPointToRect(shown, pt[2].x + x, pt[2].y + y);
+            addRectToRect(&ctx->dirtyRect, shown);
+        } /* if */
+    } /* for */
+} /* markTurtlesDirty */
+
+
+static void presentToScreen(TobyContext *ctx)
+{
+    TurtleArrays *turtles = &ctx->turtles;
+    int i;
+
+    flushDrawing(ctx);
+    markTurtlesDirty(ctx);
+    ctx->callbacks.putToScreen(ctx);
+
+    for (i = 0; i < turtles->changedCount; i++)
+        turtles->flags[turtles->changed[i]] &= ~TURTLEFLAG_CHANGED;
+    turtles->changedCount = 0;
+
+    clearRect(&ctx->dirtyRect);
+    ctx->turtleSpaceIsDirty = 0;
+} /* presentToScreen */
+
+
+static inline void putToScreen(TobyContext *ctx)
+{
+    if (ctx->turtleSpaceIsDirty)
+        presentToScreen(ctx);
 } /* putToScreen */
 
 
-static void setTurtleAngle(lua_State *L, lua_Number angle)
+static void setTurtleAngle(TobyContext *ctx, int t, lua_Number angle)
 {
-    Turtle *turtle = getTurtle(L);
-    if (angle != turtle->angle)
+    if (angle != ctx->turtles.angle[t])
     {
-        /* !!! FIXME: ugh, use modulus... */
-        while (angle >= N(360)) angle -= N(360);
-        while (angle < N(0)) angle += N(360);
-        turtle->angle = angle;
-        turtle->recalcPoints = 1;
-        if (turtle->visible)
-            turtleSpaceIsDirty = 1;
+        if ((angle >= N(360)) || (angle < N(0)))
+        {
+            angle = (lua_Number) fmod(angle, N(360));
+            if (angle < N(0))
+                angle += N(360);
+            if (angle >= N(360))  /* tiny negative angle rounded up. */
+                angle = N(0);
+        } /* if */
+        ctx->turtles.angle[t] = angle;
+        updateHeading(ctx, t);
+        turtleMoved(ctx, t);
     } /* if */
 } /* setTurtleAngle */
 
 
-static int luahook_setangle(lua_State *L)
+static int fastbuiltin_setangle(lua_State *L, const lua_Number *args,
+                                lua_Number *ret)
 {
-    setTurtleAngle(L, luaL_checknumber(L, 1));
+    setTurtleAngle(getContext(L), getTurtle(L), args[0]);
     return 0;
-} /* luahook_setangle */
+} /* fastbuiltin_setangle */
 
 
-static inline void turnTurtle(lua_State *L, lua_Number degree)
+static inline void turnTurtle(TobyContext *ctx, int t, lua_Number degree)
 {
-    Turtle *turtle = getTurtle(L);
     if (degree != N(0))
-        setTurtleAngle(L, turtle->angle + degree);
+        setTurtleAngle(ctx, t, ctx->turtles.angle[t] + degree);
 } /* turnTurtle */
 
 
-static int luahook_turnright(lua_State *L)
+static int fastbuiltin_turnright(lua_State *L, const lua_Number *args,
+                                 lua_Number *ret)
+{
+    turnTurtle(getContext(L), getTurtle(L), args[0]);
+    return 0;
+} /* fastbuiltin_turnright */
+
+
+static int fastbuiltin_turnleft(lua_State *L, const lua_Number *args,
+                                lua_Number *ret)
+{
+    turnTurtle(getContext(L), getTurtle(L), -args[0]);
+    return 0;
+} /* fastbuiltin_turnleft */
+
+
+static inline void testFence(lua_State *L, const TurtleArrays *turtles, int t)
+{
+    const lua_Number x = turtles->x[t];
+    const lua_Number y = turtles->y[t];
+    if ( !((x >= N(0)) && (x <= N(1000)) && (y >= N(0)) && (y <= N(1000))) )
+        throwError(L, "Turtle outside fence");  /* NaN is outside, too. */
+} /* testFence */
+
+
+/* Add a corner to the polygon being recorded by startPolygon(). */
+static void addPathPoint(lua_State *L, lua_Number x, lua_Number y)
+{
+    TobyContext *ctx = getContext(L);
+    if (((x - x) != N(0)) || ((y - y) != N(0)))  /* infinite, or NaN. */
+        throwError(L, "Polygon corner must be a finite number");
+
+    if (ctx->pathCount == ctx->pathAllocated)
+    {
+        const int newalloc = (ctx->pathAllocated * 2) + 16;
+        void *ptr = realloc(ctx->path, sizeof (TurtlePoint) * newalloc);
+        if (ptr == NULL)
+            throwError(L, "Out of memory");
+        ctx->path = (TurtlePoint *) ptr;
+        ctx->pathAllocated = newalloc;
+    } /* if */
+    ctx->path[ctx->pathCount].x = x;
+    ctx->path[ctx->pathCount].y = y;
+    ctx->pathCount++;
+} /* addPathPoint */
+
+
+static void setTurtleXY(lua_State *L, int t, lua_Number x, lua_Number y)
+{
+    TobyContext *ctx = getContext(L);
+    ctx->turtles.x[t] = x;
+    ctx->turtles.y[t] = y;
+    turtleMoved(ctx, t);
+
+    if (t == ctx->pathTurtle)
+        addPathPoint(L, x, y);
+
+    if (ctx->fenceEnabled)
+        testFence(L, &ctx->turtles, t);
+} /* setTurtleXY */
+
+
+static int fastbuiltin_setturtlexy(lua_State *L, const lua_Number *args,
+                                   lua_Number *ret)
+{
+    setTurtleXY(L, getTurtle(L), args[0], args[1]);
+    return 0;
+} /* fastbuiltin_setturtlexy */
+
+
+static int fastbuiltin_hometurtle(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
+{
+    setTurtleXY(L, getTurtle(L), N(500), N(500));
+    return 0;
+} /* fastbuiltin_hometurtle */
+
+
+/* Move turtle (t) along its heading, drawing only if (draw) and pen down. */
+static void moveTurtle(lua_State *L, int t, lua_Number distance, int draw)
+{
+    TobyContext *ctx = getContext(L);
+    const TurtleArrays *turtles = &ctx->turtles;
+    if (distance != N(0))
+    {
+        lua_Number x1 = turtles->x[t];
+        lua_Number y1 = turtles->y[t];
+        lua_Number unclipped_x2, unclipped_y2;
+        lua_Number x2, y2;
+        TurtlePoint heading;
+
+        heading.x = turtles->headingX[t];
+        heading.y = turtles->headingY[t];
+        calculateLine(&heading, distance, x1, y1, &x2, &y2);
+        unclipped_x2 = x2;
+        unclipped_y2 = y2;
+        /* draw the line covering path turtle took? */
+        if ((draw) && (turtles->flags[t] & TURTLEFLAG_PENDOWN))
+        {
+            /* only draw if SOMETHING is inside TurtleSpace... */
+            if (TOBY_clipLine(&x1, &y1, &x2, &y2, N(999), N(999)))
+            {
+                queueLine(ctx, x1, y1, x2, y2, &turtles->pen[t]);
+                recordLine(ctx, x1, y1, x2, y2, &turtles->pen[t]);
+                ctx->stats.segments++;
+                ctx->turtleSpaceIsDirty = 1;
+            } /* if */
+        } /* if */
+ 
+        setTurtleXY(L, t, unclipped_x2, unclipped_y2);
+    } /* if */
+} /* moveTurtle */
+
+
+static inline void driveTurtle(lua_State *L, int t, lua_Number distance)
+{
+    moveTurtle(L, t, distance, 1);
+} /* driveTurtle */
+
+
+static int fastbuiltin_goforward(lua_State *L, const lua_Number *args,
+                                 lua_Number *ret)
+{
+    driveTurtle(L, getTurtle(L), args[0]);
+    return 0;
+} /* fastbuiltin_goforward */
+
+
+static int fastbuiltin_gobackward(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
+{
+    driveTurtle(L, getTurtle(L), -args[0]);
+    return 0;
+} /* fastbuiltin_gobackward */
+
+
+/*
+ * The shape builtins draw with the current turtle exactly as the usual
+ *  goForward()/turnRight() loops would, leaving it wherever those would,
+ *  but without a trip through the interpreter for every step. The lines
+ *  all go out to the frontend in the same batches as any other lines.
+ *  The hook can't get in while they're running, so they call
+ *  shapeCheckpoint() every step to let frames and halts happen.
+ */
+static void shapeCheckpoint(lua_State *L);
+
+#define MAX_POLYGON_SIDES 100000
+
+/* One arc of at most a full turn; see arcTurtle(). */
+static void traceArc(lua_State *L, int t, lua_Number radius,
+                     lua_Number degrees, int draw)
+{
+    TobyContext *ctx = getContext(L);
+    const lua_Number total = (degrees < N(0)) ? -degrees : degrees;
+    const int steps = (int) ceil(total);
+    lua_Number step, half, chord;
+    int i;
+
+    if (steps == 0)
+        return;
+
+    step = degrees / ((lua_Number) steps);
+    half = degreesToRadians(total / ((lua_Number) steps)) / N(2);
+    chord = N(2) * radius * (lua_Number) sin(half);
+
+    /* bend halfway into each step, go along the chord, bend the rest. */
+    turnTurtle(ctx, t, step / N(2));
+    for (i = 0; i < steps; i++)
+    {
+        moveTurtle(L, t, chord, draw);
+        turnTurtle(ctx, t, (i < steps - 1) ? step : (step / N(2)));
+        shapeCheckpoint(L);
+    } /* for */
+} /* traceArc */
+
+
+/*
+ * Trace an arc of (radius), bending right by (degrees), or left if it's
+ *  negative: the turtle ends up (degrees) turned, on the far end of the
+ *  arc. It's drawn as chords of the circle, a degree apart at most. Past
+ *  a full turn, the arc only goes over what's already drawn, so the turtle
+ *  just moves along the rest of it, however many more turns it is.
+ */
+static void arcTurtle(lua_State *L, int t, lua_Number radius,
+                      lua_Number degrees)
+{
+    if ((radius - radius) != N(0))  /* infinite, or not a number. */
+        throwError(L, "Radius must be a finite number");
+    else if (radius < N(0))
+        throwError(L, "Radius can't be negative");
+    else if ((degrees - degrees) != N(0))
+        throwError(L, "Arc angle must be a finite number");
+
+    if ((degrees <= N(360)) && (degrees >= N(-360)))
+        traceArc(L, t, radius, degrees, 1);
+    else
+    {
+        traceArc(L, t, radius, (degrees < N(0)) ? N(-360) : N(360), 1);
+        traceArc(L, t, radius, (lua_Number) fmod(degrees, N(360)), 0);
+    } /* else */
+} /* arcTurtle */
+
+
+static int fastbuiltin_drawarc(lua_State *L, const lua_Number *args,
+                               lua_Number *ret)
+{
+    arcTurtle(L, getTurtle(L), args[0], args[1]);
+    return 0;
+} /* fastbuiltin_drawarc */
+
+
+static int fastbuiltin_drawcircle(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
+{
+    arcTurtle(L, getTurtle(L), args[0], N(360));
+    return 0;
+} /* fastbuiltin_drawcircle */
+
+
+/* goForward(length), turnRight(360 / sides), (sides) times. */
+static int fastbuiltin_drawpolygon(lua_State *L, const lua_Number *args,
+                                   lua_Number *ret)
+{
+    TobyContext *ctx = getContext(L);
+    const lua_Number length = args[1];
+    const int t = getTurtle(L);
+    lua_Number turn;
+    int sides, i;
+
+    if (args[0] < N(1))
+        throwError(L, "Polygons need at least one side");
+    else if (args[0] > ((lua_Number) MAX_POLYGON_SIDES))
+        throwError(L, "Too many sides for a polygon");
+    else if ((length - length) != N(0))  /* infinite, or not a number. */
+        throwError(L, "Side length must be a finite number");
+    sides = wholeNum(L, args[0]);
+
+    turn = N(360) / ((lua_Number) sides);
+    for (i = 0; i < sides; i++)
+    {
+        driveTurtle(L, t, length);
+        turnTurtle(ctx, t, turn);
+        shapeCheckpoint(L);
+    } /* for */
+    return 0;
+} /* fastbuiltin_drawpolygon */
+
+
+/*
+ * Filled shapes go to the frontend in one call each, so painting an area
+ *  doesn't mean stroking it a line at a time. They use the current
+ *  turtle's pen color.
+ */
+static void fillPolygon(lua_State *L, const TurtlePoint *pts, int count)
+{
+    TobyContext *ctx = getContext(L);
+    const TurtleRGB *pen = &ctx->turtles.pen[getTurtle(L)];
+    int i;
+
+    if (count < 3)
+        return;  /* no area to fill. */
+
+    flushDrawing(ctx);  /* keep lines under the fill if drawn before it. */
+    ctx->callbacks.fillPolygon(ctx, pts, count, pen->r, pen->g, pen->b);
+    for (i = 0; i < count; i++)
+        addPointToRect(&ctx->dirtyRect, pts[i].x, pts[i].y);
+    recordPolygon(ctx, pts, count, pen);
+    ctx->turtleSpaceIsDirty = 1;
+} /* fillPolygon */
+
+
+static int fastbuiltin_fillrect(lua_State *L, const lua_Number *args,
+                                lua_Number *ret)
+{
+    const lua_Number x1 = args[0];
+    const lua_Number y1 = args[1];
+    const lua_Number x2 = args[2];
+    const lua_Number y2 = args[3];
+    TurtlePoint pts[4];
+    if ( ((x1 - x1) != N(0)) || ((y1 - y1) != N(0)) ||  /* inf, or NaN. */
+         ((x2 - x2) != N(0)) || ((y2 - y2) != N(0)) )
+        throwError(L, "Rectangle corners must be finite numbers");
+    pts[0].x = x1; pts[0].y = y1;
+    pts[1].x = x2; pts[1].y = y1;
+    pts[2].x = x2; pts[2].y = y2;
+    pts[3].x = x1; pts[3].y = y2;
+    fillPolygon(L, pts, 4);
+    return 0;
+} /* fastbuiltin_fillrect */
+
+
+/* Start recording everywhere the current turtle goes, for fillPolygon(). */
+static int fastbuiltin_startpolygon(lua_State *L, const lua_Number *args,
+                                    lua_Number *ret)
 {
-    turnTurtle(L, luaL_checknumber(L, 1));
+    TobyContext *ctx = getContext(L);
+    const int t = getTurtle(L);
+    ctx->pathTurtle = t;
+    ctx->pathCount = 0;
+    addPathPoint(L, ctx->turtles.x[t], ctx->turtles.y[t]);
     return 0;
-} /* luahook_turnright */
+} /* fastbuiltin_startpolygon */
 
 
-static int luahook_turnleft(lua_State *L)
+/* Fill the path recorded since startPolygon(), and stop recording. */
+static int fastbuiltin_fillpolygon(lua_State *L, const lua_Number *args,
+                                   lua_Number *ret)
 {
-    turnTurtle(L, -luaL_checknumber(L, 1));
+    TobyContext *ctx = getContext(L);
+    if (ctx->pathTurtle < 0)
+        throwError(L, "No polygon started");
+    ctx->pathTurtle = -1;
+    fillPolygon(L, ctx->path, ctx->pathCount);
     return 0;
-} /* luahook_turnleft */
+} /* fastbuiltin_fillpolygon */
 
 
-static inline void testFence(lua_State *L, const Turtle *turtle)
+/*
+ * Plotting sets single pixels without going through a turtle, so programs
+ *  that draw an image pixel by pixel don't pay for the line math. Points
+ *  outside TurtleSpace are ignored.
+ */
+static inline void plotPoint(TobyContext *ctx, lua_Number x, lua_Number y,
+                             const TurtleRGB *color)
 {
-    const lua_Number x = turtle->pos.x;
-    const lua_Number y = turtle->pos.y;
-    if ( (x < N(0)) || (x > N(1000)) || (y < N(0)) || (y > N(1000)) )
-        throwError(L, "Turtle outside fence");
-} /* testFence */
+    if ((x >= N(0)) && (x < N(1000)) && (y >= N(0)) && (y < N(1000)))
+    {
+        queuePoint(ctx, x, y, color);
+        recordPoint(ctx, x, y, color);
+        ctx->stats.points++;
+        ctx->turtleSpaceIsDirty = 1;
+    } /* if */
+} /* plotPoint */
 
 
-static void setTurtleXY(lua_State *L, lua_Number x, lua_Number y)
+/* Set the pixel at (x,y) to the current turtle's pen color. */
+static int fastbuiltin_plot(lua_State *L, const lua_Number *args,
+                            lua_Number *ret)
 {
-    Turtle *turtle = getTurtle(L);
-    turtle->pos.x = x;
-    turtle->pos.y = y;
-
-    if (fenceEnabled)
-        testFence(L, turtle);
-} /* setTurtleXY */
+    TobyContext *ctx = getContext(L);
+    plotPoint(ctx, args[0], args[1], &ctx->turtles.pen[getTurtle(L)]);
+    return 0;
+} /* fastbuiltin_plot */
 
 
-static int luahook_setturtlexy(lua_State *L)
+/*
+ * Plot a whole row at (y): element (x) of the array is the color for (x,y),
+ *  as made by colorRGB(), for every x in TurtleSpace the array has.
+ */
+static int luahook_plotrow(lua_State *L)
 {
-    const lua_Number x = luaL_checknumber(L, 1);
-    const lua_Number y = luaL_checknumber(L, 2);
-    setTurtleXY(L, x, y);
+    TobyContext *ctx = getContext(L);
+    const lua_Number y = luaL_checknumber(L, 1);
+    TurtleRGB color;
+    int x;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if ((y < N(0)) || (y >= N(1000)))
+        return 0;
+
+    for (x = 0; x < 1000; x++)
+    {
+        lua_rawgeti(L, 2, x);
+        if (lua_isnumber(L, -1))
+        {
+            const unsigned int rgb = (unsigned int) lua_tointeger(L, -1);
+            color.r = (int) ((rgb >> 16) & 0xFF);
+            color.g = (int) ((rgb >> 8) & 0xFF);
+            color.b = (int) (rgb & 0xFF);
+            plotPoint(ctx, (lua_Number) x, y, &color);
+        } /* if */
+        lua_pop(L, 1);
+    } /* for */
     return 0;
-} /* luahook_setturtlexy */
+} /* luahook_plotrow */
 
 
-static int luahook_hometurtle(lua_State *L)
+/* Paint the area around the current turtle, up to where the color changes. */
+static int fastbuiltin_floodfill(lua_State *L, const lua_Number *args,
+                                 lua_Number *ret)
 {
-    setTurtleXY(L, N(500), N(500));
+    TobyContext *ctx = getContext(L);
+    const TurtleArrays *turtles = &ctx->turtles;
+    const int t = getTurtle(L);
+    const lua_Number x = turtles->x[t];
+    const lua_Number y = turtles->y[t];
+    const TurtleRGB *pen = &turtles->pen[t];
+
+    if ((x < N(0)) || (x >= N(1000)) || (y < N(0)) || (y >= N(1000)))
+        return 0;  /* nothing out there to fill. */
+
+    flushDrawing(ctx);  /* the lines are probably what it has to stop at. */
+    if (!ctx->callbacks.floodFill(ctx, x, y, pen->r, pen->g, pen->b))
+        throwError(L, "Platform doesn't support flood fills");
+
+    recordFloodFill(ctx, x, y, pen);
+    markAllDirty(ctx);  /* only the frontend knows how far it went. */
+    ctx->turtleSpaceIsDirty = 1;
     return 0;
-} /* luahook_hometurtle */
+} /* fastbuiltin_floodfill */
 
 
-static void driveTurtle(lua_State *L, lua_Number distance)
+/*
+ * The bulk versions of the movement functions take an optional range of
+ *  turtles after their usual arguments, first and last inclusive, and
+ *  work on every turtle if it's left out. They don't change the current
+ *  turtle. Swarms of turtles can move in one call this way, instead of
+ *  a useTurtle() and a call into here for every one of them.
+ */
+static void checkTurtleRange(lua_State *L, int idx, int *first, int *last)
 {
-    Turtle *turtle = getTurtle(L);
-    if (distance != N(0))
+    const int total = getContext(L)->turtles.count;
+    if (lua_isnoneornil(L, idx))
     {
-        lua_Number x1 = turtle->pos.x;
-        lua_Number y1 = turtle->pos.y;
-        lua_Number unclipped_x2, unclipped_y2;
-        lua_Number x2, y2;
- 
-        calculateLine(turtle->angle, distance, x1, y1, &x2, &y2);
-        unclipped_x2 = x2;
-        unclipped_y2 = y2;
-        if (turtle->penDown)   /* draw the line covering path turtle took? */
-        {
-            /* only draw if SOMETHING is inside TurtleSpace... */
-            if (TOBY_clipLine(&x1, &y1, &x2, &y2, N(999), N(999)))
-            {
-                const TurtleRGB *pen = &turtle->pen;
-                TOBY_drawLine(x1, y1, x2, y2, pen->r, pen->g, pen->b);
-                turtleSpaceIsDirty = 1;
-            } /* if */
-        } /* if */
- 
-        setTurtleXY(L, unclipped_x2, unclipped_y2);
+        *first = 0;
+        *last = total - 1;
     } /* if */
-} /* driveTurtle */
+    else
+    {
+        *first = checkWholeNum(L, idx);
+        *last = checkWholeNum(L, idx + 1);
+        if ((*first < 0) || (*last >= total) || (*first > *last))
+            throwError(L, "Not a valid range of turtles");
+    } /* else */
+} /* checkTurtleRange */
 
 
-static int luahook_goforward(lua_State *L)
+static void turnTurtles(lua_State *L, lua_Number degree, int first, int last)
 {
-    driveTurtle(L, luaL_checknumber(L, 1));
-    return 0;
-} /* luahook_goforward */
+    TobyContext *ctx = getContext(L);
+    int i;
+    for (i = first; i <= last; i++)
+        turnTurtle(ctx, i, degree);
+} /* turnTurtles */
 
 
-static int luahook_gobackward(lua_State *L)
+static void driveTurtles(lua_State *L, lua_Number distance,
+                         int first, int last)
 {
-    driveTurtle(L, -luaL_checknumber(L, 1));
-    return 0;
-} /* luahook_gobackward */
+    int i;
+    for (i = first; i <= last; i++)
+        driveTurtle(L, i, distance);
+} /* driveTurtles */
 
 
-static int luahook_getturtlex(lua_State *L)
+static void setTurtlesAngle(lua_State *L, lua_Number angle,
+                            int first, int last)
 {
-    lua_pushnumber(L, getTurtle(L)->pos.x);
+    TobyContext *ctx = getContext(L);
+    int i;
+    for (i = first; i <= last; i++)
+        setTurtleAngle(ctx, i, angle);
+} /* setTurtlesAngle */
+
+
+/*
+ * Without a range, these have fast paths that work on every turtle; with
+ *  one, they go the usual way.
+ */
+#define BULK_BUILTIN(sym, func, sign) \
+    static int fastbuiltin_##sym(lua_State *L, const lua_Number *args, \
+                                 lua_Number *ret) \
+    { \
+        func(L, sign args[0], 0, getContext(L)->turtles.count - 1); \
+        return 0; \
+    } \
+    static int luahook_##sym(lua_State *L) \
+    { \
+        const lua_Number num = luaL_checknumber(L, 1); \
+        int first, last; \
+        checkTurtleRange(L, 2, &first, &last); \
+        func(L, sign num, first, last); \
+        return 0; \
+    }
+BULK_BUILTIN(goforwardall, driveTurtles, +)
+BULK_BUILTIN(gobackwardall, driveTurtles, -)
+BULK_BUILTIN(turnrightall, turnTurtles, +)
+BULK_BUILTIN(turnleftall, turnTurtles, -)
+BULK_BUILTIN(setangleall, setTurtlesAngle, +)
+#undef BULK_BUILTIN
+
+
+static int fastbuiltin_getturtlex(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
+{
+    *ret = getContext(L)->turtles.x[getTurtle(L)];
     return 1;
-} /* luahook_getturtlex */
+} /* fastbuiltin_getturtlex */
 
 
-static int luahook_getturtley(lua_State *L)
+static int fastbuiltin_getturtley(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
 {
-    lua_pushnumber(L, getTurtle(L)->pos.y);
+    *ret = getContext(L)->turtles.y[getTurtle(L)];
     return 1;
-} /* luahook_getturtley */
+} /* fastbuiltin_getturtley */
 
 
-static int luahook_getturtlespacewidth(lua_State *L)
+static int fastbuiltin_getturtlespacewidth(lua_State *L, const lua_Number *args,
+                                           lua_Number *ret)
 {
-    lua_pushnumber(L, N(1000));   /* !!! FIXME: allow this to change? */
+    *ret = N(1000);   /* !!! FIXME: allow this to change? */
     return 1;
-} /* luahook_getturtlespacewidth */
+} /* fastbuiltin_getturtlespacewidth */
 
 
-static int luahook_getturtlespaceheight(lua_State *L)
+static int fastbuiltin_getturtlespaceheight(lua_State *L,
+                                            const lua_Number *args,
+                                            lua_Number *ret)
 {
-    lua_pushnumber(L, N(1000));   /* !!! FIXME: allow this to change? */
+    *ret = N(1000);   /* !!! FIXME: allow this to change? */
     return 1;
-} /* luahook_getturtlespaceheight */
+} /* fastbuiltin_getturtlespaceheight */
 
 
-static int luahook_setpenup(lua_State *L)
+static int fastbuiltin_setpenup(lua_State *L, const lua_Number *args,
+                                lua_Number *ret)
 {
-    getTurtle(L)->penDown = 0;
+    getContext(L)->turtles.flags[getTurtle(L)] &= ~TURTLEFLAG_PENDOWN;
     return 0;
-} /* luahook_setpenup */
+} /* fastbuiltin_setpenup */
 
 
-static int luahook_setpendown(lua_State *L)
+static int fastbuiltin_setpendown(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
 {
-    getTurtle(L)->penDown = 1;
+    getContext(L)->turtles.flags[getTurtle(L)] |= TURTLEFLAG_PENDOWN;
     return 0;
-} /* luahook_setpendown */
+} /* fastbuiltin_setpendown */
 
 
 static inline void setPenColorRGB(lua_State *L, int r, int g, int b)
 {
-    TurtleRGB *pen = &(getTurtle(L)->pen);
+    TurtleRGB *pen = &getContext(L)->turtles.pen[getTurtle(L)];
     pen->r = r;
     pen->g = g;
     pen->b = b;
 } /* setPenColorRGB */
 
 
-static int luahook_setpencolorrgb(lua_State *L)
+/* Check r, g and b, in (rgb), and convert to 0 to 255. */
+static void colorRGB(lua_State *L, const lua_Number *rgb, TurtleRGB *color)
 {
-    const lua_Number r = luaL_checknumber(L, 1);
-    const lua_Number g = luaL_checknumber(L, 2);
-    const lua_Number b = luaL_checknumber(L, 3);
+    const lua_Number r = rgb[0];
+    const lua_Number g = rgb[1];
+    const lua_Number b = rgb[2];
 
     if ( (r < N(0)) || (r > N(1)) )
         throwError(L, "Red value is not between 0.0 and 1.0");
@@ -491,14 +1737,36 @@ static int luahook_setpencolorrgb(lua_State *L)
         throwError(L, "Green value is not between 0.0 and 1.0");
     else if ( (b < N(0)) || (b > N(1)) )
         throwError(L, "Blue value is not between 0.0 and 1.0");
-    else
-        setPenColorRGB(L, to8bit(r), to8bit(g), to8bit(b));
 
+    color->r = to8bit(r);
+    color->g = to8bit(g);
+    color->b = to8bit(b);
+} /* colorRGB */
+
+
+static int fastbuiltin_setpencolorrgb(lua_State *L, const lua_Number *args,
+                                      lua_Number *ret)
+{
+    TurtleRGB color;
+    colorRGB(L, args, &color);
+    setPenColorRGB(L, color.r, color.g, color.b);
     return 0;
-} /* luahook_setpencolorrgb */
+} /* fastbuiltin_setpencolorrgb */
+
+
+/* Pack r,g,b (0.0 to 1.0 each, like setPenColorRGB()) into one number. */
+static int fastbuiltin_colorrgb(lua_State *L, const lua_Number *args,
+                                lua_Number *ret)
+{
+    TurtleRGB color;
+    colorRGB(L, args, &color);
+    *ret = (lua_Number) ((color.r << 16) | (color.g << 8) | color.b);
+    return 1;
+} /* fastbuiltin_colorrgb */
 
 
-static int luahook_setpencolor(lua_State *L)
+static int fastbuiltin_setpencolor(lua_State *L, const lua_Number *args,
+                                   lua_Number *ret)
 {
     /*
      * How I got these numbers:
@@ -527,66 +1795,76 @@ static int luahook_setpencolor(lua_State *L)
         { 255, 255, 255 }, /* bright white */
     };
 
-    const int color = checkWholeNum(L, 1);
+    const int color = wholeNum(L, args[0]);
     if ( (color < 0) || (color >= (STATICARRAYLEN(colors))) )
         throwError(L, "Color value is not between 0 and 15");
     else
         setPenColorRGB(L, colors[color].r, colors[color].g, colors[color].b);
     return 0;
-} /* luahook_setpencolor */
+} /* fastbuiltin_setpencolor */
 
 
-static int luahook_showturtle(lua_State *L)
+static int fastbuiltin_showturtle(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
 {
-    Turtle *turtle = getTurtle(L);
-    if (!turtle->visible)
+    TobyContext *ctx = getContext(L);
+    const int t = getTurtle(L);
+    if ((ctx->turtles.flags[t] & TURTLEFLAG_VISIBLE) == 0)
     {
-        turtle->visible = 1;
-        turtleSpaceIsDirty = 1;
+        ctx->turtles.flags[t] |= TURTLEFLAG_VISIBLE;
+        turtleChanged(ctx, t);
     } /* if */
     return 0;
-} /* luahook_showturtle */
+} /* fastbuiltin_showturtle */
 
 
-static int luahook_hideturtle(lua_State *L)
+static int fastbuiltin_hideturtle(lua_State *L, const lua_Number *args,
+                                  lua_Number *ret)
 {
-    Turtle *turtle = getTurtle(L);
-    if (turtle->visible)
+    TobyContext *ctx = getContext(L);
+    const int t = getTurtle(L);
+    if (ctx->turtles.flags[t] & TURTLEFLAG_VISIBLE)
     {
-        turtle->visible = 0;
-        turtleSpaceIsDirty = 1;
+        ctx->turtles.flags[t] &= ~TURTLEFLAG_VISIBLE;
+        turtleChanged(ctx, t);  /* still has to be erased. */
     } /* if */
     return 0;
-} /* luahook_hideturtle */
+} /* fastbuiltin_hideturtle */
 
 
-static int luahook_enablefence(lua_State *L)
+static int fastbuiltin_enablefence(lua_State *L, const lua_Number *args,
+                                   lua_Number *ret)
 {
+    TobyContext *ctx = getContext(L);
     int i;
 
-    fenceEnabled = 1;
+    ctx->fenceEnabled = 1;
 
-    for (i = 0; i < totalTurtles; i++)
-        testFence(L, &turtles[i]);
+    for (i = 0; i < ctx->turtles.count; i++)
+        testFence(L, &ctx->turtles, i);
 
     return 0;
-} /* luahook_enablefence */
+} /* fastbuiltin_enablefence */
 
 
-static int luahook_disablefence(lua_State *L)
+static int fastbuiltin_disablefence(lua_State *L, const lua_Number *args,
+                                    lua_Number *ret)
 {
-    fenceEnabled = 0;
+    TobyContext *ctx = getContext(L);
+    ctx->fenceEnabled = 0;
     return 0;
-} /* luahook_disablefence */
+} /* fastbuiltin_disablefence */
 
 
-static int luahook_cleanupturtlespace(lua_State *L)
+static int fastbuiltin_cleanupturtlespace(lua_State *L, const lua_Number *args,
+                                          lua_Number *ret)
 {
+    TobyContext *ctx = getContext(L);
     /* !!! FIXME: let user choose color? */
-    TOBY_cleanup(background.r, background.g, background.b);
-    turtleSpaceIsDirty = 1;
+    cleanup(ctx);
+    ctx->turtleSpaceIsDirty = 1;
     return 0;
-} /* luahook_getturtlespaceheight */
+} /* fastbuiltin_cleanupturtlespace */
 
 
 /* !!! FIXME: all must handle utf8.... */
@@ -698,20 +1976,28 @@ static int luahook_lowercasestring(lua_State *L)
 
 static int luahook_drawstring(lua_State *L)
 {
-    const Turtle *turtle = getTurtle(L);
+    TobyContext *ctx = getContext(L);
+    const TurtleArrays *turtles = &ctx->turtles;
+    const int t = getTurtle(L);
+    const TurtleRGB *pen = &turtles->pen[t];
     const char *utf8str = luaL_checklstring(L, 1, NULL);
-    if (!TOBY_drawString(turtle->pos.x, turtle->pos.y, utf8str, turtle->angle,
-                         turtle->pen.r, turtle->pen.g, turtle->pen.b))
+    flushDrawing(ctx);  /* keep lines under the string if drawn before it. */
+    if (!ctx->callbacks.drawString(ctx, turtles->x[t], turtles->y[t], utf8str,
+                                   turtles->angle[t], pen->r, pen->g, pen->b))
     {
         throwError(L, "Platform doesn't support string drawing");
     } /* if */
 
-    turtleSpaceIsDirty = 1;
+    recordString(ctx, t, utf8str);
+    markAllDirty(ctx);  /* only the frontend knows the font. */
+    ctx->stats.strings++;
+    ctx->turtleSpaceIsDirty = 1;
     return 0;
 } /* luahook_drawstring */
 
 
-static int luahook_random(lua_State *L)
+static int fastbuiltin_random(lua_State *L, const lua_Number *args,
+                              lua_Number *ret)
 {
 #ifdef _MSC_VER
     const long val = rand();  /* !!! FIXME: seed this. */
@@ -721,64 +2007,68 @@ static int luahook_random(lua_State *L)
     /* !!! FIXME: fixed point */
     /* !!! FIXME: nasty double code. */
     const lua_Number flt = (lua_Number) (((double)val) / ((double)RAND_MAX));
-    lua_pushnumber(L, flt);
+    *ret = flt;
     return 1;
-} /* luahook_random */
+} /* fastbuiltin_random */
 
 
-static int luahook_round(lua_State *L)
+static int fastbuiltin_round(lua_State *L, const lua_Number *args,
+                             lua_Number *ret)
 {
     /* !!! FIXME: fixed point. */
-    lua_pushinteger(L, (lua_Integer) (luaL_checknumber(L, 1) + 0.5));
+    *ret = (lua_Number) ((lua_Integer) (args[0] + 0.5));
     return 1;
-} /* luahook_setpendown */
+} /* fastbuiltin_round */
 
 
-int TOBY_delay(long ms)
+int TOBY_delay(TobyContext *ctx, long ms)
 {
-    long now = TOBY_getTicks();
+    long now = ctx->callbacks.getTicks(ctx);
     const long end = now + ms;
     do
     {
-        TOBY_pumpEvents();
-        now = TOBY_getTicks();
+        ctx->callbacks.pumpEvents(ctx);
+        now = ctx->callbacks.getTicks(ctx);
         if (now < end)
         {
             const long ticks = end - now;
-            TOBY_yieldCPU((ticks > 50) ? 50 : ticks);
-            now = TOBY_getTicks();
+            ctx->callbacks.yieldCPU(ctx, (ticks > 50) ? 50 : ticks);
+            now = ctx->callbacks.getTicks(ctx);
         } /* if */
     } while (now < end);
 
-    return (TOBY_isRunning() && !TOBY_isStopping());
+    return (TOBY_isRunning(ctx) && !TOBY_isStopping(ctx));
 } /* TOBY_delay */
 
 
-static int luahook_pause(lua_State *L)
+static int fastbuiltin_pause(lua_State *L, const lua_Number *args,
+                             lua_Number *ret)
 {
-    const lua_Number secs = luaL_checknumber(L, 1);
-    if (!TOBY_delay(secsToMs(secs)))
+    if (!TOBY_delay(getContext(L), secsToMs(args[0])))
         haltProgram(L);
     return 0;
-} /* luahook_pause */
+} /* fastbuiltin_pause */
 
 
-static int luahook_addturtle(lua_State *L)
+static int fastbuiltin_addturtle(lua_State *L, const lua_Number *args,
+                                 lua_Number *ret)
 {
     allocateTurtle(L);
     return 0;
-} /* luahook_addturtle */
+} /* fastbuiltin_addturtle */
 
 
-static int luahook_useturtle(lua_State *L)
+static int fastbuiltin_useturtle(lua_State *L, const lua_Number *args,
+                                 lua_Number *ret)
 {
-    const int newidx = checkWholeNum(L, 1);
-    if ((newidx < 0) || (newidx >= totalTurtles))
+    TobyContext *ctx = getContext(L);
+    const int newidx = wholeNum(L, args[0]);
+    if ((newidx < 0) || (newidx >= ctx->turtles.count))
         throwError(L, "Not a valid turtle");
 
-    currentTurtleIndex = newidx;
+    ctx->currentTurtleIndex = newidx;
     return 0;
-} /* luahook_useturtle */
+} /* fastbuiltin_useturtle */
 
 
 static int luahook_print(lua_State *L)
@@ -788,47 +2078,56 @@ static int luahook_print(lua_State *L)
 } /* luahook_print */
 
 
+/* Every builtin with a fast path, and how many numbers that takes. */
+#define FAST_BUILTINS(X) \
+    X(showturtle, 0) X(hideturtle, 0) X(hometurtle, 0) X(enablefence, 0) \
+    X(disablefence, 0) X(random, 0) X(getturtlespacewidth, 0) \
+    X(getturtlespaceheight, 0) X(getturtlex, 0) X(getturtley, 0) \
+    X(cleanupturtlespace, 0) X(setpencolorrgb, 3) X(setpenup, 0) \
+    X(setpendown, 0) X(addturtle, 0) X(useturtle, 1) X(round, 1) \
+    X(pause, 1) X(setangle, 1) X(goforward, 1) X(gobackward, 1) \
+    X(turnright, 1) X(turnleft, 1) X(drawarc, 2) X(drawcircle, 1) \
+    X(drawpolygon, 2) X(fillrect, 4) X(startpolygon, 0) \
+    X(fillpolygon, 0) X(floodfill, 0) X(plot, 2) X(colorrgb, 3) \
+    X(setpencolor, 1) X(setturtlexy, 2)
+
+#define FAST_LUAHOOK(sym, nargs) \
+    static int luahook_##sym(lua_State *L) \
+    { \
+        return callFastBuiltin(L, fastbuiltin_##sym, nargs); \
+    }
+FAST_BUILTINS(FAST_LUAHOOK)
+#undef FAST_LUAHOOK
+
 static void add_toby_functions(lua_State *L)
 {
-    #define SET_LUAHOOK(sym) \
-        lua_pushcfunction(L, luahook_##sym); \
-        lua_setglobal(L, #sym);
-    SET_LUAHOOK(showturtle);
-    SET_LUAHOOK(hideturtle);
-    SET_LUAHOOK(hometurtle);
-    SET_LUAHOOK(enablefence);
-    SET_LUAHOOK(disablefence);
-    SET_LUAHOOK(drawstring);
-    SET_LUAHOOK(random);
-    SET_LUAHOOK(getturtlespacewidth);
-    SET_LUAHOOK(getturtlespaceheight);
-    SET_LUAHOOK(getturtlex);
-    SET_LUAHOOK(getturtley);
-    SET_LUAHOOK(cleanupturtlespace);
-    SET_LUAHOOK(setpencolorrgb);
-    SET_LUAHOOK(setpenup);
-    SET_LUAHOOK(setpendown);
-    SET_LUAHOOK(addturtle);
-    SET_LUAHOOK(useturtle);
-    SET_LUAHOOK(round);
-    SET_LUAHOOK(stringlength);
-    SET_LUAHOOK(rightstring);
-    SET_LUAHOOK(leftstring);
-    SET_LUAHOOK(substring);
-    SET_LUAHOOK(uppercasestring);
-    SET_LUAHOOK(lowercasestring);
-    SET_LUAHOOK(joinstrings);
-    SET_LUAHOOK(pause);
-    SET_LUAHOOK(setangle);
-    SET_LUAHOOK(goforward);
-    SET_LUAHOOK(gobackward);
-    SET_LUAHOOK(turnright);
-    SET_LUAHOOK(turnleft);
-    SET_LUAHOOK(setpencolor);
-    SET_LUAHOOK(setturtlexy);
-    SET_LUAHOOK(print);
-    #undef SET_LUAHOOK
-}
+    static const lua_CFunction builtins[] =
+    {
+        #define TOBY_BUILTIN(sym) luahook_##sym,
+        TOBY_BUILTINS(TOBY_BUILTIN)
+        #undef TOBY_BUILTIN
+    };
+    static const TobyFastPath fast[] =
+    {
+        #define FAST_BUILTIN(sym, nargs) { #sym, fastbuiltin_##sym, nargs },
+        FAST_BUILTINS(FAST_BUILTIN)
+        FAST_BUILTIN(goforwardall, 1)  /* the bulk movers, without a range. */
+        FAST_BUILTIN(gobackwardall, 1)
+        FAST_BUILTIN(turnrightall, 1)
+        FAST_BUILTIN(turnleftall, 1)
+        FAST_BUILTIN(setangleall, 1)
+        #undef FAST_BUILTIN
+    };
+    TOBY_setBuiltins(L, builtins, fast, STATICARRAYLEN(fast));
+} /* add_toby_functions */
+
+
+static int luahook_fatal(lua_State *L)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
+            lua_tostring(L, -1));
+    return 0;
+} /* luahook_fatal */
 
 
 static int luahook_stackwalk(lua_State *L)
@@ -905,93 +2204,182 @@ static int luahook_stackwalk(lua_State *L)
 } /* luahook_stackwalk */
 
 
-static int *breakpointLines = NULL;
-static int breakpointLineCount = 0;
+static void luaDebugHook(lua_State *L, lua_Debug *ar);
 
-void TOBY_clearAllBreakpoints(void)
+/*
+ * The line hook costs a callback on every source line, so it's only
+ *  installed while something actually needs to look at each line:
+ *  single-stepping or a per-line delay. Breakpoints don't need it; they're
+ *  traps patched into the program's code (see toby_trap.c).
+ */
+static inline int debugHookMask(TobyContext *ctx)
 {
-    free(breakpointLines);
-    breakpointLines = NULL;
-    breakpointLineCount = 0;
-} /* TOBY_clearAllBreakpoints */
+    int retval = 0;
+    if ((ctx->delayPerLine > 0) || (ctx->execState == EXEC_STEPPING))
+        retval |= LUA_MASKLINE;
+    if (ctx->countInstructions)
+        retval |= LUA_MASKCOUNT;  /* every instruction; see luaDebugHook(). */
+    return retval;
+} /* debugHookMask */
+
+
+/*
+ * Call this whenever anything debugHookMask() looks at changes, but only on
+ *  the program's own thread: the run controls can be called from any
+ *  thread, so they just change the state, and the hook picks that up at
+ *  the next frame (see waitWhilePaused()).
+ */
+static void updateDebugHook(TobyContext *ctx)
+{
+    if (ctx->luaState != NULL)
+        lua_sethook(ctx->luaState, luaDebugHook, debugHookMask(ctx), 1);
+} /* updateDebugHook */
 
 
-int TOBY_addBreakpointLine(int line)
+/*
+ * Make the interpreter call luaDebugHook() before its next instruction.
+ *  Lua allows lua_sethook() from another thread, so the watchdog does this
+ *  once a frame, and the hook puts the mask back when it runs. Between
+ *  frames the program runs with no count hook at all.
+ */
+static inline void armDebugHook(TobyContext *ctx)
 {
-    const size_t newSize = sizeof (int) * (breakpointLineCount + 1);
-    void *ptr = realloc(breakpointLines, newSize);
-    if (ptr == NULL)
-        return -1;
+    lua_sethook(ctx->luaState, luaDebugHook,
+                debugHookMask(ctx) | LUA_MASKCOUNT, 1);
+} /* armDebugHook */
 
-    /* !!! FIXME: sort into array, don't append. */
-    /* !!! FIXME: make sure it's not already in the array. */
-    breakpointLines = (int *) ptr;
-    breakpointLines[breakpointLineCount++] = line;
-    return breakpointLineCount-1;
-} /* TOBY_addBreakpointLine */
 
+/*
+ * A frame every WATCHDOG_TICKS, or right away if someone wakes us up to
+ *  halt the program, so stopping doesn't wait for the rest of the frame.
+ */
+static void watchdog(void *data)
+{
+    TobyContext *ctx = (TobyContext *) data;
+    for (;;)
+    {
+        TOBY_waitEvent(ctx->watchdogWake, WATCHDOG_TICKS);
+        if (ctx->watchdogQuit)
+            break;
+        ctx->frameDue = 1;
+        armDebugHook(ctx);
+    } /* for */
+} /* watchdog */
+
+
+static int startWatchdog(TobyContext *ctx)
+{
+    ctx->watchdogQuit = 0;
+    ctx->watchdogThread = TOBY_createThread(watchdog, ctx);
+    return (ctx->watchdogThread != NULL);
+} /* startWatchdog */
 
-static int isBreakpointLine(int line)
+
+static void stopWatchdog(TobyContext *ctx)
 {
-    int retval = -1;
-    if (breakpointLines != NULL)
+    if (ctx->watchdogThread != NULL)
     {
-        int i;  /* !!! FIXME: don't do a linear search here... */
-        for (i = 0; i < breakpointLineCount; i++)
-        {
-            if (breakpointLines[i] == line)
-                return i;
-        } /* for */
+        ctx->watchdogQuit = 1;
+        TOBY_signalEvent(ctx->watchdogWake);
+        TOBY_waitThread(ctx->watchdogThread);
+        ctx->watchdogThread = NULL;
     } /* if */
+} /* stopWatchdog */
 
-    return retval;
-} /* isBreakpointLine */
 
+void TOBY_clearAllBreakpoints(TobyContext *ctx)
+{
+    free(ctx->breakpointLines);
+    ctx->breakpointLines = NULL;
+    ctx->breakpointLineCount = 0;
+    if (ctx->luaState != NULL)
+        TOBY_clearAllTraps(ctx->luaState);
+} /* TOBY_clearAllBreakpoints */
 
-static void luaDebugHook(lua_State *L, lua_Debug *ar)
+
+/* Returns index where (line) is, or where it would be inserted if not. */
+static int findBreakpointLine(TobyContext *ctx, int line)
 {
-    const int hook = ar->event;
-    const int line = ar->currentline;
-    const long startTicks = TOBY_getTicks();
-    long pauseTicks = -1;
-    int breakpoint = -1;
-    int shouldRedraw = (startTicks >= nextPumpTicks);
+    int lo = 0;
+    int hi = ctx->breakpointLineCount;
+    while (lo < hi)
+    {
+        const int mid = lo + ((hi - lo) / 2);
+        if (ctx->breakpointLines[mid] < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } /* while */
+    return lo;
+} /* findBreakpointLine */
 
-    /*
-     * Should only break inside this function, and should block here until
-     *  breakpoint ends and program continues.
-     */
-    assert(!TOBY_isPaused());
 
-    /* If we hit a new line, see if this is a breakpoint. Pause here if so. */
-    if (hook == LUA_HOOKLINE)
+int TOBY_addBreakpointLine(TobyContext *ctx, int line)
+{
+    const int idx = findBreakpointLine(ctx, line);
+    void *ptr;
+
+    if ((idx < ctx->breakpointLineCount) && (ctx->breakpointLines[idx] == line))
+        return idx;  /* already have it. */
+
+    ptr = realloc(ctx->breakpointLines,
+                  sizeof (int) * (ctx->breakpointLineCount + 1));
+    if (ptr == NULL)
+        return -1;
+
+    if ((ctx->luaState != NULL) && (TOBY_setLineTraps(ctx->luaState, line) < 0))
     {
-        const long mustDelay = TOBY_getDelayTicksPerLine();
-        /*printf("Now on line #%d\n", line);*/
-        if (mustDelay > 0)
-            pauseTicks = startTicks + mustDelay;
-        if (TOBY_isStepping())  /* single stepping? Break here. */
-            execState = EXEC_PAUSED;
-        if ((breakpoint = isBreakpointLine(line)) != -1)
-            execState = EXEC_PAUSED;
+        TOBY_clearLineTraps(ctx->luaState, line);
+        ctx->breakpointLines = (int *) ptr;
+        return -1;
     } /* if */
 
-    /* !!! FIXME: maybe later. */
-    #if 0
-    if (hook == LUA_HOOKCALL)
+    ctx->breakpointLines = (int *) ptr;
+    memmove(&ctx->breakpointLines[idx+1], &ctx->breakpointLines[idx],
+            sizeof (int) * (ctx->breakpointLineCount - idx));
+    ctx->breakpointLines[idx] = line;
+    ctx->breakpointLineCount++;
+    return idx;
+} /* TOBY_addBreakpointLine */
+
+
+static int isBreakpointLine(TobyContext *ctx, int line)
+{
+    const int idx = findBreakpointLine(ctx, line);
+    if ((idx < ctx->breakpointLineCount) && (ctx->breakpointLines[idx] == line))
+        return idx;
+    return -1;
+} /* isBreakpointLine */
+
+
+/* Patch traps for all current breakpoints into a newly-loaded program. */
+static int setBreakpointTraps(lua_State *L)
+{
+    TobyContext *ctx = getContext(L);
+    int i;
+    for (i = 0; i < ctx->breakpointLineCount; i++)
     {
-        if (breakpoint == -1)
-        {
-            if ((breakpoint = isBreakpointFunc(ar)) != -1)
-                execState = EXEC_PAUSED;
-        } /* if */
-    } /* if */
-    #endif
+        if (TOBY_setLineTraps(L, ctx->breakpointLines[i]) < 0)
+            return 0;
+    } /* for */
+    return 1;
+} /* setBreakpointTraps */
 
-    if ((TOBY_isPaused()) || (pauseTicks > 0))
-        TOBY_pauseReached(line, TOBY_isPaused(), breakpoint, pauseTicks);
 
-    while ( (TOBY_isPaused()) || (pauseTicks > 0) || (shouldRedraw) )
+/*
+ * Block until the user continues (if paused) and any per-line delay has
+ *  passed, keeping the screen and event queue alive in the meantime.
+ */
+static void waitWhilePaused(TobyContext *ctx, lua_State *L, int line,
+                            int breakpoint, long pauseTicks, int shouldRedraw)
+{
+    if ((TOBY_isPaused(ctx)) || (pauseTicks > 0))
+    {
+        ctx->callbacks.pauseReached(ctx, line, TOBY_isPaused(ctx),
+                                    breakpoint, pauseTicks);
+    } /* if */
+
+    while ( (TOBY_isPaused(ctx)) || (pauseTicks > 0) || (shouldRedraw) )
     {
         if (shouldRedraw)
         {
@@ -1000,45 +2388,145 @@ static void luaDebugHook(lua_State *L, lua_Debug *ar)
              *  but the overall execution of the program will be much faster,
              *  as rendering primitives will batch.
              */
-            putToScreen();
-            nextPumpTicks = TOBY_getTicks() + 50;
+            putToScreen(ctx);
             shouldRedraw = 0;  /* only redraw once if spinning. */
         } /* if */
 
         /*
          * Pump the system event queue. This only happens if we're delaying
-         *  or it's been >= 50ms since the last pump.
+         *  or the watchdog says it's been a frame since the last pump.
          */
-        TOBY_pumpEvents();
+        ctx->callbacks.pumpEvents(ctx);
 
         if (pauseTicks > 0)  /* we're just slowing down this run. */
         {
-            const long now = TOBY_getTicks();
+            const long now = ctx->callbacks.getTicks(ctx);
             if (now >= pauseTicks)
                 pauseTicks = -1;
             else
             {
                 const long remain = pauseTicks - now;
                 const long lagTicks = ((remain > 10) ? 10 : remain);
-                TOBY_yieldCPU(lagTicks);
+                ctx->callbacks.yieldCPU(ctx, lagTicks);
             } /* else */
         } /* if */
 
-        else if (TOBY_isPaused())
+        else if (TOBY_isPaused(ctx))
         {
-            TOBY_yieldCPU(50);  /* we're apparently spinning on the user. */
+            /* we're apparently spinning on the user. */
+            ctx->callbacks.yieldCPU(ctx, 50);
         } /* else if */
     } /* while */
 
-    if (TOBY_isStopping())
+    updateDebugHook(ctx);  /* in case we're stepping or delaying now. */
+
+    if (TOBY_isStopping(ctx))
+        haltProgram(L);
+} /* waitWhilePaused */
+
+
+static void shapeCheckpoint(lua_State *L)
+{
+    TobyContext *ctx = getContext(L);
+    if (ctx->frameDue)  /* do what the hook would have done. */
+    {
+        ctx->frameDue = 0;
+        waitWhilePaused(ctx, L, -1, -1, -1, 1);
+    } /* if */
+    else if (TOBY_isStopping(ctx))
         haltProgram(L);
+} /* shapeCheckpoint */
+
+
+/* The program reached a breakpoint's trap. */
+static void breakpointReached(lua_State *L, int line)
+{
+    TobyContext *ctx = getContext(L);
+
+    /*
+     * If single-stepping just stopped on this line, the user already saw
+     *  it; the trap on the same instruction shouldn't stop them again.
+     */
+    if (ctx->steppedOntoLine == line)
+        ctx->steppedOntoLine = -1;
+    else
+    {
+        assert(!TOBY_isPaused(ctx));
+        ctx->execState = EXEC_PAUSED;
+        waitWhilePaused(ctx, L, line, isBreakpointLine(ctx, line), -1, 1);
+    } /* else */
+} /* breakpointReached */
+
+
+static void luaDebugHook(lua_State *L, lua_Debug *ar)
+{
+    TobyContext *ctx = getContext(L);
+    const int hook = ar->event;
+    const int line = ar->currentline;
+    long startTicks;
+    long pauseTicks = -1;
+    int breakpoint = -1;
+    int shouldRedraw = 0;
+
+    /* Counting instructions calls us for every one, so get out quickly. */
+    if ((hook == LUA_HOOKCOUNT) && (ctx->countInstructions))
+    {
+        ctx->stats.instructions++;
+        if ((!ctx->frameDue) && (ctx->execState == EXEC_RUNNING))
+            return;
+    } /* if */
+
+    startTicks = ctx->callbacks.getTicks(ctx);
+
+    /*
+     * Should only break inside this function, and should block here until
+     *  breakpoint ends and program continues.
+     */
+    assert(!TOBY_isPaused(ctx));
+
+    /* The watchdog armed a one-shot count hook: time for a new frame. */
+    if ((hook == LUA_HOOKCOUNT) && (ctx->frameDue))
+    {
+        ctx->frameDue = 0;
+        shouldRedraw = 1;  /* waitWhilePaused() puts the mask back. */
+    } /* if */
+
+    /* If we hit a new line, see if we're stepping. Pause here if so. */
+    if (hook == LUA_HOOKLINE)
+    {
+        const long mustDelay = TOBY_getDelayTicksPerLine(ctx);
+        /*printf("Now on line #%d\n", line);*/
+        ctx->steppedOntoLine = -1;
+        if (mustDelay > 0)
+            pauseTicks = startTicks + mustDelay;
+        if (TOBY_isStepping(ctx))  /* single stepping? Break here. */
+        {
+            ctx->execState = EXEC_PAUSED;
+            if ((breakpoint = isBreakpointLine(ctx, line)) != -1)
+                ctx->steppedOntoLine = line;
+        } /* if */
+    } /* if */
+
+    /* !!! FIXME: maybe later. */
+    #if 0
+    if (hook == LUA_HOOKCALL)
+    {
+        if (breakpoint == -1)
+        {
+            if ((breakpoint = isBreakpointFunc(ar)) != -1)
+                ctx->execState = EXEC_PAUSED;
+        } /* if */
+    } /* if */
+    #endif
+
+    waitWhilePaused(ctx, L, line, breakpoint, pauseTicks, shouldRedraw);
 } /* luaDebugHook */
 
 
-static void luaErrorMsgBox(lua_State *L)
+static void luaErrorMsgBox(TobyContext *ctx, lua_State *L)
 {
     const char *errstr = lua_tostring(L, -1);
-    TOBY_messageBox(errstr);
+    ctx->callbacks.messageBox(ctx, errstr);
     lua_pop(L, 1);  /* dump error string. */
 } /* luaErrorMsgBox */
 
@@ -1094,9 +2582,9 @@ static int addDebugItem(int *elements, int *itemCount, TobyDebugInfo **info,
 } /* addDebugItem */
 
 
-const TobyDebugInfo *TOBY_getCallstack(int *elementCount)
+const TobyDebugInfo *TOBY_getCallstack(TobyContext *ctx, int *elementCount)
 {
-    lua_State *L = luaState;
+    lua_State *L = ctx->luaState;
     lua_Debug ldbg;
     int elements = 0;
     int i;
@@ -1114,18 +2602,19 @@ const TobyDebugInfo *TOBY_getCallstack(int *elementCount)
         /* only care about user-written Toby code with debug information. */
         if ((ldbg.currentline > 0) && (strcmp(ldbg.what, "Lua") == 0))
         {
-            if (!addDebugItem(&elements, &callstackCount, &callstack,
+            if (!addDebugItem(&elements, &ctx->callstackCount, &ctx->callstack,
                         ldbg.name, NULL, ldbg.currentline))
                 return 0;
         } /* if */
     } /* for */
 
     *elementCount = elements;
-    return callstack;
+    return ctx->callstack;
 } /* TOBY_getCallstack */
 
 
-static const TobyDebugInfo *getGlobals(lua_State *L, int *elementCount)
+static const TobyDebugInfo *getGlobals(TobyContext *ctx, lua_State *L,
+                                       int *elementCount)
 {
     int elements = 0;
 
@@ -1144,7 +2633,10 @@ static const TobyDebugInfo *getGlobals(lua_State *L, int *elementCount)
         } /* if */
 
         if (val != NULL)
-            rc = addDebugItem(&elements, &varCount, &varList, name, val, -1);
+        {
+            rc = addDebugItem(&elements, &ctx->varCount, &ctx->varList,
+                              name, val, -1);
+        } /* if */
         lua_pop(L, 1);  /* remove value, keep key for next iteration. */
         if (!rc)
             return 0;
@@ -1152,14 +2644,15 @@ static const TobyDebugInfo *getGlobals(lua_State *L, int *elementCount)
     lua_pop(L, 1);  /* pop iterator key */
 
     *elementCount = elements;
-    return varList;
+    return ctx->varList;
 } /* getGlobals */
 
 
-const TobyDebugInfo *TOBY_getVariables(int stackframe, int *elementCount)
+const TobyDebugInfo *TOBY_getVariables(TobyContext *ctx, int stackframe,
+                                       int *elementCount)
 {
     const char *name = NULL;
-    lua_State *L = luaState;
+    lua_State *L = ctx->luaState;
     lua_Debug ldbg;
     int elements = 0;
     int i;
@@ -1170,7 +2663,7 @@ const TobyDebugInfo *TOBY_getVariables(int stackframe, int *elementCount)
         return NULL;
 
     if (stackframe < 0)
-        return getGlobals(L, elementCount);
+        return getGlobals(ctx, L, elementCount);
 
     if (!lua_getstack(L, stackframe, &ldbg))
         return NULL;
@@ -1189,7 +2682,8 @@ const TobyDebugInfo *TOBY_getVariables(int stackframe, int *elementCount)
                     val = "??? (bug in Toby!)";
             } /* if */
 
-            rc = addDebugItem(&elements, &varCount, &varList, name, val, -1);
+            rc = addDebugItem(&elements, &ctx->varCount, &ctx->varList,
+                              name, val, -1);
         } /* if */
 
         lua_pop(L, 1);
@@ -1198,65 +2692,99 @@ const TobyDebugInfo *TOBY_getVariables(int stackframe, int *elementCount)
     } /* for */
 
     *elementCount = elements;
-    return varList;
+    return ctx->varList;
 } /* TOBY_getVariables */
 
 
-long TOBY_getDelayTicksPerLine(void)
+long TOBY_getDelayTicksPerLine(TobyContext *ctx)
 {
-    return delayPerLine;
+    return ctx->delayPerLine;
 } /* TOBY_delayTicksPerLine */
 
 
-void TOBY_setDelayTicksPerLine(long ms)
+void TOBY_setDelayTicksPerLine(TobyContext *ctx, long ms)
 {
-    delayPerLine = ms;
+    ctx->delayPerLine = ms;  /* the hook notices at the next frame. */
 } /* TOBY_delayTicksPerLine */
 
 
-void TOBY_haltProgram(void)
+void TOBY_haltProgram(TobyContext *ctx)
 {
-    if (TOBY_isRunning())
-        execState = EXEC_STOPPING;
+    if (TOBY_isRunning(ctx))
+    {
+        /*
+         * Don't touch the Lua state here; this might not be its thread, and
+         *  it could be going away under us. Wake the watchdog instead: it
+         *  arms the hook right away, and the hook stops the program when it
+         *  sees this. The event outlives the run, so this is safe even if
+         *  the program just finished.
+         */
+        ctx->execState = EXEC_STOPPING;
+        TOBY_signalEvent(ctx->watchdogWake);
+    } /* if */
 } /* TOBY_haltProgram */
 
 
-void TOBY_continueProgram(void)
+void TOBY_countInstructions(TobyContext *ctx, int enable)
+{
+    ctx->countInstructions = enable;  /* the hook notices at the next frame. */
+} /* TOBY_countInstructions */
+
+
+void TOBY_getRunStats(TobyContext *ctx, TobyRunStats *stats)
+{
+    memcpy(stats, &ctx->stats, sizeof (TobyRunStats));
+} /* TOBY_getRunStats */
+
+
+void TOBY_getMemoryStats(TobyContext *ctx, TobyArenaStats *stats)
+{
+    TOBY_getArenaStats(ctx->arena, stats);
+} /* TOBY_getMemoryStats */
+
+
+void TOBY_continueProgram(TobyContext *ctx)
 {
-    if (TOBY_isRunning())
-        execState = EXEC_RUNNING;
+    if (TOBY_isRunning(ctx))
+    {
+        ctx->execState = EXEC_RUNNING;
+    } /* if */
 } /* TOBY_continueProgram */
 
 
-void TOBY_stepProgram(void)
+void TOBY_stepProgram(TobyContext *ctx)
 {
-    if ( (TOBY_isRunning()) && (!TOBY_isStopping()) )
-        execState = EXEC_STEPPING;
+    if ( (TOBY_isRunning(ctx)) && (!TOBY_isStopping(ctx)) )
+    {
+        ctx->execState = EXEC_STEPPING;
+    } /* if */
 } /* TOBY_stepProgram */
 
 
-int TOBY_isPaused(void)
+int TOBY_isPaused(TobyContext *ctx)
 {
-    return execState == EXEC_PAUSED;
+    return ctx->execState == EXEC_PAUSED;
 } /* TOBY_isPaused */
 
 
-int TOBY_isStepping(void)
+int TOBY_isStepping(TobyContext *ctx)
 {
-    return execState == EXEC_STEPPING;
+    return ctx->execState == EXEC_STEPPING;
 } /* TOBY_isStepping */
 
 
-int TOBY_isRunning(void)
+int TOBY_isRunning(TobyContext *ctx)
 {
-    return ( (execState == EXEC_RUNNING) || (execState == EXEC_STEPPING) ||
-             (execState == EXEC_PAUSED) || (execState == EXEC_STOPPING) );
+    const TobyExecState state = ctx->execState;
+    return ( (state == EXEC_RUNNING) || (state == EXEC_STEPPING) ||
+             (state == EXEC_PAUSED) || (state == EXEC_STOPPING) );
 } /* TOBY_isRunning */
 
 
-int TOBY_isStopping(void)
+int TOBY_isStopping(TobyContext *ctx)
 {
-    return ( (execState == EXEC_STOPPING) || (execState == EXEC_STOPPED) );
+    const TobyExecState state = ctx->execState;
+    return ( (state == EXEC_STOPPING) || (state == EXEC_STOPPED) );
 } /* TOBY_isStopping */
 
 
@@ -1275,74 +2803,163 @@ static void freeDebugInfo(TobyDebugInfo **info, int *count)
 } /* freeDebugInfo */
 
 
-static inline void resetProgramState(void)
-{
-    freeDebugInfo(&callstack, &callstackCount);
-    freeDebugInfo(&varList, &varCount);
-    free(turtles);
-    turtles = NULL;
-    currentTurtleIndex = -1;
-    totalTurtles = 0;
-    fenceEnabled = 1;
-    halted = 0;
-    luaState = NULL;
-    turtleSpaceIsDirty = 0;
-    executingLine = -1;
-    execState = EXEC_STOPPED;
-    delayPerLine = 0;
-    nextPumpTicks = 0;
+static inline void resetProgramState(TobyContext *ctx)
+{
+    freeDebugInfo(&ctx->callstack, &ctx->callstackCount);
+    freeDebugInfo(&ctx->varList, &ctx->varCount);
+    freeTurtles(&ctx->turtles);
+    ctx->currentTurtleIndex = -1;
+    free(ctx->path);
+    ctx->path = NULL;
+    ctx->pathCount = ctx->pathAllocated = 0;
+    ctx->pathTurtle = -1;
+    ctx->fenceEnabled = 1;
+    ctx->halted = 0;
+    ctx->luaState = NULL;
+    ctx->turtleSpaceIsDirty = 0;
+    clearRect(&ctx->dirtyRect);
+    ctx->executingLine = -1;
+    ctx->steppedOntoLine = -1;
+    ctx->lineQueueCount = 0;
+    ctx->pointQueueCount = 0;
+    ctx->execState = EXEC_STOPPED;
+    ctx->delayPerLine = 0;
 } /* resetProgramState */
 
 
-void TOBY_runProgram(const char *source_code, int run_for_printing)
+static lua_State *newLuaState(TobyContext *ctx)
+{
+    /* the context rides along as allocator data; see getContext(). */
+    lua_State *L = lua_newstate(luaAllocator, ctx);
+    if (L != NULL)
+    {
+        lua_atpanic(L, luahook_fatal);
+        add_toby_functions(L);
+    } /* if */
+    return L;
+} /* newLuaState */
+
+
+static void closeLuaState(TobyContext *ctx, lua_State *L)
+{
+    /*
+     * Toby states have no finalizers to run, but lua_close() still frees
+     *  every object; let those be no-ops, and give the arena back whole.
+     */
+    TOBY_closingArena(ctx->arena);
+    lua_close(L);
+    TOBY_releaseArena(ctx->arena);
+} /* closeLuaState */
+
+
+/* The run using (L) is over: keep it warm for the next one, or close it. */
+static void retireLuaState(TobyContext *ctx, lua_State *L)
+{
+    #if TOBY_WARM_STATE
+    if (ctx->luaMemory <= TOBY_WARM_STATE_BYTES)
+    {
+        lua_sethook(L, NULL, 0, 0);
+        lua_settop(L, 0);
+        lua_newtable(L);  /* builtins aren't globals; nothing to keep. */
+        lua_replace(L, LUA_GLOBALSINDEX);  /* drop the program's globals... */
+        lua_gc(L, LUA_GCCOLLECT, 0);  /* ...and everything it made. */
+        ctx->warmState = L;
+        return;
+    } /* if */
+    #endif
+
+    closeLuaState(ctx, L);
+} /* retireLuaState */
+
+
+void TOBY_destroyContext(TobyContext *ctx)
+{
+    if (ctx != NULL)
+    {
+        assert(!TOBY_isRunning(ctx));
+        if (ctx->warmState != NULL)
+            closeLuaState(ctx, ctx->warmState);
+        resetProgramState(ctx);
+        freeDisplayList(ctx);
+        TOBY_clearAllBreakpoints(ctx);
+        TOBY_destroyEvent(ctx->watchdogWake);
+        TOBY_destroyArena(ctx->arena);
+        free(ctx);
+    } /* if */
+} /* TOBY_destroyContext */
+
+
+void TOBY_runProgram(TobyContext *ctx, const char *source_code,
+                     int run_for_printing)
 {
+    TurtleRGB *bg = &ctx->background;
     lua_State *L;
 
-    resetProgramState();
+    resetProgramState(ctx);
+    freeDisplayList(ctx);
+    memset(&ctx->stats, '\0', sizeof (ctx->stats));
+    TOBY_clearArenaStats(ctx->arena);
+    ctx->frameDue = 0;
 
     if (run_for_printing)
-        background.r = background.g = background.b = 255;  /* white. */
+        bg->r = bg->g = bg->b = 255;  /* white. */
     else
-        background.r = background.g = background.b = 0;  /* black. */
+        bg->r = bg->g = bg->b = 0;  /* black. */
 
-    luaState = L = luaL_newstate();
+    L = ctx->warmState;
+    ctx->warmState = NULL;
     if (L == NULL)
-        return;
-
-/*
-// !!! FIXME
-//    lua_atpanic(L, luahook_fatal);
-*/
+        L = newLuaState(ctx);
 
-    lua_sethook(L, luaDebugHook, LUA_MASKLINE | LUA_MASKCOUNT, 1000);
-    add_toby_functions(L);
+    ctx->luaState = L;
+    if (L == NULL)
+    {
+        TOBY_releaseArena(ctx->arena);
+        return;
+    } /* if */
 
     lua_pushcfunction(L, luahook_stackwalk);
-    if (luaL_loadstring(L, source_code) != 0)
-        luaErrorMsgBox(L);
+    if (TOBY_compileCached(L, source_code, "=program") != 0)
+        luaErrorMsgBox(ctx, L);
+    else if ((!TOBY_attachTraps(L, -1, breakpointReached)) ||
+             (!setBreakpointTraps(L)))
+    {
+        ctx->callbacks.messageBox(ctx, "Out of memory");
+        lua_pop(L, 1);  /* dump compiled program. */
+    } /* else if */
+    else if (!startWatchdog(ctx))
+    {
+        ctx->callbacks.messageBox(ctx, "Couldn't start watchdog thread");
+        lua_pop(L, 1);  /* dump compiled program. */
+    } /* else if */
     else
     {
-        execState = EXEC_RUNNING;
-        TOBY_startRun();
-        TOBY_cleanup(background.r, background.g, background.b);
-        currentTurtleIndex = allocateTurtle(L);
-        turtleSpaceIsDirty = 1;
+        ctx->execState = EXEC_RUNNING;
+        updateDebugHook(ctx);
+        ctx->callbacks.startRun(ctx);
+        cleanup(ctx);
+        ctx->currentTurtleIndex = allocateTurtle(L);
+        ctx->turtleSpaceIsDirty = 1;
 
         /* Call new chunk on top of the stack (lua_pcall will pop it off). */
         if (lua_pcall(L, 0, 0, -2) != 0)  /* retvals are dumped. */
         {
-            if (!halted)  /* (halted) means stop requested, not error. */
-                luaErrorMsgBox(L);
+            if (!ctx->halted)  /* (halted) means stop requested, not error. */
+                luaErrorMsgBox(ctx, L);
         } /* if */
 
-        TOBY_renderAllTurtles(NULL);  /* put final turtles to backing store. */
-        TOBY_putToScreen();
-        TOBY_stopRun();
+        stopWatchdog(ctx);
+        TOBY_renderAllTurtles(ctx, NULL);  /* final turtles to backing store. */
+        recordFinalTurtles(ctx);
+        ctx->displayListFinished = !ctx->halted;  /* halted is only partial. */
+        presentToScreen(ctx);
+        ctx->callbacks.stopRun(ctx);
     } /* if */
     lua_pop(L, 1);   /* dump stackwalker. */
 
-    resetProgramState();
-    lua_close(L);
+    TOBY_detachTraps(L);
+    resetProgramState(ctx);
+    retireLuaState(ctx, L);
 } /* TOBY_runProgram */
 
 
@@ -16,6 +16,7 @@ extern "C" {
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#include "toby_arena.h"
 
 #if (defined(_MSC_VER) && (!defined inline))
 #define inline __inline
@@ -70,12 +71,12 @@ typedef struct Turtle
     lua_Number width;
     lua_Number height;
     lua_Number angle;
+    TurtlePoint heading;  /* cos and sin of (angle): one unit forward. */
     TurtlePoint points[4];
     TurtleRGB pen;
     int penDown;
     int visible;
-    int recalcPoints;  /* non-zero if (points) needs to be recalculated. */
-    int dirty;  /* non-zero if turtle needs redrawing in TurtleSpace. */
+    int index;  /* which turtle this is, starting at zero. */
 } Turtle;
 
 
@@ -87,130 +88,303 @@ typedef struct TobyDebugInfo
 } TobyDebugInfo;
 
 
-/* !!! FIXME: comment this */
-void TOBY_background(int *r, int *g, int *b);
+/*
+ * Everything about a running (or most recently run) program lives in a
+ *  TobyContext: the Lua state, the turtles, breakpoints, the display list,
+ *  and the frontend's callbacks. Contexts don't share anything, so an app
+ *  can run as many programs at once as it likes, as long as each context is
+ *  only used from one thread at a time. The run controls are the exception:
+ *  TOBY_haltProgram(), TOBY_stepProgram(), TOBY_continueProgram(),
+ *  TOBY_setDelayTicksPerLine() and TOBY_countInstructions() may be called
+ *  from any thread, and take effect by the program's next frame; a halt
+ *  asks for that frame right away.
+ */
+typedef struct TobyContext TobyContext;
 
 
-/* !!! FIXME: comment this */
-void TOBY_renderAllTurtles(void *udata);
+/*
+ * Line segments handed to the drawLines callback, below.
+ */
+typedef struct TobyLineSegment
+{
+    lua_Number x1;
+    lua_Number y1;
+    lua_Number x2;
+    lua_Number y2;
+    TurtleRGB color;
+} TobyLineSegment;
 
 
-/* !!! FIXME: comment these */
-const TobyDebugInfo *TOBY_getCallstack(int *elementCount);
-const TobyDebugInfo *TOBY_getVariables(int stackframe, int *elementCount);
+/*
+ * Single pixels handed to the drawPoints callback, below.
+ */
+typedef struct TobyPoint
+{
+    lua_Number x;
+    lua_Number y;
+    TurtleRGB color;
+} TobyPoint;
 
 
-/* !!! FIXME: comment all these */
-void TOBY_setDelayTicksPerLine(long ms);
-long TOBY_getDelayTicksPerLine(void);
-void TOBY_haltProgram(void);
-void TOBY_stepProgram(void);
-void TOBY_continueProgram(void);
-int TOBY_isPaused(void);
-int TOBY_isStepping(void);
-int TOBY_isRunning(void);
-int TOBY_isStopping(void);
-void TOBY_stepProgram(void);
+/*
+ * These are supplied by your app, and are called during the
+ *  TOBY_runProgram() call. Every one of them must be filled in. They get
+ *  the context that's calling them; TOBY_getContextUserData() gets back the
+ *  pointer you passed to TOBY_createContext().
+ */
+typedef struct TobyCallbacks
+{
+    /* Set up for a new program run. This lets you prepare a backbuffer, etc. */
+    void (*startRun)(TobyContext *ctx);
+
+    /* Notify app that the program run has finished. */
+    void (*stopRun)(TobyContext *ctx);
+
+    /*
+     * Let UI pump its event queue. Call TOBY_haltProgram() to stop program
+     *  execution, making TOBY_runProgram() return.
+     */
+    void (*pumpEvents)(TobyContext *ctx);
+
+    /* !!! FIXME: comment me. */
+    void (*putToScreen)(TobyContext *ctx);
+
+    /*
+     * Put up a message box with "OK" message. Block until the user
+     *  dismisses it. (msg) is UTF-8 encoded Unicode.
+     */
+    void (*messageBox)(TobyContext *ctx, const char *msg);
+
+    /*
+     * Draw (count) line segments, each between (x1,y1) and (x2,y2) in its
+     *  own color, in the order given. All coordinates are between 0 and 999,
+     *  with (0,0) being the top left of the screen and ...(999, 999) being
+     *  to bottom right. You need to scale to the correct coordinates for
+     *  your display.
+     *
+     * All lines are clipped prior to this call, so they will never be
+     *  outside the 0-999 range. Lines that don't intersect TurtleSpace at
+     *  all are never included.
+     *
+     * The backend queues up lines as the program draws them, and hands them
+     *  over in batches: before a frame is put to the screen, and before any
+     *  other drawing call, so the order of everything on the screen is kept.
+     *  Consecutive segments very often share a color, and the end of one is
+     *  usually the start of the next, so it pays to set up a pen once per
+     *  run of the same color.
+     */
+    void (*drawLines)(TobyContext *ctx, const TobyLineSegment *segs, int count);
+
+    /*
+     * Set the pixel under each of (count) points to its color. Coordinates
+     *  are in the same system as drawLines, and are always inside
+     *  TurtleSpace. These are queued up and batched like lines are, and
+     *  a program plotting an image pixel by pixel sends a lot of them, so
+     *  write them straight into your backing store if you can.
+     */
+    void (*drawPoints)(TobyContext *ctx, const TobyPoint *pts, int count);
+
+    /* !!! FIXME: comment me. */
+    int (*drawString)(TobyContext *ctx, lua_Number x, lua_Number y,
+                      const char *utf8str, lua_Number angle,
+                      int r, int g, int b);
+
+    /*
+     * Render a turtle of size (w,h) with the center at (x,y), facing
+     *  (angle). Angle is between 0 and 360, coordinates and sizes are in the
+     *  same system as drawLines.
+     * !!! FIXME: document (data).
+     */
+    void (*drawTurtle)(TobyContext *ctx, const Turtle *turtle, void *data);
+
+    /*
+     * Fill the polygon with (count) corners at (pts), in color r,g,b, using
+     *  the even-odd rule where its edges cross. Coordinates are in the same
+     *  system as drawLines, but aren't clipped, so corners may be outside
+     *  TurtleSpace; only what's inside it should be drawn.
+     */
+    void (*fillPolygon)(TobyContext *ctx, const TurtlePoint *pts, int count,
+                        int r, int g, int b);
+
+    /*
+     * Paint the area around (x,y) that's all the same color as the pixel at
+     *  (x,y) in color r,g,b, stopping at anything of a different color.
+     *  (x,y) is inside TurtleSpace. Return zero if you can't do this.
+     */
+    int (*floodFill)(TobyContext *ctx, lua_Number x, lua_Number y,
+                     int r, int g, int b);
+
+    /* Clean up turtlespace. Blank it out to color r,g,b (0 to 255 each). */
+    void (*cleanup)(TobyContext *ctx, int r, int g, int b);
+
+    /* !!! FIXME: comment me. */
+    void (*pauseReached)(TobyContext *ctx, int line, int fullstop,
+                         int breakpoint, int pauseTicks);
+
+    /* Get the time, in milliseconds, that the process has been running. */
+    long (*getTicks)(TobyContext *ctx);
+
+    /*
+     * Surrender the CPU to other processes for (ms) milliseconds. This
+     *  doesn't have to exact if the OS's scheduler doesn't have good
+     *  precision, and it can just busy loop if the OS doesn't have
+     *  facilities. You don't have to pump the event queue here...callers
+     *  are expected to alternate between this and pumpEvents if they are
+     *  wasting time.
+     */
+    void (*yieldCPU)(TobyContext *ctx, int ms);
+} TobyCallbacks;
 
 
 /*
- * Pause for (ms) milliseconds, calling TOBY_pumpEvents() every 50 ms or so,
- *  and TOBY_yieldCPU() to give up time between pumps. Returns 0 if
- *  TOBY_haltProgram() got called before or during the function's run,
- *  non-zero otherwise. Will pump the event queue at least once, even if ms
- *  is <= 0.
+ * Make a new context that calls back into (callbacks), which is copied.
+ *  (userdata) is yours to do with as you like. Returns NULL if out of
+ *  memory. Destroy it when you're done; it mustn't be running a program.
  */
-int TOBY_delay(long ms);
+TobyContext *TOBY_createContext(const TobyCallbacks *callbacks, void *userdata);
+void TOBY_destroyContext(TobyContext *ctx);
+void *TOBY_getContextUserData(TobyContext *ctx);
 
 
+/* !!! FIXME: comment this */
+void TOBY_background(TobyContext *ctx, int *r, int *g, int *b);
+
+
+/* !!! FIXME: comment this */
+void TOBY_renderAllTurtles(TobyContext *ctx, void *udata);
+
 /*
- * This can block for a LONG time, but it will call back into your
- *  application with the following functions...
+ * Draw just the turtles that moved, turned, appeared or vanished since the
+ *  last putToScreen, hidden ones included (with (visible) cleared), so you
+ *  can keep your own copy of the turtles by index. Only meaningful inside
+ *  the putToScreen callback.
  */
-void TOBY_runProgram(const char *source_code, int run_for_printing);
+void TOBY_renderChangedTurtles(TobyContext *ctx, void *udata);
 
 
-/* !!! FIXME: comment these. */
-/* !!! FIXME: breakpoint API isn't robust, but it's all I need right now. */
-void TOBY_clearAllBreakpoints(void);
-int TOBY_addBreakpointLine(int line);
-void TOBY_pauseReached(int line, int fullstop, int breakpoint, int pauseTicks);
-
+/* A rectangle in TurtleSpace coordinates, (x1,y1) being the top left. */
+typedef struct TobyRect
+{
+    lua_Number x1;
+    lua_Number y1;
+    lua_Number x2;
+    lua_Number y2;
+} TobyRect;
 
 /*
- * The following are supplied by your app, and are called during the
- *  TOBY_runProgram() call...
+ * The part of TurtleSpace that changed since the last putToScreen callback:
+ *  lines, strings, cleanups, and turtles where they were and where they are
+ *  now. Call this from putToScreen, and copy only that much of your backing
+ *  store to the screen; pad it by a pixel or so for rounding. The rect is
+ *  clipped to TurtleSpace. Returns zero if nothing changed.
  */
+int TOBY_getDirtyRect(TobyContext *ctx, TobyRect *rect);
 
-/* Set up for a new program run. This lets you prepare a backbuffer, etc. */
-void TOBY_startRun(void);
+
+/* !!! FIXME: comment these */
+const TobyDebugInfo *TOBY_getCallstack(TobyContext *ctx, int *elementCount);
+const TobyDebugInfo *TOBY_getVariables(TobyContext *ctx, int stackframe,
+                                       int *elementCount);
 
 
-/* Notify app that the program run has finished. */
-void TOBY_stopRun(void);
+/* !!! FIXME: comment all these */
+void TOBY_setDelayTicksPerLine(TobyContext *ctx, long ms);
+long TOBY_getDelayTicksPerLine(TobyContext *ctx);
+void TOBY_haltProgram(TobyContext *ctx);
+void TOBY_stepProgram(TobyContext *ctx);
+void TOBY_continueProgram(TobyContext *ctx);
+int TOBY_isPaused(TobyContext *ctx);
+int TOBY_isStepping(TobyContext *ctx);
+int TOBY_isRunning(TobyContext *ctx);
+int TOBY_isStopping(TobyContext *ctx);
 
 
 /*
- * Let UI pump its event queue. Return non-zero to keep going, zero to
- *  stop program execution, making TOBY_runProgram() return.
+ * Pause for (ms) milliseconds, calling the pumpEvents callback every 50 ms
+ *  or so, and yieldCPU to give up time between pumps. Returns 0 if
+ *  TOBY_haltProgram() got called before or during the function's run,
+ *  non-zero otherwise. Will pump the event queue at least once, even if ms
+ *  is <= 0.
  */
-void TOBY_pumpEvents(void);
+int TOBY_delay(TobyContext *ctx, long ms);
 
-/* !!! FIXME: comment me. */
-void TOBY_putToScreen(void);
 
 /*
- * Put up a message box with "OK" message. Block until the user dismisses it.
- *  (msg) is UTF-8 encoded Unicode.
+ * This can block for a LONG time, but it will call back into your
+ *  application through the context's callbacks...
  */
-void TOBY_messageBox(const char *msg);
+void TOBY_runProgram(TobyContext *ctx, const char *source_code,
+                     int run_for_printing);
+
 
 /*
- * Draw line between (x1,y1) and (x2,y2) in color r,g,b. All coordinates are
- *  between 0 and 999, with (0,0) being the top left of the screen and
- *  ...(999, 999) being to bottom right. You need to scale to the correct
- *  coordinates for your display.
- *
- * All lines are clipped prior to this call, so they will never be outside
- *  the 0-999 range. If they don't intersect TurtleSpace at all, this
- *  function will not be called.
+ * The backend keeps a display list of every line, string and cleanup the
+ *  current (or most recent) program drew. This redraws all of it through
+ *  the cleanup, drawLines and drawString callbacks, plus the final turtles
+ *  through drawTurtle if the program is done, so you can set up a backing
+ *  store of any size and fill it without running the program again.
+ *  (for_printing) picks the background like TOBY_runProgram() does, but
+ *  only if no program is running. Returns zero if the list had to be
+ *  dropped, because the program drew too much or memory ran out, in which
+ *  case you'll have to rerun it.
  */
-void TOBY_drawLine(lua_Number x1, lua_Number y1, lua_Number x2, lua_Number y2,
-                   int r, int g, int b);
+int TOBY_replayDisplayList(TobyContext *ctx, int for_printing);
 
-
-/* !!! FIXME: comment me. */
-int TOBY_drawString(lua_Number x, lua_Number y, const char *utf8str,
-                    lua_Number angle, int r, int g, int b);
+/*
+ * Non-zero if the most recent program ran to the end (it wasn't halted),
+ *  so TOBY_replayDisplayList() will reproduce everything it would draw.
+ */
+int TOBY_displayListComplete(TobyContext *ctx);
 
 
 /*
- * Render a turtle of size (w,h) with the center at (x,y), facing (angle).
- *  Angle is between 0 and 360, coordinates and sizes are in the same system
- *  as TOBY_drawLine().
- * !!! FIXME: document (data).
+ * Keep compiled programs in directory (dir), keyed by a hash of the source
+ *  and the build version, so running the same program again skips
+ *  compiling it. The directory is created if it doesn't exist. Pass NULL
+ *  to turn off the cache, which is the default. Returns zero on failure.
+ *  This is shared by all contexts; set it before running any programs.
  */
-void TOBY_drawTurtle(const Turtle *turtle, void *data);
-
+int TOBY_setBytecodeCacheDir(const char *dir);
 
 /*
- * Clean up turtlespace. Blank it out to color r,g,b (0 to 255 each).
+ * Compile every .toby file in directory (dir) into the bytecode cache, so
+ *  later runs of them start right away. Returns the number of programs that
+ *  are now cached, or -1 if there's no cache directory set or (dir) can't
+ *  be read. Programs with errors are skipped.
  */
-void TOBY_cleanup(int r, int g, int b);
+int TOBY_prewarmBytecodeCache(const char *dir);
+
+
+/* !!! FIXME: comment these. */
+/* !!! FIXME: breakpoint API isn't robust, but it's all I need right now. */
+void TOBY_clearAllBreakpoints(TobyContext *ctx);
+int TOBY_addBreakpointLine(TobyContext *ctx, int line);
+
 
 /*
- * Get the time, in milliseconds, that the process has been running.
+ * What the current (or most recent) program run has done so far, for
+ *  profiling. Instructions are only counted while TOBY_countInstructions()
+ *  is on, since that calls into the backend for every Lua instruction and
+ *  makes the program run many times slower; time those runs separately.
  */
-long TOBY_getTicks(void);
+typedef struct TobyRunStats
+{
+    unsigned long instructions;  /* Lua VM instructions executed. */
+    unsigned long segments;  /* line segments drawn, after clipping. */
+    unsigned long strings;  /* drawString calls. */
+    unsigned long points;  /* pixels plotted. */
+    unsigned long peakMemory;  /* most bytes the Lua state had at once. */
+} TobyRunStats;
+
+void TOBY_countInstructions(TobyContext *ctx, int enable);
+void TOBY_getRunStats(TobyContext *ctx, TobyRunStats *stats);
 
 /*
- * Surrender the CPU to other processes for (ms) milliseconds. This doesn't
- *  have to exact if the OS's scheduler doesn't have good precision, and it
- *  can just busy loop if the OS doesn't have facilities.
- * You don't have to pump the event queue here...callers are expected to
- *  alternate between this and TOBY_pumpEvents() if they are wasting time.
+ * Where the current (or most recent) run's Lua memory went, by size
+ *  class. See toby_arena.h.
  */
-void TOBY_yieldCPU(int ms);
+void TOBY_getMemoryStats(TobyContext *ctx, TobyArenaStats *stats);
+
 
 /*
  * Clip a line defined by (*x1,*y1)-(*x2,*y2) to a rectangle of (0,0)-(w,h).
@@ -218,8 +392,8 @@ void TOBY_yieldCPU(int ms);
  *  is completely outside the rectangle, non-zero if some portion of the line
  *  intersects the rectangle.
  *
- * Frontends don't generally call this, since TOBY_drawLine() will clip the
- *  lines before calling the frontend (and not call it if the line isn't inside
+ * Frontends don't generally call this, since lines are clipped before they
+ *  are handed to the drawLines callback (and dropped if they aren't inside
  *  TurtleSpace), meaning frontends may not need to manipulate a clip region
  *  at all.
  */
@@ -0,0 +1,325 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "toby_arena.h"
+
+#define ARENA_GRANULE 16
+#define ARENA_MAX_POOLED (ARENA_GRANULE * TOBY_ARENA_CLASSES)
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Headers get padded out, so whatever follows them stays aligned. */
+#define ARENA_HEADER(type) \
+    (((sizeof (type) + ARENA_GRANULE - 1) / ARENA_GRANULE) * ARENA_GRANULE)
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+} ArenaChunk;
+
+typedef struct ArenaBlock  /* something too big for the pools. */
+{
+    struct ArenaBlock *prev;
+    struct ArenaBlock *next;
+} ArenaBlock;
+
+typedef struct ArenaFree  /* a pooled block that's been given back. */
+{
+    struct ArenaFree *next;
+} ArenaFree;
+
+struct TobyArena
+{
+    ArenaChunk *chunks;  /* newest first. */
+    unsigned char *bump;  /* unused space in the newest chunk... */
+    unsigned char *bumpEnd;  /* ...up to here. */
+    ArenaFree *freeLists[TOBY_ARENA_CLASSES];
+    ArenaBlock bigBlocks;  /* circular list; this one's just the anchor. */
+    int closing;
+    TobyArenaStats stats;
+};
+
+
+static inline int sizeClass(size_t size)
+{
+    return (int) ((size - 1) / ARENA_GRANULE);
+} /* sizeClass */
+
+
+static inline TobyArenaClassStats *statsFor(TobyArena *arena, size_t size)
+{
+    if (size > ARENA_MAX_POOLED)
+        return &arena->stats.big;
+    return &arena->stats.classes[sizeClass(size)];
+} /* statsFor */
+
+
+static void noteAlloc(TobyArena *arena, size_t size)
+{
+    TobyArenaClassStats *stats = statsFor(arena, size);
+    stats->allocations++;
+    stats->bytes += size;
+    stats->bytesInUse += size;
+    if (stats->bytesInUse > stats->peakBytes)
+        stats->peakBytes = stats->bytesInUse;
+} /* noteAlloc */
+
+
+static inline void noteFree(TobyArena *arena, size_t size)
+{
+    statsFor(arena, size)->bytesInUse -= size;
+} /* noteFree */
+
+
+static int addChunk(TobyArena *arena)
+{
+    ArenaChunk *chunk = (ArenaChunk *) malloc(ARENA_CHUNK_SIZE);
+    if (chunk == NULL)
+        return 0;
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->bump = ((unsigned char *) chunk) + ARENA_HEADER(ArenaChunk);
+    arena->bumpEnd = ((unsigned char *) chunk) + ARENA_CHUNK_SIZE;
+    arena->stats.chunks++;
+    arena->stats.chunkBytes += ARENA_CHUNK_SIZE;
+    return 1;
+} /* addChunk */
+
+
+static void *poolAlloc(TobyArena *arena, size_t size)
+{
+    const int sclass = sizeClass(size);
+    const size_t blocklen = ((size_t) (sclass + 1)) * ARENA_GRANULE;
+    ArenaFree *block = arena->freeLists[sclass];
+    void *retval;
+
+    if (block != NULL)
+    {
+        arena->freeLists[sclass] = block->next;
+        return block;
+    } /* if */
+
+    /* whatever's left at the end of the old chunk is wasted. Oh well. */
+    if ((size_t) (arena->bumpEnd - arena->bump) < blocklen)
+    {
+        if (!addChunk(arena))
+            return NULL;
+    } /* if */
+
+    retval = arena->bump;
+    arena->bump += blocklen;
+    return retval;
+} /* poolAlloc */
+
+
+static inline void poolFree(TobyArena *arena, void *ptr, size_t size)
+{
+    ArenaFree *block = (ArenaFree *) ptr;
+    const int sclass = sizeClass(size);
+    block->next = arena->freeLists[sclass];
+    arena->freeLists[sclass] = block;
+} /* poolFree */
+
+
+static inline void linkBig(TobyArena *arena, ArenaBlock *block)
+{
+    ArenaBlock *anchor = &arena->bigBlocks;
+    block->prev = anchor;
+    block->next = anchor->next;
+    anchor->next->prev = block;
+    anchor->next = block;
+} /* linkBig */
+
+
+static inline void unlinkBig(ArenaBlock *block)
+{
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+} /* unlinkBig */
+
+
+static void *bigRealloc(TobyArena *arena, void *ptr, size_t size)
+{
+    ArenaBlock *block = NULL;
+    ArenaBlock *newblock;
+
+    if (ptr != NULL)
+    {
+        block = (ArenaBlock *) (((unsigned char *) ptr) -
+                                ARENA_HEADER(ArenaBlock));
+        unlinkBig(block);
+    } /* if */
+
+    newblock = (ArenaBlock *) realloc(block, ARENA_HEADER(ArenaBlock) + size);
+    if (newblock == NULL)
+    {
+        if (block != NULL)
+            linkBig(arena, block);  /* caller keeps the old one. */
+        return NULL;
+    } /* if */
+
+    linkBig(arena, newblock);
+    return ((unsigned char *) newblock) + ARENA_HEADER(ArenaBlock);
+} /* bigRealloc */
+
+
+static void bigFree(void *ptr)
+{
+    ArenaBlock *block = (ArenaBlock *) (((unsigned char *) ptr) -
+                                        ARENA_HEADER(ArenaBlock));
+    unlinkBig(block);
+    free(block);
+} /* bigFree */
+
+
+static void *allocBlock(TobyArena *arena, size_t size)
+{
+    void *retval;
+    if (size <= ARENA_MAX_POOLED)
+        retval = poolAlloc(arena, size);
+    else
+        retval = bigRealloc(arena, NULL, size);
+
+    if (retval != NULL)
+        noteAlloc(arena, size);
+    return retval;
+} /* allocBlock */
+
+
+static void freeBlock(TobyArena *arena, void *ptr, size_t size)
+{
+    noteFree(arena, size);
+    if (arena->closing)
+        return;  /* it's all going back at once in a moment. */
+    else if (size <= ARENA_MAX_POOLED)
+        poolFree(arena, ptr, size);
+    else
+        bigFree(ptr);
+} /* freeBlock */
+
+
+void *TOBY_arenaAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    TobyArena *arena = (TobyArena *) ud;
+    void *retval;
+
+    if (nsize == 0)
+    {
+        if (ptr != NULL)
+            freeBlock(arena, ptr, osize);
+        return NULL;
+    } /* if */
+
+    else if (ptr == NULL)
+        return allocBlock(arena, nsize);
+
+    else if ((osize > ARENA_MAX_POOLED) && (nsize > ARENA_MAX_POOLED))
+    {
+        retval = bigRealloc(arena, ptr, nsize);
+        if (retval != NULL)
+        {
+            noteFree(arena, osize);
+            noteAlloc(arena, nsize);
+        } /* if */
+        return retval;
+    } /* else if */
+
+    else if ((osize <= ARENA_MAX_POOLED) && (nsize <= ARENA_MAX_POOLED) &&
+             (sizeClass(osize) == sizeClass(nsize)))
+    {
+        TobyArenaClassStats *stats = statsFor(arena, osize);
+        stats->bytesInUse = (stats->bytesInUse - osize) + nsize;
+        if (stats->bytesInUse > stats->peakBytes)
+            stats->peakBytes = stats->bytesInUse;
+        return ptr;  /* still fits. */
+    } /* else if */
+
+    /* moving between pools, or in or out of them. */
+    retval = allocBlock(arena, nsize);
+    if (retval != NULL)
+    {
+        memcpy(retval, ptr, (osize < nsize) ? osize : nsize);
+        freeBlock(arena, ptr, osize);
+    } /* if */
+    return retval;
+} /* TOBY_arenaAlloc */
+
+
+TobyArena *TOBY_createArena(void)
+{
+    TobyArena *arena = (TobyArena *) calloc(1, sizeof (TobyArena));
+    if (arena != NULL)
+        arena->bigBlocks.prev = arena->bigBlocks.next = &arena->bigBlocks;
+    return arena;
+} /* TOBY_createArena */
+
+
+void TOBY_closingArena(TobyArena *arena)
+{
+    arena->closing = 1;
+} /* TOBY_closingArena */
+
+
+void TOBY_releaseArena(TobyArena *arena)
+{
+    ArenaBlock *block = arena->bigBlocks.next;
+    ArenaChunk *chunk;
+
+    while (block != &arena->bigBlocks)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    } /* while */
+    arena->bigBlocks.prev = arena->bigBlocks.next = &arena->bigBlocks;
+
+    /* keep the newest chunk, so the next run doesn't start from nothing. */
+    chunk = arena->chunks;
+    if (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        chunk->next = NULL;
+        arena->bump = ((unsigned char *) chunk) + ARENA_HEADER(ArenaChunk);
+        while (next != NULL)
+        {
+            chunk = next;
+            next = chunk->next;
+            free(chunk);
+        } /* while */
+    } /* if */
+
+    memset(arena->freeLists, '\0', sizeof (arena->freeLists));
+    arena->closing = 0;
+} /* TOBY_releaseArena */
+
+
+void TOBY_destroyArena(TobyArena *arena)
+{
+    if (arena != NULL)
+    {
+        TOBY_releaseArena(arena);
+        free(arena->chunks);
+        free(arena);
+    } /* if */
+} /* TOBY_destroyArena */
+
+
+void TOBY_getArenaStats(const TobyArena *arena, TobyArenaStats *stats)
+{
+    memcpy(stats, &arena->stats, sizeof (TobyArenaStats));
+} /* TOBY_getArenaStats */
+
+
+void TOBY_clearArenaStats(TobyArena *arena)
+{
+    memset(&arena->stats, '\0', sizeof (TobyArenaStats));
+} /* TOBY_clearArenaStats */
+
+/* end of toby_arena.c ... */
@@ -0,0 +1,79 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * A memory arena for Lua states that only live for one program run. Small
+ *  blocks (strings, tables, closures, upvalues...) come out of pools, one
+ *  per size class, carved from big chunks; anything bigger goes straight
+ *  to malloc(), but the arena still keeps track of it. When the run is
+ *  over, everything goes back at once, instead of one free() per object.
+ */
+
+#ifndef _INCL_TOBY_ARENA_H_
+#define _INCL_TOBY_ARENA_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pooled blocks are 16, 32, ... bytes, up to 16 * TOBY_ARENA_CLASSES. */
+#define TOBY_ARENA_CLASSES 16
+
+typedef struct TobyArena TobyArena;
+
+typedef struct TobyArenaClassStats
+{
+    unsigned long allocations;  /* blocks handed out. */
+    size_t bytes;  /* total bytes asked for in those. */
+    size_t bytesInUse;  /* bytes not given back yet. */
+    size_t peakBytes;  /* most bytes in use at once. */
+} TobyArenaClassStats;
+
+/* Everything since the stats were last cleared. */
+typedef struct TobyArenaStats
+{
+    TobyArenaClassStats classes[TOBY_ARENA_CLASSES];
+    TobyArenaClassStats big;  /* blocks too big for the pools. */
+    unsigned long chunks;  /* chunks the pools got from malloc(). */
+    size_t chunkBytes;
+} TobyArenaStats;
+
+/* Returns NULL if out of memory. */
+TobyArena *TOBY_createArena(void);
+
+/* Frees the arena, and every block still in it. */
+void TOBY_destroyArena(TobyArena *arena);
+
+/*
+ * A lua_Alloc, with the arena as its userdata. It works like any other
+ *  allocator, except that once TOBY_releaseArena() is coming, frees can be
+ *  skipped: call TOBY_closingArena() right before lua_close().
+ */
+void *TOBY_arenaAlloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/* Make frees do nothing until the next TOBY_releaseArena(). */
+void TOBY_closingArena(TobyArena *arena);
+
+/*
+ * Give back every block at once, keeping one chunk for next time. Anything
+ *  from the arena is invalid after this. Stats are left alone.
+ */
+void TOBY_releaseArena(TobyArena *arena);
+
+void TOBY_getArenaStats(const TobyArena *arena, TobyArenaStats *stats);
+void TOBY_clearArenaStats(TobyArena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of toby_arena.h ... */
@@ -0,0 +1,897 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * Runs programs over and over, with nothing on the other end of the
+ *  callbacks (to time the interpreter) and with the software canvas (to
+ *  time interpreter plus rasterizer), and writes the results as JSON so
+ *  builds can be compared. Rates are figured from the fastest run.
+ *  It can also time the line rasterizer on its own, with --lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "toby_app.h"
+#include "toby_raster.h"
+
+typedef struct BenchJob
+{
+    TobyRaster *raster;  /* NULL for the null backend. */
+    const char *fname;
+    long startTicks;
+    int failed;
+    int timedOut;
+} BenchJob;
+
+typedef struct BenchResult
+{
+    const char *backend;
+    int failed;
+    int timedOut;
+    double minSeconds;
+    double maxSeconds;
+    double totalSeconds;
+    TobyRunStats stats;
+    TobyArenaStats memory;
+    unsigned long pixels;
+} BenchResult;
+
+static int GRuns = 3;
+static int GSize = 600;
+static long GTimeout = 10000;
+static int GLines = 0;
+
+
+static double getSeconds(void)
+{
+    #if PLATFORM_WINDOWS
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return ((double) now.QuadPart) / ((double) freq.QuadPart);
+    #else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((double) now.tv_sec) + (((double) now.tv_usec) / 1000000.0);
+    #endif
+} /* getSeconds */
+
+
+static long tobyhook_getTicks(TobyContext *ctx)
+{
+    static double start = -1.0;
+    const double now = getSeconds();
+    if (start < 0.0)
+        start = now;  /* first call is from main(). */
+    return (long) ((now - start) * 1000.0);
+} /* tobyhook_getTicks */
+
+
+static void tobyhook_yieldCPU(TobyContext *ctx, int ms)
+{
+    #if PLATFORM_WINDOWS
+    Sleep(ms);
+    #else
+    usleep(ms * 1000);
+    #endif
+} /* tobyhook_yieldCPU */
+
+
+static void tobyhook_startRun(TobyContext *ctx)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    job->startTicks = tobyhook_getTicks(ctx);
+} /* tobyhook_startRun */
+
+
+static void tobyhook_stopRun(TobyContext *ctx)
+{
+    /* no-op. */
+} /* tobyhook_stopRun */
+
+
+static void tobyhook_pumpEvents(TobyContext *ctx)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (GTimeout > 0)
+    {
+        if ((tobyhook_getTicks(ctx) - job->startTicks) > GTimeout)
+        {
+            job->timedOut = 1;
+            TOBY_haltProgram(ctx);
+        } /* if */
+    } /* if */
+} /* tobyhook_pumpEvents */
+
+
+static void tobyhook_putToScreen(TobyContext *ctx)
+{
+    /* no-op. */
+} /* tobyhook_putToScreen */
+
+
+static void tobyhook_messageBox(TobyContext *ctx, const char *msg)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    fprintf(stderr, "%s: %s\n", job->fname, msg);
+    job->failed = 1;
+} /* tobyhook_messageBox */
+
+
+static void tobyhook_pauseReached(TobyContext *ctx, int line, int fullstop,
+                                  int breakpoint, int pauseTicks)
+{
+    /* no-op in this implementation: no debugging facilities. */
+} /* tobyhook_pauseReached */
+
+
+static void tobyhook_drawLines(TobyContext *ctx, const TobyLineSegment *segs,
+                               int count)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterDrawLines(job->raster, segs, count);
+} /* tobyhook_drawLines */
+
+
+static void tobyhook_drawPoints(TobyContext *ctx, const TobyPoint *pts,
+                                int count)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterDrawPoints(job->raster, pts, count);
+} /* tobyhook_drawPoints */
+
+
+static int tobyhook_drawString(TobyContext *ctx, lua_Number x, lua_Number y,
+                               const char *utf8str, lua_Number angle,
+                               int r, int g, int b)
+{
+    return 1;  /* the canvas doesn't do text yet; pretend we drew it. */
+} /* tobyhook_drawString */
+
+
+static void tobyhook_drawTurtle(TobyContext *ctx, const Turtle *turtle,
+                                void *data)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterDrawTurtle(job->raster, turtle);
+} /* tobyhook_drawTurtle */
+
+
+static void tobyhook_fillPolygon(TobyContext *ctx, const TurtlePoint *pts,
+                                 int count, int r, int g, int b)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterFillPolygon(job->raster, pts, count, r, g, b);
+} /* tobyhook_fillPolygon */
+
+
+static int tobyhook_floodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                              int r, int g, int b)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterFloodFill(job->raster, x, y, r, g, b);
+    return 1;
+} /* tobyhook_floodFill */
+
+
+static void tobyhook_cleanup(TobyContext *ctx, int r, int g, int b)
+{
+    BenchJob *job = (BenchJob *) TOBY_getContextUserData(ctx);
+    if (job->raster != NULL)
+        TOBY_rasterClear(job->raster, r, g, b);
+} /* tobyhook_cleanup */
+
+
+static const TobyCallbacks callbacks =
+{
+    tobyhook_startRun,
+    tobyhook_stopRun,
+    tobyhook_pumpEvents,
+    tobyhook_putToScreen,
+    tobyhook_messageBox,
+    tobyhook_drawLines,
+    tobyhook_drawPoints,
+    tobyhook_drawString,
+    tobyhook_drawTurtle,
+    tobyhook_fillPolygon,
+    tobyhook_floodFill,
+    tobyhook_cleanup,
+    tobyhook_pauseReached,
+    tobyhook_getTicks,
+    tobyhook_yieldCPU,
+};
+
+
+static char *loadProgram(const char *fname)
+{
+    char *retval = NULL;
+    FILE *io = fopen(fname, "rb");
+    if (io == NULL)
+        fprintf(stderr, "Failed to open '%s': %s\n", fname, strerror(errno));
+    else
+    {
+        long len = 0;
+        if ( (fseek(io, 0, SEEK_END) == -1) ||
+             ((len = ftell(io)) == -1) ||
+             (fseek(io, 0, SEEK_SET) == -1) )
+        {
+            fprintf(stderr, "i/o error on '%s': %s\n", fname, strerror(errno));
+        } /* if */
+
+        else
+        {
+            retval = (char *) malloc(len + 1);
+            if (retval == NULL)
+                fprintf(stderr, "Out of memory.\n");
+            else
+            {
+                if (fread(retval, len, 1, io) == 1)
+                    retval[len] = '\0';
+                else
+                {
+                    fprintf(stderr, "Failed to read '%s': %s\n", fname,
+                            strerror(errno));
+                    free(retval);
+                    retval = NULL;
+                } /* else */
+            } /* else */
+        } /* else */
+        fclose(io);
+    } /* else */
+
+    return retval;
+} /* loadProgram */
+
+
+/* Time GRuns runs of (program) against whatever backend (job) has. */
+static void benchProgram(TobyContext *ctx, BenchJob *job, const char *program,
+                         BenchResult *result)
+{
+    TobyRaster *raster = job->raster;
+    int i;
+
+    result->minSeconds = result->maxSeconds = result->totalSeconds = 0.0;
+    for (i = 0; i < GRuns; i++)
+    {
+        const unsigned long pixels = raster ? raster->pixelsWritten : 0;
+        double elapsed;
+
+        job->failed = job->timedOut = 0;
+        elapsed = getSeconds();
+        TOBY_runProgram(ctx, program, 0);
+        elapsed = getSeconds() - elapsed;
+
+        result->failed |= job->failed;
+        result->timedOut |= job->timedOut;
+        if (job->failed)
+            break;
+
+        if ((i == 0) || (elapsed < result->minSeconds))
+            result->minSeconds = elapsed;
+        if ((i == 0) || (elapsed > result->maxSeconds))
+            result->maxSeconds = elapsed;
+        result->totalSeconds += elapsed;
+        TOBY_getRunStats(ctx, &result->stats);
+        TOBY_getMemoryStats(ctx, &result->memory);
+        if (raster != NULL)
+            result->pixels = raster->pixelsWritten - pixels;
+    } /* for */
+} /* benchProgram */
+
+
+/* Run (program) once, slowly, just to see how many instructions it takes. */
+static int countInstructions(TobyContext *ctx, BenchJob *job,
+                             const char *program, unsigned long *count)
+{
+    TobyRunStats stats;
+    job->failed = job->timedOut = 0;
+    TOBY_countInstructions(ctx, 1);
+    TOBY_runProgram(ctx, program, 0);
+    TOBY_countInstructions(ctx, 0);
+    TOBY_getRunStats(ctx, &stats);
+    *count = stats.instructions;
+    return ((!job->failed) && (!job->timedOut));
+} /* countInstructions */
+
+
+static void writeJSONString(FILE *io, const char *str)
+{
+    fputc('"', io);
+    for (; *str; str++)
+    {
+        const unsigned char ch = (unsigned char) *str;
+        if ((ch == '"') || (ch == '\\'))
+            fprintf(io, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(io, "\\u%04x", (unsigned int) ch);
+        else
+            fputc(ch, io);
+    } /* for */
+    fputc('"', io);
+} /* writeJSONString */
+
+
+/*
+ * The line microbenchmark: (GLines) lines, the same ones every time, of
+ *  every length and direction, drawn with each span writer this CPU has,
+ *  and with the pixel-at-a-time Bresenham they replaced, for comparison.
+ *  Every writer has to set exactly the pixels that one does.
+ */
+typedef struct BenchLine
+{
+    int x1, y1, x2, y2;
+    unsigned int pval;
+} BenchLine;
+
+typedef struct LineResult
+{
+    const char *writer;
+    double minSeconds;
+    unsigned long pixels;
+    int matches;
+} LineResult;
+
+static unsigned int benchRandom(unsigned int *seed)
+{
+    *seed = (*seed * 1103515245) + 12345;  /* good enough, and portable. */
+    return (*seed >> 16) & 0x7FFF;
+} /* benchRandom */
+
+
+static int clampToCanvas(int val)
+{
+    return (val < 0) ? 0 : ((val >= GSize) ? GSize - 1 : val);
+} /* clampToCanvas */
+
+
+static BenchLine *makeBenchLines(void)
+{
+    BenchLine *retval = (BenchLine *) malloc(sizeof (BenchLine) * GLines);
+    unsigned int seed = 0x70B7;
+    int i;
+
+    if (retval == NULL)
+        return NULL;
+
+    for (i = 0; i < GLines; i++)
+    {
+        const int len = 1 << (i % 10);  /* 1 to 512 pixels each way. */
+        BenchLine *line = &retval[i];
+        line->x1 = (int) (benchRandom(&seed) % GSize);
+        line->y1 = (int) (benchRandom(&seed) % GSize);
+        line->x2 = line->x1 + (int) (benchRandom(&seed) % (len * 2 + 1)) - len;
+        line->y2 = line->y1 + (int) (benchRandom(&seed) % (len * 2 + 1)) - len;
+        line->x2 = clampToCanvas(line->x2);
+        line->y2 = clampToCanvas(line->y2);
+        line->pval = (benchRandom(&seed) << 9) ^ benchRandom(&seed);
+    } /* for */
+
+    return retval;
+} /* makeBenchLines */
+
+
+/* What toby_sdl.c did before the span writers, one pixel at a time. */
+static unsigned long referenceDrawLine(unsigned int *p, int w,
+                                       const BenchLine *line)
+{
+    const unsigned int pval = line->pval;
+    int dx = line->x2 - line->x1;
+    int dy = line->y2 - line->y1;
+    const int sdx = (dx < 0) ? -1 : 1;
+    const int sdy = (dy < 0) ? -1 : 1;
+    int px = line->x1;
+    int py = line->y1;
+    int x = 0;
+    int y = 0;
+
+    dx = sdx * dx + 1;
+    dy = sdy * dy + 1;
+
+    if (dx >= dy)
+    {
+        for (x = 0; x < dx; x++)
+        {
+            p[(py * w) + px] = pval;
+            y += dy;
+            if (y >= dx)
+            {
+                y -= dx;
+                py += sdy;
+            } /* if */
+            px += sdx;
+        } /* for */
+    } /* if */
+    else
+    {
+        for (y = 0; y < dy; y++)
+        {
+            p[(py * w) + px] = pval;
+            x += dx;
+            if (x >= dy)
+            {
+                x -= dy;
+                px += sdx;
+            } /* if */
+            py += sdy;
+        } /* for */
+    } /* else */
+
+    return (unsigned long) ((dx >= dy) ? dx : dy);
+} /* referenceDrawLine */
+
+
+/* Time GRuns passes over (lines), with the reference if (writer) is NULL. */
+static void benchLines(TobyRaster *raster, const BenchLine *lines,
+                       const char *writer, LineResult *result)
+{
+    const BenchLine *end = lines + GLines;
+    const TobySpanFuncs *spans = TOBY_getSpanFuncs(4);
+    TobySpanTarget target;
+    int i;
+
+    target.pixels = raster->pixels;
+    target.w = target.h = GSize;
+    target.pitch = GSize * (int) sizeof (unsigned int);
+    target.bpp = 4;
+
+    memset(raster->pixels, '\0', sizeof (unsigned int) * GSize * GSize);
+    result->writer = (writer != NULL) ? writer : "reference";
+    result->minSeconds = 0.0;
+    for (i = 0; i < GRuns; i++)
+    {
+        const BenchLine *line;
+        unsigned long pixels = 0;
+        double elapsed = getSeconds();
+        if (writer == NULL)
+        {
+            for (line = lines; line != end; line++)
+                pixels += referenceDrawLine(raster->pixels, GSize, line);
+        } /* if */
+        else
+        {
+            for (line = lines; line != end; line++)
+            {
+                pixels += spans->drawLine(&target, line->x1, line->y1,
+                                          line->x2, line->y2, line->pval);
+            } /* for */
+        } /* else */
+        elapsed = getSeconds() - elapsed;
+
+        if ((i == 0) || (elapsed < result->minSeconds))
+            result->minSeconds = elapsed;
+        result->pixels = pixels;
+    } /* for */
+} /* benchLines */
+
+
+static const char *spanWriterName(TobySpanWriter writer)
+{
+    switch (writer)
+    {
+        case TOBY_SPANWRITER_SCALAR: return "scalar";
+        case TOBY_SPANWRITER_SSE2: return "sse2";
+        case TOBY_SPANWRITER_AVX2: return "avx2";
+    } /* switch */
+    return "unknown";
+} /* spanWriterName */
+
+
+/* Returns zero if the writers disagreed with the reference, or on error. */
+static int benchAllLines(FILE *io, TobyRaster *raster)
+{
+    static const TobySpanWriter writers[] =
+    {
+        TOBY_SPANWRITER_SCALAR, TOBY_SPANWRITER_SSE2, TOBY_SPANWRITER_AVX2
+    };
+    const TobySpanWriter defaultWriter = TOBY_getSpanWriter();
+    const size_t canvasBytes = sizeof (unsigned int) * GSize * GSize;
+    LineResult results[STATICARRAYLEN(writers) + 1];
+    BenchLine *lines = makeBenchLines();
+    unsigned int *reference = (unsigned int *) malloc(canvasBytes);
+    int total = 0;
+    int retval = 1;
+    int i;
+
+    if ((lines == NULL) || (reference == NULL))
+    {
+        fprintf(stderr, "Out of memory.\n");
+        fprintf(io, ",\n  \"lines\": null");
+        free(reference);
+        free(lines);
+        return 0;
+    } /* if */
+
+    fprintf(stderr, "%d lines...\n", GLines);
+
+    benchLines(raster, lines, NULL, &results[total]);
+    results[total++].matches = 1;
+    memcpy(reference, raster->pixels, canvasBytes);
+
+    for (i = 0; i < (int) STATICARRAYLEN(writers); i++)
+    {
+        if (!TOBY_setSpanWriter(writers[i]))
+            continue;
+        benchLines(raster, lines, spanWriterName(writers[i]), &results[total]);
+        results[total].matches = (memcmp(reference, raster->pixels,
+                                         canvasBytes) == 0);
+        if (!results[total].matches)
+            retval = 0;
+        total++;
+    } /* for */
+
+    TOBY_setSpanWriter(defaultWriter);
+
+    fprintf(io, ",\n  \"lines\": {\n    \"count\": %d", GLines);
+    fprintf(io, ",\n    \"defaultWriter\": \"%s\"",
+            spanWriterName(defaultWriter));
+    fprintf(io, ",\n    \"results\": [");
+    for (i = 0; i < total; i++)
+    {
+        const LineResult *result = &results[i];
+        fprintf(io, "%s\n      {\n        \"writer\": ", (i == 0) ? "" : ",");
+        writeJSONString(io, result->writer);
+        fprintf(io, ",\n        \"minWallSeconds\": %.6f",
+                result->minSeconds);
+        fprintf(io, ",\n        \"pixels\": %lu", result->pixels);
+        fprintf(io, ",\n        \"pixelsPerSec\": ");
+        if (result->minSeconds <= 0.0)
+            fprintf(io, "null");
+        else
+            fprintf(io, "%.1f", ((double) result->pixels) / result->minSeconds);
+        fprintf(io, ",\n        \"matchesReference\": %s",
+                result->matches ? "true" : "false");
+        fprintf(io, "\n      }");
+    } /* for */
+    fprintf(io, "\n    ]\n  }");
+
+    if (!retval)
+        fprintf(stderr, "Span writers didn't match the reference lines!\n");
+
+    free(reference);
+    free(lines);
+    return retval;
+} /* benchAllLines */
+
+
+static void writeJSONRate(FILE *io, const char *name, int valid,
+                          unsigned long count, double seconds)
+{
+    fprintf(io, ",\n      \"%s\": ", name);
+    if ((!valid) || (seconds <= 0.0))
+        fprintf(io, "null");
+    else
+        fprintf(io, "%.1f", ((double) count) / seconds);
+} /* writeJSONRate */
+
+
+static void writeJSONClass(FILE *io, const TobyArenaClassStats *stats,
+                           int size, int first)
+{
+    fprintf(io, "%s\n          { \"size\": ", first ? "" : ",");
+    if (size > 0)
+        fprintf(io, "%d", size);
+    else
+        fprintf(io, "null");
+    fprintf(io, ", \"allocations\": %lu, \"bytes\": %lu, \"peakBytes\": %lu }",
+            stats->allocations, (unsigned long) stats->bytes,
+            (unsigned long) stats->peakBytes);
+} /* writeJSONClass */
+
+
+/* Lua allocations by size class; "size" is null for the unpooled ones. */
+static void writeJSONMemory(FILE *io, const TobyArenaStats *stats)
+{
+    int i;
+    fprintf(io, ",\n      \"luaMemory\": {");
+    fprintf(io, "\n        \"chunks\": %lu", stats->chunks);
+    fprintf(io, ",\n        \"chunkBytes\": %lu",
+            (unsigned long) stats->chunkBytes);
+    fprintf(io, ",\n        \"classes\": [");
+    for (i = 0; i < TOBY_ARENA_CLASSES; i++)
+        writeJSONClass(io, &stats->classes[i], (i + 1) * 16, (i == 0));
+    writeJSONClass(io, &stats->big, 0, 0);
+    fprintf(io, "\n        ]\n      }");
+} /* writeJSONMemory */
+
+
+static void writeJSONResult(FILE *io, const char *fname,
+                            const BenchResult *result, int haveInstructions,
+                            unsigned long instructions, int first)
+{
+    const int ok = !result->failed;
+    const int runs = ok ? GRuns : 0;
+    const int complete = ok && !result->timedOut;
+    const int raster = (strcmp(result->backend, "raster") == 0);
+    const double secs = result->minSeconds;
+
+    fprintf(io, "%s\n    {\n      \"program\": ", first ? "" : ",");
+    writeJSONString(io, fname);
+    fprintf(io, ",\n      \"backend\": \"%s\"", result->backend);
+    fprintf(io, ",\n      \"runs\": %d", runs);
+    fprintf(io, ",\n      \"failed\": %s", result->failed ? "true" : "false");
+    fprintf(io, ",\n      \"timedOut\": %s",
+            result->timedOut ? "true" : "false");
+    if (!ok)
+    {
+        fprintf(io, "\n    }");
+        return;
+    } /* if */
+
+    fprintf(io, ",\n      \"minWallSeconds\": %.6f", result->minSeconds);
+    fprintf(io, ",\n      \"meanWallSeconds\": %.6f",
+            result->totalSeconds / (double) GRuns);
+    fprintf(io, ",\n      \"maxWallSeconds\": %.6f", result->maxSeconds);
+
+    fprintf(io, ",\n      \"instructions\": ");
+    if (haveInstructions)
+        fprintf(io, "%lu", instructions);
+    else
+        fprintf(io, "null");
+    writeJSONRate(io, "instructionsPerSec", complete && haveInstructions,
+                  instructions, secs);
+
+    fprintf(io, ",\n      \"segments\": %lu", result->stats.segments);
+    writeJSONRate(io, "segmentsPerSec", 1, result->stats.segments, secs);
+    fprintf(io, ",\n      \"strings\": %lu", result->stats.strings);
+    fprintf(io, ",\n      \"points\": %lu", result->stats.points);
+
+    fprintf(io, ",\n      \"pixels\": ");
+    if (raster)
+        fprintf(io, "%lu", result->pixels);
+    else
+        fprintf(io, "null");
+    writeJSONRate(io, "pixelsPerSec", raster, result->pixels, secs);
+
+    fprintf(io, ",\n      \"peakLuaBytes\": %lu", result->stats.peakMemory);
+    writeJSONMemory(io, &result->memory);
+    fprintf(io, "\n    }");
+} /* writeJSONResult */
+
+
+/* Most memory this process has had at once, in bytes, or -1 if unknown. */
+static double getPeakRSS(void)
+{
+    #if PLATFORM_WINDOWS
+    return -1.0;  /* !!! FIXME: GetProcessMemoryInfo() needs psapi. */
+    #else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+        return -1.0;
+    #if PLATFORM_MACOSX
+    return (double) usage.ru_maxrss;  /* bytes on Mac OS X... */
+    #else
+    return ((double) usage.ru_maxrss) * 1024.0;  /* ...kilobytes elsewhere. */
+    #endif
+    #endif
+} /* getPeakRSS */
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "USAGE: %s [options] [program.toby ...]\n"
+        "\n"
+        "  --runs <count>      Timed runs per program and backend (3).\n"
+        "  --size <pixels>     Width and height of the canvas (600).\n"
+        "  --timeout <ms>      Stop programs after this long, 0 for never\n"
+        "                       (10000).\n"
+        "  --output <file>     Write JSON here instead of stdout.\n"
+        "  --cachedir <dir>    Keep compiled programs in this directory.\n"
+        "  --lines <count>     Also time drawing this many lines with each\n"
+        "                       span writer (0).\n"
+        "\n", argv0);
+} /* usage */
+
+
+int main(int argc, char **argv)
+{
+    const char *outpath = NULL;
+    FILE *io = stdout;
+    TobyContext *ctx = NULL;
+    TobyRaster *raster = NULL;
+    BenchJob job;
+    double peakRSS;
+    int failures = 0;
+    int first = 1;
+    int programs = 0;
+    int i;
+
+    /* Parse command lines. */
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (*arg == '-')
+        {
+            while (*(++arg) == '-') { /* no-op. */ }
+            if (strcmp(arg, "runs") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GRuns = atoi(arg);
+            } /* if */
+            else if (strcmp(arg, "size") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GSize = atoi(arg);
+            } /* else if */
+            else if (strcmp(arg, "timeout") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GTimeout = atol(arg);
+            } /* else if */
+            else if (strcmp(arg, "lines") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GLines = atoi(arg);
+            } /* else if */
+            else if (strcmp(arg, "output") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    outpath = arg;
+            } /* else if */
+            else if (strcmp(arg, "cachedir") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                {
+                    if (!TOBY_setBytecodeCacheDir(arg))
+                    {
+                        fprintf(stderr, "Out of memory.\n");
+                        return 1;
+                    } /* if */
+                } /* if */
+            } /* else if */
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            } /* else */
+        } /* if */
+        else
+        {
+            programs++;
+        } /* else */
+    } /* for */
+
+    if ((programs == 0) && (GLines == 0))
+    {
+        usage(argv[0]);
+        return 3;
+    } /* if */
+
+    if ((GRuns <= 0) || (GSize <= 0) || (GLines < 0))
+    {
+        fprintf(stderr, "Runs and size must be more than zero, and lines"
+                        " can't be negative.\n");
+        return 1;
+    } /* if */
+
+    tobyhook_getTicks(NULL);  /* start the clock. */
+
+    memset(&job, '\0', sizeof (job));
+    raster = TOBY_createRaster(GSize);
+    if (raster != NULL)
+        ctx = TOBY_createContext(&callbacks, &job);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        TOBY_destroyRaster(raster);
+        return 1;
+    } /* if */
+
+    if (outpath != NULL)
+    {
+        io = fopen(outpath, "w");
+        if (io == NULL)
+        {
+            fprintf(stderr, "Couldn't open '%s': %s\n", outpath,
+                    strerror(errno));
+            TOBY_destroyContext(ctx);
+            TOBY_destroyRaster(raster);
+            return 1;
+        } /* if */
+    } /* if */
+
+    fprintf(io, "{\n  \"buildver\": ");
+    writeJSONString(io, GBuildVer);
+    fprintf(io, ",\n  \"runs\": %d,\n  \"size\": %d,\n  \"timeoutMs\": %ld",
+            GRuns, GSize, GTimeout);
+    fprintf(io, ",\n  \"results\": [");
+
+    for (i = 1; i < argc; i++)
+    {
+        BenchResult results[2];
+        unsigned long instructions = 0;
+        int haveInstructions = 0;
+        char *program = NULL;
+        int j;
+
+        if (*argv[i] == '-')
+        {
+            i++;  /* every option we take has an argument. */
+            continue;
+        } /* if */
+
+        job.fname = argv[i];
+        program = loadProgram(job.fname);
+        if (program == NULL)
+        {
+            failures++;
+            continue;
+        } /* if */
+
+        fprintf(stderr, "%s...\n", job.fname);
+
+        memset(results, '\0', sizeof (results));
+        results[0].backend = "null";
+        results[1].backend = "raster";
+
+        job.raster = NULL;
+        haveInstructions = countInstructions(ctx, &job, program, &instructions);
+        if (job.failed)
+            results[0].failed = results[1].failed = 1;
+        else
+        {
+            benchProgram(ctx, &job, program, &results[0]);
+            job.raster = raster;
+            benchProgram(ctx, &job, program, &results[1]);
+        } /* else */
+
+        for (j = 0; j < (int) STATICARRAYLEN(results); j++)
+        {
+            writeJSONResult(io, job.fname, &results[j], haveInstructions,
+                            instructions, first);
+            first = 0;
+        } /* for */
+
+        if (results[0].failed || results[1].failed)
+            failures++;
+
+        free(program);
+    } /* for */
+
+    fprintf(io, "\n  ]");
+
+    if ((GLines > 0) && (!benchAllLines(io, raster)))
+        failures++;
+
+    peakRSS = getPeakRSS();
+    fprintf(io, ",\n  \"peakRSSBytes\": ");
+    if (peakRSS < 0.0)
+        fprintf(io, "null");
+    else
+        fprintf(io, "%.0f", peakRSS);
+    fprintf(io, "\n}\n");
+
+    if ((outpath != NULL) && (fclose(io) != 0))
+    {
+        fprintf(stderr, "Couldn't write '%s': %s\n", outpath, strerror(errno));
+        failures++;
+    } /* if */
+
+    TOBY_destroyContext(ctx);
+    TOBY_destroyRaster(raster);
+    return (failures > 0) ? 4 : 0;
+} /* main */
+
+/* end of toby_bench.c ... */
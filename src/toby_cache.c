@@ -0,0 +1,315 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * On-disk cache of compiled programs. Each entry is a Lua chunk written by
+ *  lua_dump(), named after a hash of the Toby source and the build version,
+ *  so a rebuilt Toby never trusts bytecode from an older compiler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+#include "toby_app.h"
+#include "toby_compiler.h"
+
+#include "lauxlib.h"
+
+/* File header. Bump the last character if the file format changes. */
+static const char cacheMagic[8] = { 'T', 'O', 'B', 'Y', 'B', 'C', '0', '4' };
+
+static char *cacheDir = NULL;
+
+
+/* 64-bit FNV-1a. */
+static unsigned long long hashBytes(unsigned long long hash,
+                                    const void *_data, size_t len)
+{
+    const unsigned char *data = (const unsigned char *) _data;
+    while (len--)
+    {
+        hash ^= (unsigned long long) *(data++);
+        hash *= 1099511628211ULL;
+    } /* while */
+    return hash;
+} /* hashBytes */
+
+
+/* Build the cache filename for (source). Caller must free() it. */
+static char *cachePath(const char *source, size_t len, const char *ext)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const size_t numsize = sizeof (lua_Number);
+    char *retval;
+
+    hash = hashBytes(hash, source, len);
+    hash = hashBytes(hash, GBuildVer, strlen(GBuildVer));
+    hash = hashBytes(hash, &numsize, sizeof (numsize));
+
+    retval = (char *) malloc(strlen(cacheDir) + 32);
+    if (retval != NULL)
+    {
+        sprintf(retval, "%s/%08lx%08lx.%s", cacheDir,
+                (unsigned long) ((hash >> 32) & 0xFFFFFFFF),
+                (unsigned long) (hash & 0xFFFFFFFF), ext);
+    } /* if */
+    return retval;
+} /* cachePath */
+
+
+/* Read a whole file into a malloc()'d, null-terminated buffer. */
+static char *readFile(const char *fname, size_t *_len)
+{
+    char *retval = NULL;
+    FILE *io = fopen(fname, "rb");
+    if (io != NULL)
+    {
+        long len = 0;
+        if ( (fseek(io, 0, SEEK_END) == 0) && ((len = ftell(io)) >= 0) &&
+             (fseek(io, 0, SEEK_SET) == 0) )
+        {
+            retval = (char *) malloc(len + 1);
+            if (retval != NULL)
+            {
+                if ((len == 0) || (fread(retval, len, 1, io) == 1))
+                {
+                    retval[len] = '\0';
+                    *_len = (size_t) len;
+                } /* if */
+                else
+                {
+                    free(retval);
+                    retval = NULL;
+                } /* else */
+            } /* if */
+        } /* if */
+        fclose(io);
+    } /* if */
+
+    return retval;
+} /* readFile */
+
+
+static int chunkWriter(lua_State *L, const void *data, size_t len, void *ud)
+{
+    return (fwrite(data, len, 1, (FILE *) ud) == 1) ? 0 : 1;
+} /* chunkWriter */
+
+
+/* Store the function on top of (L)'s stack under (path). Fails silently. */
+static void writeCacheFile(lua_State *L, const char *path, size_t srclen)
+{
+    const size_t pathlen = strlen(path);
+    const unsigned int len32 = (unsigned int) srclen;
+    char *tmppath = (char *) malloc(pathlen + 32);
+    int okay = 0;
+    FILE *io;
+
+    if (tmppath == NULL)
+        return;
+
+    /*
+     * Write to a temp file and rename, so readers never see half a chunk.
+     *  Other threads might be writing the same entry, so the temp file is
+     *  named after the Lua state, too.
+     */
+    sprintf(tmppath, "%s.%lx.tmp", path, (unsigned long) (size_t) L);
+
+    io = fopen(tmppath, "wb");
+    if (io != NULL)
+    {
+        okay = ( (fwrite(cacheMagic, sizeof (cacheMagic), 1, io) == 1) &&
+                 (fwrite(&len32, sizeof (len32), 1, io) == 1) &&
+                 (lua_dump(L, chunkWriter, io) == 0) );
+        okay = (fclose(io) == 0) && okay;
+    } /* if */
+
+#if PLATFORM_WINDOWS
+    if (okay)
+        remove(path);  /* Windows won't rename over an existing file. */
+#endif
+
+    if ((!okay) || (rename(tmppath, path) != 0))
+        remove(tmppath);
+
+    free(tmppath);
+} /* writeCacheFile */
+
+
+/* Push the cached chunk for (path), if there's a valid one. */
+static int readCacheFile(lua_State *L, const char *path, size_t srclen,
+                         const char *chunkname)
+{
+    const size_t hdrlen = sizeof (cacheMagic) + sizeof (unsigned int);
+    unsigned int len32 = 0;
+    size_t len = 0;
+    int retval = 0;
+    char *buf = readFile(path, &len);
+
+    if (buf == NULL)
+        return 0;
+
+    if (len > hdrlen)
+        memcpy(&len32, buf + sizeof (cacheMagic), sizeof (len32));
+
+    if ( (len > hdrlen) && (len32 == (unsigned int) srclen) &&
+         (memcmp(buf, cacheMagic, sizeof (cacheMagic)) == 0) )
+    {
+        /* lua_load() notices the binary signature and undumps it. */
+        if (luaL_loadbuffer(L, buf + hdrlen, len - hdrlen, chunkname) == 0)
+            retval = 1;
+        else
+            lua_pop(L, 1);  /* corrupt entry; we'll compile over it. */
+    } /* if */
+
+    free(buf);
+    return retval;
+} /* readCacheFile */
+
+
+int TOBY_compileCached(lua_State *L, const char *source, const char *chunkname)
+{
+    const size_t len = strlen(source);
+    char *path = NULL;
+    int retval;
+
+    if (cacheDir != NULL)
+        path = cachePath(source, len, "tbc");
+
+    if ((path != NULL) && (readCacheFile(L, path, len, chunkname)))
+        retval = 0;
+    else
+    {
+        retval = TOBY_compile(L, source, chunkname);
+        if ((retval == 0) && (path != NULL))
+            writeCacheFile(L, path, len);
+    } /* else */
+
+    free(path);
+    return retval;
+} /* TOBY_compileCached */
+
+
+int TOBY_setBytecodeCacheDir(const char *dir)
+{
+    char *ptr = NULL;
+
+    if (dir != NULL)
+    {
+        ptr = (char *) malloc(strlen(dir) + 1);
+        if (ptr == NULL)
+            return 0;
+        strcpy(ptr, dir);
+
+#if PLATFORM_WINDOWS
+        _mkdir(ptr);  /* may already exist; opening entries will tell. */
+#else
+        mkdir(ptr, 0777);
+#endif
+    } /* if */
+
+    free(cacheDir);
+    cacheDir = ptr;
+    return 1;
+} /* TOBY_setBytecodeCacheDir */
+
+
+/* Compile (fname) into the cache. Returns non-zero if it's there now. */
+static int prewarmProgram(const char *dir, const char *fname)
+{
+    char *path = (char *) malloc(strlen(dir) + strlen(fname) + 2);
+    char *source = NULL;
+    size_t len = 0;
+    int retval = 0;
+
+    if (path != NULL)
+    {
+        sprintf(path, "%s/%s", dir, fname);
+        source = readFile(path, &len);
+        free(path);
+    } /* if */
+
+    if (source != NULL)
+    {
+        lua_State *L = luaL_newstate();
+        if (L != NULL)
+        {
+            retval = (TOBY_compileCached(L, source, "=program") == 0);
+            lua_close(L);
+        } /* if */
+        free(source);
+    } /* if */
+
+    return retval;
+} /* prewarmProgram */
+
+
+static int isTobyProgram(const char *fname)
+{
+    const size_t len = strlen(fname);
+    return ((len > 5) && (strcmp(fname + (len - 5), ".toby") == 0));
+} /* isTobyProgram */
+
+
+int TOBY_prewarmBytecodeCache(const char *dir)
+{
+    int retval = 0;
+
+    if (cacheDir == NULL)
+        return -1;
+
+#if PLATFORM_WINDOWS
+    {
+        WIN32_FIND_DATAA data;
+        HANDLE h;
+        char *wildcard = (char *) malloc(strlen(dir) + 3);
+        if (wildcard == NULL)
+            return -1;
+        sprintf(wildcard, "%s\\*", dir);
+        h = FindFirstFileA(wildcard, &data);
+        free(wildcard);
+        if (h == INVALID_HANDLE_VALUE)
+            return -1;
+        do
+        {
+            if (isTobyProgram(data.cFileName))
+                retval += prewarmProgram(dir, data.cFileName);
+        } while (FindNextFileA(h, &data));
+        FindClose(h);
+    }
+#else
+    {
+        struct dirent *dent;
+        DIR *dirp = opendir(dir);
+        if (dirp == NULL)
+            return -1;
+        while ((dent = readdir(dirp)) != NULL)
+        {
+            if (isTobyProgram(dent->d_name))
+                retval += prewarmProgram(dir, dent->d_name);
+        } /* while */
+        closedir(dirp);
+    }
+#endif
+
+    return retval;
+} /* TOBY_prewarmBytecodeCache */
+
+/* end of toby_cache.c ... */
+
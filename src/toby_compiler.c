@@ -0,0 +1,1923 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * This is a Toby front end for the Lua virtual machine. It lexes and parses
+ *  Toby source, and emits Lua 5.1 bytecode directly through lcode.c, the
+ *  same way lparser.c does for Lua source. There's never an intermediate
+ *  Lua source string to build and parse a second time.
+ *
+ * lcode.c only cares about a few fields of the LexState (line numbers and
+ *  error reporting), so we embed one at the start of our parser state and
+ *  keep it up to date as we go.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "toby_app.h"
+#include "toby_compiler.h"
+
+#include "lcode.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "llex.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lparser.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lzio.h"
+
+typedef enum TobyTokenType
+{
+    TOKEN_EOI = 0,
+    /* single-character tokens are their own ASCII value. */
+    TOKEN_NUMBER = 257,
+    TOKEN_STRING,
+    TOKEN_IDENTIFIER,
+    TOKEN_EQ,  /* "==" */
+    TOKEN_NE,  /* "!=" */
+    TOKEN_LE,  /* "<=" */
+    TOKEN_GE,  /* ">=" */
+
+    /* keywords. Keep these in the same (alphabetical) order as keywords[]! */
+    TOKEN_AND,
+    TOKEN_ARRAY,
+    TOKEN_BOOLEAN,
+    TOKEN_DOWNTO,
+    TOKEN_ELSE,
+    TOKEN_ELSEIF,
+    TOKEN_ENDFOR,
+    TOKEN_ENDFUNCTION,
+    TOKEN_ENDIF,
+    TOKEN_ENDWHILE,
+    TOKEN_FALSE,
+    TOKEN_FOR,
+    TOKEN_FUNCTION,
+    TOKEN_IF,
+    TOKEN_NOT,
+    TOKEN_NOTHING,
+    TOKEN_NUMBERTYPE,
+    TOKEN_OF,
+    TOKEN_OR,
+    TOKEN_RETURN,
+    TOKEN_RETURNS,
+    TOKEN_STEP,
+    TOKEN_STRINGTYPE,
+    TOKEN_TO,
+    TOKEN_TRUE,
+    TOKEN_WHILE,
+} TobyTokenType;
+
+static const char *keywords[] =
+{
+    "and", "array", "boolean", "downto", "else", "elseif", "endfor",
+    "endfunction", "endif", "endwhile", "false", "for", "function", "if",
+    "not", "nothing", "number", "of", "or", "return", "returns", "step",
+    "string", "to", "true", "while",
+};
+
+static const char *const builtinNames[] =
+{
+    #define TOBY_BUILTIN(sym) #sym,
+    TOBY_BUILTINS(TOBY_BUILTIN)
+    #undef TOBY_BUILTIN
+};
+
+#define BUILTIN_COUNT ((int) (sizeof (builtinNames) / sizeof (builtinNames[0])))
+
+/* the builtins live here, so OP_CALLBUILTIN's can't go away. */
+static const char *builtinsRegistryKey = "toby.builtins";
+static const char *builtinInfoRegistryKey = "toby.builtininfo";
+
+
+typedef struct TobyToken
+{
+    int type;
+    int line;
+    lua_Number num;  /* for TOKEN_NUMBER. */
+    TString *ts;  /* for TOKEN_IDENTIFIER (lowercased) and TOKEN_STRING. */
+    const char *spelling;  /* start of token in the original source. */
+    size_t spellinglen;
+} TobyToken;
+
+
+/* A local variable, parallel to FuncState::actvar[]. */
+typedef struct TobyLocal
+{
+    TString *name;  /* lowercased, NULL for hidden registers. */
+    TobyVarType vtype;
+} TobyLocal;
+
+
+typedef struct TobyBlock
+{
+    struct TobyBlock *previous;
+    lu_byte nactvar;  /* active locals outside this block. */
+} TobyBlock;
+
+
+/* Per-function state; wraps the FuncState that lcode.c works on. */
+typedef struct TobyFuncState
+{
+    FuncState fs;
+    TobyBlock *bl;
+    TobyType returnType;
+    TobyLocal locals[LUAI_MAXVARS];
+} TobyFuncState;
+
+
+/* Global variables and functions, kept for the whole compile. */
+typedef struct TobySymbol
+{
+    TString *name;  /* lowercased. */
+    TString *spelling;  /* as declared, for error messages. */
+    int isFunction;
+    TobyVarType vtype;  /* variable type, or function's return type. */
+    int paramCount;
+    TobyVarType *params;
+    int predeclared;  /* function seen by declareFunctions(), not compiled. */
+} TobySymbol;
+
+
+typedef struct TobyParser
+{
+    LexState ls;  /* must be first! lcode.c gets to us through fs->ls. */
+    lua_State *L;
+    const char *ptr;
+    int line;
+    TobyToken token;
+    Mbuffer buff;
+    TobyFuncState *tfs;
+    TobySymbol *symbols;
+    int symbolCount;
+    int symbolAlloc;
+} TobyParser;
+
+
+static void failLine(TobyParser *P, int line, const char *fmt, ...)
+{
+    lua_State *L = P->L;
+    char chunk[LUA_IDSIZE];
+    const char *msg;
+    va_list ap;
+
+    va_start(ap, fmt);
+    msg = luaO_pushvfstring(L, fmt, ap);
+    va_end(ap);
+
+    luaO_chunkid(chunk, getstr(P->ls.source), sizeof (chunk));
+    luaO_pushfstring(L, "%s:%d: %s", chunk, line, msg);
+    luaD_throw(L, LUA_ERRSYNTAX);
+} /* failLine */
+
+#define fail(P, msg) failLine(P, (P)->token.line, "%s", msg)
+
+
+static const char *tokenName(TobyParser *P, int type)
+{
+    switch (type)
+    {
+        case TOKEN_EOI: return "end of program";
+        case TOKEN_NUMBER: return "number";
+        case TOKEN_STRING: return "string";
+        case TOKEN_IDENTIFIER: return "name";
+        case TOKEN_EQ: return "'=='";
+        case TOKEN_NE: return "'!='";
+        case TOKEN_LE: return "'<='";
+        case TOKEN_GE: return "'>='";
+    } /* switch */
+
+    if (type >= TOKEN_AND)
+        return luaO_pushfstring(P->L, "'%s'", keywords[type - TOKEN_AND]);
+    return luaO_pushfstring(P->L, "'%c'", type);
+} /* tokenName */
+
+
+static inline int isAlpha(const char ch)
+{
+    return ( ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) ||
+             (ch == '_') );
+} /* isAlpha */
+
+
+static inline int isDigit(const char ch)
+{
+    return ((ch >= '0') && (ch <= '9'));
+} /* isDigit */
+
+
+static inline char toLower(const char ch)
+{
+    return ((ch >= 'A') && (ch <= 'Z')) ? (ch - ('A' - 'a')) : ch;
+} /* toLower */
+
+
+static int cmpKeyword(const void *a, const void *b)
+{
+    return strcmp((const char *) a, *((const char * const *) b));
+} /* cmpKeyword */
+
+
+static char *scratch(TobyParser *P, size_t len)
+{
+    if (luaZ_sizebuffer(&P->buff) < len)
+        luaZ_resizebuffer(P->L, &P->buff, len);
+    return luaZ_buffer(&P->buff);
+} /* scratch */
+
+
+static void lexIdentifier(TobyParser *P, TobyToken *tok)
+{
+    const char *start = P->ptr;
+    const char *ptr = start;
+    const char **kw;
+    size_t len, i;
+    char *buf;
+
+    while ((isAlpha(*ptr)) || (isDigit(*ptr)))
+        ptr++;
+
+    /* Toby is case-insensitive, so all names are lowercased here. */
+    len = (size_t) (ptr - start);
+    buf = scratch(P, len + 1);
+    for (i = 0; i < len; i++)
+        buf[i] = toLower(start[i]);
+    buf[len] = '\0';
+    P->ptr = ptr;
+
+    kw = (const char **) bsearch(buf, keywords, STATICARRAYLEN(keywords),
+                                 sizeof (keywords[0]), cmpKeyword);
+    if (kw != NULL)
+        tok->type = TOKEN_AND + (int) (kw - keywords);
+    else
+    {
+        tok->type = TOKEN_IDENTIFIER;
+        tok->ts = luaX_newstring(&P->ls, buf, len);
+    } /* else */
+} /* lexIdentifier */
+
+
+static void lexNumber(TobyParser *P, TobyToken *tok)
+{
+    const char *start = P->ptr;
+    const char *ptr = start;
+    size_t len;
+    char *buf;
+
+    while (isDigit(*ptr))
+        ptr++;
+    if (*ptr == '.')
+    {
+        ptr++;
+        while (isDigit(*ptr))
+            ptr++;
+    } /* if */
+
+    if (isAlpha(*ptr))
+        fail(P, "Malformed number");
+
+    len = (size_t) (ptr - start);
+    buf = scratch(P, len + 1);
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    if (!luaO_str2d(buf, &tok->num))
+        fail(P, "Malformed number");
+
+    tok->type = TOKEN_NUMBER;
+    P->ptr = ptr;
+} /* lexNumber */
+
+
+static void lexString(TobyParser *P, TobyToken *tok)
+{
+    const char *start = ++P->ptr;  /* skip opening quote. */
+    const char *ptr = start;
+
+    while (*ptr != '\"')
+    {
+        if ((*ptr == '\0') || (*ptr == '\n') || (*ptr == '\r'))
+            fail(P, "Unfinished string");
+        ptr++;
+    } /* while */
+
+    tok->type = TOKEN_STRING;
+    tok->ts = luaX_newstring(&P->ls, start, (size_t) (ptr - start));
+    P->ptr = ptr + 1;  /* skip closing quote. */
+} /* lexString */
+
+
+static void nextToken(TobyParser *P)
+{
+    TobyToken *tok = &P->token;
+
+    /* lcode.c tags each instruction with the line of the last token used. */
+    P->ls.lastline = tok->line;
+
+    for (;;)
+    {
+        const char ch = *P->ptr;
+        if (ch == '\n')
+        {
+            P->line++;
+            P->ptr++;
+        } /* if */
+        else if ((ch == ' ') || (ch == '\t') || (ch == '\r') ||
+                 (ch == '\f') || (ch == '\v'))
+        {
+            P->ptr++;
+        } /* else if */
+        else if ((ch == '/') && (P->ptr[1] == '/'))  /* comment to EOL. */
+        {
+            while ((*P->ptr != '\n') && (*P->ptr != '\0'))
+                P->ptr++;
+        } /* else if */
+        else
+        {
+            break;
+        } /* else */
+    } /* for */
+
+    tok->line = P->ls.linenumber = P->line;
+    tok->spelling = P->ptr;
+    tok->ts = NULL;
+
+    switch (*P->ptr)
+    {
+        case '\0':
+            tok->type = TOKEN_EOI;
+            break;
+
+        case '\"':
+            lexString(P, tok);
+            break;
+
+        case '=': case '!': case '<': case '>':
+            if (P->ptr[1] == '=')
+            {
+                switch (*P->ptr)
+                {
+                    case '=': tok->type = TOKEN_EQ; break;
+                    case '!': tok->type = TOKEN_NE; break;
+                    case '<': tok->type = TOKEN_LE; break;
+                    case '>': tok->type = TOKEN_GE; break;
+                } /* switch */
+                P->ptr += 2;
+            } /* if */
+            else if (*P->ptr == '!')
+            {
+                fail(P, "Unexpected character '!'");
+            } /* else if */
+            else
+            {
+                tok->type = *(P->ptr++);
+            } /* else */
+            break;
+
+        case '(': case ')': case '[': case ']': case ',':
+        case '+': case '-': case '*': case '/': case '%':
+            tok->type = *(P->ptr++);
+            break;
+
+        default:
+            if (isAlpha(*P->ptr))
+                lexIdentifier(P, tok);
+            else if ( (isDigit(*P->ptr)) ||
+                      ((*P->ptr == '.') && (isDigit(P->ptr[1]))) )
+                lexNumber(P, tok);
+            else
+                failLine(P, P->line, "Unexpected character '%c'", *P->ptr);
+            break;
+    } /* switch */
+
+    tok->spellinglen = (size_t) (P->ptr - tok->spelling);
+} /* nextToken */
+
+
+static inline int testNext(TobyParser *P, int type)
+{
+    if (P->token.type != type)
+        return 0;
+    nextToken(P);
+    return 1;
+} /* testNext */
+
+
+static void expected(TobyParser *P, const char *what)
+{
+    failLine(P, P->token.line, "Expected %s, found %s", what,
+             tokenName(P, P->token.type));
+} /* expected */
+
+
+static void checkNext(TobyParser *P, int type)
+{
+    if (P->token.type != type)
+        expected(P, tokenName(P, type));
+    nextToken(P);
+} /* checkNext */
+
+
+static TString *checkIdentifier(TobyParser *P)
+{
+    TString *retval = P->token.ts;
+    if (P->token.type != TOKEN_IDENTIFIER)
+        expected(P, "a name");
+    nextToken(P);
+    return retval;
+} /* checkIdentifier */
+
+
+/* The name as the programmer typed it, for debug info and error messages. */
+static TString *tokenSpelling(TobyParser *P)
+{
+    const TobyToken *tok = &P->token;
+    return luaX_newstring(&P->ls, tok->spelling, tok->spellinglen);
+} /* tokenSpelling */
+
+
+static const char *typeName(const TobyType type)
+{
+    switch (type)
+    {
+        case TOBYTYPE_UNKNOWN: return "unknown";
+        case TOBYTYPE_NOTHING: return "nothing";
+        case TOBYTYPE_NUMBER: return "number";
+        case TOBYTYPE_BOOLEAN: return "boolean";
+        case TOBYTYPE_STRING: return "string";
+        case TOBYTYPE_ARRAY: return "array";
+    } /* switch */
+    return "???";
+} /* typeName */
+
+
+/* Only complain if we're sure: we don't know everything at compile time. */
+static void checkType(TobyParser *P, int line, TobyType want, TobyType got)
+{
+    if ((want != TOBYTYPE_UNKNOWN) && (got != TOBYTYPE_UNKNOWN) && (want != got))
+    {
+        failLine(P, line, "Type mismatch: expected %s, found %s",
+                 typeName(want), typeName(got));
+    } /* if */
+} /* checkType */
+
+
+static TobySymbol *findSymbol(TobyParser *P, const TString *name)
+{
+    int i;
+    for (i = 0; i < P->symbolCount; i++)
+    {
+        if (P->symbols[i].name == name)
+            return &P->symbols[i];
+    } /* for */
+    return NULL;
+} /* findSymbol */
+
+
+/* The builtin's number, or -1 if (name) isn't a builtin. */
+static int findBuiltin(const char *name)
+{
+    int i;
+    for (i = 0; i < BUILTIN_COUNT; i++)
+    {
+        if (strcmp(builtinNames[i], name) == 0)
+            return i;
+    } /* for */
+    return -1;
+} /* findBuiltin */
+
+
+/* Calls always go to the builtin, so nothing else can have its name. */
+static void checkNotBuiltin(TobyParser *P, const TString *name,
+                            const TString *spelling)
+{
+    if (findBuiltin(getstr(name)) >= 0)
+    {
+        failLine(P, P->ls.lastline, "'%s' is the name of a builtin function",
+                 getstr(spelling));
+    } /* if */
+} /* checkNotBuiltin */
+
+
+static TobySymbol *addSymbol(TobyParser *P, TString *name, TString *spelling,
+                             int isFunction, const TobyVarType *vtype)
+{
+    TobySymbol *sym;
+
+    checkNotBuiltin(P, name, spelling);
+    sym = findSymbol(P, name);
+    if (sym != NULL)
+    {
+        if ((isFunction) || (sym->isFunction))
+        {
+            failLine(P, P->ls.lastline, "'%s' is already defined",
+                     getstr(spelling));
+        } /* if */
+        sym->vtype = *vtype;  /* redeclared global variable: last one wins. */
+        return sym;
+    } /* if */
+
+    luaM_growvector(P->L, P->symbols, P->symbolCount, P->symbolAlloc,
+                    TobySymbol, MAX_INT, "too many symbols");
+    sym = &P->symbols[P->symbolCount++];
+    sym->name = name;
+    sym->spelling = spelling;
+    sym->isFunction = isFunction;
+    sym->vtype = *vtype;
+    sym->paramCount = 0;
+    sym->params = NULL;
+    sym->predeclared = 0;
+    return sym;
+} /* addSymbol */
+
+
+static void freeSymbols(TobyParser *P)
+{
+    int i;
+    for (i = 0; i < P->symbolCount; i++)
+        luaM_freearray(P->L, P->symbols[i].params, P->symbols[i].paramCount,
+                       TobyVarType);
+    luaM_freearray(P->L, P->symbols, P->symbolAlloc, TobySymbol);
+    P->symbols = NULL;
+    P->symbolCount = P->symbolAlloc = 0;
+} /* freeSymbols */
+
+
+
+/* Function state management; this mirrors what lparser.c does. */
+
+static inline void initExp(expdesc *e, expkind k, int info)
+{
+    e->f = e->t = NO_JUMP;
+    e->k = k;
+    e->u.s.info = info;
+} /* initExp */
+
+
+static int registerLocalVar(TobyParser *P, TString *varname)
+{
+    FuncState *fs = &P->tfs->fs;
+    Proto *f = fs->f;
+    int oldsize = f->sizelocvars;
+    luaM_growvector(P->L, f->locvars, fs->nlocvars, f->sizelocvars,
+                    LocVar, SHRT_MAX, "too many local variables");
+    while (oldsize < f->sizelocvars)
+        f->locvars[oldsize++].varname = NULL;
+    f->locvars[fs->nlocvars].varname = varname;
+    luaC_objbarrier(P->L, f, varname);
+    return fs->nlocvars++;
+} /* registerLocalVar */
+
+
+/* (name) is the lowercased name, (spelling) goes in the debug info. */
+static void newLocalVar(TobyParser *P, TString *name, TString *spelling,
+                        const TobyVarType *vtype, int n)
+{
+    TobyFuncState *tfs = P->tfs;
+    FuncState *fs = &tfs->fs;
+    const int idx = fs->nactvar + n;
+    if (idx + 1 > LUAI_MAXVARS)
+        fail(P, "Too many local variables");
+    if (name != NULL)
+        checkNotBuiltin(P, name, spelling);
+    fs->actvar[idx] = cast(unsigned short, registerLocalVar(P, spelling));
+    tfs->locals[idx].name = name;
+    if (vtype != NULL)
+        tfs->locals[idx].vtype = *vtype;
+    else
+        memset(&tfs->locals[idx].vtype, '\0', sizeof (TobyVarType));
+} /* newLocalVar */
+
+
+static void newHiddenVar(TobyParser *P, const char *name, int n)
+{
+    TString *ts = luaX_newstring(&P->ls, name, strlen(name));
+    newLocalVar(P, NULL, ts, NULL, n);
+} /* newHiddenVar */
+
+
+static void adjustLocalVars(TobyParser *P, int nvars)
+{
+    FuncState *fs = &P->tfs->fs;
+    fs->nactvar = cast_byte(fs->nactvar + nvars);
+    for (; nvars; nvars--)
+        fs->f->locvars[fs->actvar[fs->nactvar - nvars]].startpc = fs->pc;
+} /* adjustLocalVars */
+
+
+static void removeVars(TobyParser *P, int tolevel)
+{
+    FuncState *fs = &P->tfs->fs;
+    while (fs->nactvar > tolevel)
+        fs->f->locvars[fs->actvar[--fs->nactvar]].endpc = fs->pc;
+} /* removeVars */
+
+
+static int searchVar(TobyParser *P, const TString *name)
+{
+    const TobyFuncState *tfs = P->tfs;
+    int i;
+    for (i = tfs->fs.nactvar - 1; i >= 0; i--)
+    {
+        if (tfs->locals[i].name == name)
+            return i;
+    } /* for */
+    return -1;  /* not found. */
+} /* searchVar */
+
+
+static void enterBlock(TobyParser *P, TobyBlock *bl)
+{
+    TobyFuncState *tfs = P->tfs;
+    bl->nactvar = tfs->fs.nactvar;
+    bl->previous = tfs->bl;
+    tfs->bl = bl;
+    lua_assert(tfs->fs.freereg == tfs->fs.nactvar);
+} /* enterBlock */
+
+
+static void leaveBlock(TobyParser *P)
+{
+    TobyFuncState *tfs = P->tfs;
+    TobyBlock *bl = tfs->bl;
+    tfs->bl = bl->previous;
+    removeVars(P, bl->nactvar);
+    tfs->fs.freereg = tfs->fs.nactvar;  /* free registers. */
+} /* leaveBlock */
+
+
+static void openFunction(TobyParser *P, TobyFuncState *tfs)
+{
+    lua_State *L = P->L;
+    FuncState *fs = &tfs->fs;
+    Proto *f = luaF_newproto(L);
+    fs->f = f;
+    fs->prev = (P->tfs != NULL) ? &P->tfs->fs : NULL;
+    fs->ls = &P->ls;
+    fs->L = L;
+    fs->pc = 0;
+    fs->lasttarget = -1;
+    fs->jpc = NO_JUMP;
+    fs->freereg = 0;
+    fs->nk = 0;
+    fs->np = 0;
+    fs->nlocvars = 0;
+    fs->nactvar = 0;
+    fs->bl = NULL;
+    tfs->bl = NULL;
+    tfs->returnType = TOBYTYPE_NOTHING;
+    P->ls.fs = fs;
+    P->tfs = tfs;
+    f->source = P->ls.source;
+    f->maxstacksize = 2;  /* registers 0/1 are always valid */
+    fs->h = luaH_new(L, 0, 0);
+    /* anchor table of constants and prototype (to avoid being collected) */
+    sethvalue2s(L, L->top, fs->h);
+    incr_top(L);
+    setptvalue2s(L, L->top, f);
+    incr_top(L);
+} /* openFunction */
+
+
+static void closeFunction(TobyParser *P, TobyFuncState *parent)
+{
+    lua_State *L = P->L;
+    FuncState *fs = &P->tfs->fs;
+    Proto *f = fs->f;
+    removeVars(P, 0);
+    luaK_ret(fs, 0, 0);  /* final return */
+    luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
+    f->sizecode = fs->pc;
+    luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
+    f->sizelineinfo = fs->pc;
+    luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
+    f->sizek = fs->nk;
+    luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *);
+    f->sizep = fs->np;
+    luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar);
+    f->sizelocvars = fs->nlocvars;
+    lua_assert(luaG_checkcode(f));
+    lua_assert(P->tfs->bl == NULL);
+    P->tfs = parent;
+    P->ls.fs = (parent != NULL) ? &parent->fs : NULL;
+    L->top -= 2;  /* remove table and prototype from the stack */
+
+    /* current token was anchored in the defunct function; reanchor it. */
+    if ((parent != NULL) && (P->token.ts != NULL))
+        luaX_newstring(&P->ls, getstr(P->token.ts), P->token.ts->tsv.len);
+} /* closeFunction */
+
+
+static void enterLevel(TobyParser *P)
+{
+    if (++P->L->nCcalls > LUAI_MAXCCALLS)
+        fail(P, "Program is nested too deeply");
+} /* enterLevel */
+
+#define leaveLevel(P) ((P)->L->nCcalls--)
+
+
+
+/* Types... */
+
+static void defaultValue(TobyParser *P, TobyType type, expdesc *e)
+{
+    FuncState *fs = &P->tfs->fs;
+    switch (type)
+    {
+        case TOBYTYPE_BOOLEAN:
+            initExp(e, VFALSE, 0);
+            break;
+        case TOBYTYPE_STRING:
+            initExp(e, VK, luaK_stringK(fs, luaS_newliteral(P->L, "")));
+            break;
+        default:
+            initExp(e, VKNUM, 0);
+            e->u.nval = cast_num(0);
+            break;
+    } /* switch */
+} /* defaultValue */
+
+
+static int parseWholeNumber(TobyParser *P)
+{
+    const int negative = testNext(P, '-');
+    lua_Number num = P->token.num;
+    int retval;
+
+    if (P->token.type != TOKEN_NUMBER)
+        expected(P, "a whole number");
+
+    retval = (int) num;
+    if (((lua_Number) retval) != num)
+        fail(P, "Expected a whole number");
+
+    nextToken(P);
+    return negative ? -retval : retval;
+} /* parseWholeNumber */
+
+
+static TobyType parseBasicType(TobyParser *P)
+{
+    switch (P->token.type)
+    {
+        case TOKEN_NUMBERTYPE: nextToken(P); return TOBYTYPE_NUMBER;
+        case TOKEN_BOOLEAN: nextToken(P); return TOBYTYPE_BOOLEAN;
+        case TOKEN_STRINGTYPE: nextToken(P); return TOBYTYPE_STRING;
+    } /* switch */
+
+    expected(P, "a type");
+    return TOBYTYPE_UNKNOWN;  /* shouldn't hit this. */
+} /* parseBasicType */
+
+
+/*
+ * Parses "number", "boolean", "string" or "array of type[lo to hi]..."
+ *  Array bounds must be whole number constants.
+ */
+static void parseType(TobyParser *P, TobyVarType *vtype)
+{
+    memset(vtype, '\0', sizeof (TobyVarType));
+    if (!testNext(P, TOKEN_ARRAY))
+        vtype->type = parseBasicType(P);
+    else
+    {
+        vtype->type = TOBYTYPE_ARRAY;
+        checkNext(P, TOKEN_OF);
+        vtype->elementType = parseBasicType(P);
+        if (P->token.type != '[')
+            expected(P, "array dimensions");
+
+        while (testNext(P, '['))
+        {
+            const int dim = vtype->dimensions;
+            if (dim >= TOBY_MAX_ARRAY_DIMENSIONS)
+                fail(P, "Too many array dimensions");
+            vtype->lower[dim] = parseWholeNumber(P);
+            checkNext(P, TOKEN_TO);
+            vtype->upper[dim] = parseWholeNumber(P);
+            if (vtype->upper[dim] < vtype->lower[dim])
+                fail(P, "Array's upper bound is less than its lower bound");
+            checkNext(P, ']');
+            vtype->dimensions++;
+        } /* while */
+    } /* else */
+} /* parseType */
+
+
+static inline int isTypeToken(const int type)
+{
+    return ( (type == TOKEN_NUMBERTYPE) || (type == TOKEN_BOOLEAN) ||
+             (type == TOKEN_STRINGTYPE) || (type == TOKEN_ARRAY) );
+} /* isTypeToken */
+
+
+/*
+ * Emit a numeric for loop's prologue over constant bounds, with the four
+ *  loop registers starting at (base). Returns the FORPREP's pc, to hand
+ *  to endConstantLoop() after emitting the loop body.
+ */
+static int beginConstantLoop(TobyParser *P, int base, int lower, int upper)
+{
+    FuncState *fs = &P->tfs->fs;
+    luaK_codeABx(fs, OP_LOADK, base, luaK_numberK(fs, cast_num(lower)));
+    luaK_codeABx(fs, OP_LOADK, base+1, luaK_numberK(fs, cast_num(upper)));
+    luaK_codeABx(fs, OP_LOADK, base+2, luaK_numberK(fs, cast_num(1)));
+    luaK_reserveregs(fs, 4);
+    return luaK_codeAsBx(fs, OP_FORPREP, base, NO_JUMP);
+} /* beginConstantLoop */
+
+
+static void endConstantLoop(TobyParser *P, int base, int prep)
+{
+    FuncState *fs = &P->tfs->fs;
+    int endfor;
+    luaK_patchtohere(fs, prep);
+    endfor = luaK_codeAsBx(fs, OP_FORLOOP, base, NO_JUMP);
+    luaK_patchlist(fs, endfor, prep + 1);
+} /* endConstantLoop */
+
+
+/*
+ * Build a new array into the next free register, every element set to the
+ *  element type's default value, so reading an element the program hasn't
+ *  assigned yet works like reading any other uninitialized variable.
+ */
+static void newArray(TobyParser *P, const TobyVarType *vtype, int dim)
+{
+    FuncState *fs = &P->tfs->fs;
+    const int lower = vtype->lower[dim];
+    const int upper = vtype->upper[dim];
+    const int size = (upper - lower) + 1;
+    const int table = fs->freereg;
+    int base, prep;
+    expdesc key, val;
+
+    luaK_codeABC(fs, OP_NEWTABLE, table,
+                 (lower == 1) ? luaO_int2fb((unsigned int) size) : 0,
+                 (lower == 1) ? 0 : luaO_int2fb((unsigned int) size));
+    luaK_reserveregs(fs, 1);
+
+    base = fs->freereg;
+    prep = beginConstantLoop(P, base, lower, upper);
+
+    if (dim < (vtype->dimensions - 1))
+    {
+        newArray(P, vtype, dim + 1);
+        initExp(&val, VNONRELOC, fs->freereg - 1);
+    } /* if */
+    else
+    {
+        defaultValue(P, vtype->elementType, &val);
+    } /* else */
+
+    initExp(&key, VINDEXED, table);
+    key.u.s.aux = base+3;
+    luaK_storevar(fs, &key, &val);
+
+    endConstantLoop(P, base, prep);
+    fs->freereg = table + 1;  /* drop the loop registers. */
+} /* newArray */
+
+
+/* Put a new variable's starting value into the next free register. */
+static void initialValue(TobyParser *P, const TobyVarType *vtype)
+{
+    FuncState *fs = &P->tfs->fs;
+    if (vtype->type == TOBYTYPE_ARRAY)
+        newArray(P, vtype, 0);
+    else
+    {
+        expdesc e;
+        defaultValue(P, vtype->type, &e);
+        luaK_exp2nextreg(fs, &e);
+    } /* else */
+} /* initialValue */
+
+
+
+/* Expressions... */
+
+static TobyType expr(TobyParser *P, expdesc *v);
+
+
+static TobyType singleVar(TobyParser *P, TString *name, expdesc *v,
+                          const TobyVarType **vtype)
+{
+    FuncState *fs = &P->tfs->fs;
+    const int idx = searchVar(P, name);
+    const TobySymbol *sym;
+
+    if (idx >= 0)
+    {
+        initExp(v, VLOCAL, idx);
+        *vtype = &P->tfs->locals[idx].vtype;
+        return (*vtype)->type;
+    } /* if */
+
+    /* Not a local, so it's a global (but maybe not one we've seen yet). */
+    initExp(v, VGLOBAL, NO_REG);
+    v->u.s.info = luaK_stringK(fs, name);
+    sym = findSymbol(P, name);
+    if ((sym != NULL) && (!sym->isFunction))
+    {
+        *vtype = &sym->vtype;
+        return sym->vtype.type;
+    } /* if */
+
+    *vtype = NULL;
+    return TOBYTYPE_UNKNOWN;
+} /* singleVar */
+
+
+static TobyType functionCall(TobyParser *P, TString *name, TString *spelling,
+                             expdesc *f)
+{
+    FuncState *fs = &P->tfs->fs;
+    const TobySymbol *sym = findSymbol(P, name);
+    const int builtin = findBuiltin(getstr(name));
+    const int line = P->ls.lastline;
+    int base, nparams;
+    int argc = 0;
+    int rkarg = -1;
+
+    if (searchVar(P, name) >= 0)
+        failLine(P, line, "'%s' is a variable, not a function", getstr(spelling));
+    else if ((sym != NULL) && (!sym->isFunction))
+        failLine(P, line, "'%s' is a variable, not a function", getstr(spelling));
+
+    if (builtin >= 0)  /* no name lookup at runtime for these. */
+    {
+        base = fs->freereg;
+        luaK_reserveregs(fs, 1);  /* the result goes here. */
+    } /* if */
+    else
+    {
+        initExp(f, VGLOBAL, NO_REG);
+        f->u.s.info = luaK_stringK(fs, name);
+        luaK_exp2nextreg(fs, f);
+        base = f->u.s.info;
+    } /* else */
+
+    checkNext(P, '(');
+    if (P->token.type != ')')
+    {
+        do
+        {
+            expdesc arg;
+            const int argline = P->token.line;
+            const TobyType type = expr(P, &arg);
+            if ((sym != NULL) && (argc < sym->paramCount))
+                checkType(P, argline, sym->params[argc].type, type);
+            luaK_setoneret(fs, &arg);
+            argc++;
+            if ( (LUAI_SUPERINSTRUCTIONS) && (builtin >= 0) && (argc == 1) &&
+                 (P->token.type == ')') )
+                rkarg = luaK_exp2RK(fs, &arg);  /* for OP_CALLBUILTIN1. */
+            else
+                luaK_exp2nextreg(fs, &arg);
+        } while (testNext(P, ','));
+    } /* if */
+    checkNext(P, ')');
+
+    if ((sym != NULL) && (argc != sym->paramCount))
+    {
+        failLine(P, line, "'%s' needs %d argument%s, but was given %d",
+                 getstr(sym->spelling), sym->paramCount,
+                 (sym->paramCount == 1) ? "" : "s", argc);
+    } /* if */
+
+    nparams = fs->freereg - (base+1);
+    if (builtin < 0)
+        initExp(f, VCALL, luaK_codeABC(fs, OP_CALL, base, nparams+1, 2));
+    else
+    {
+        if (rkarg < 0)
+            luaK_codeABC(fs, OP_CALLBUILTIN, base, nparams+1, builtin);
+        else  /* the argument doesn't have to be copied after the base... */
+        {
+            /* ...unless it's a regular call, so keep room for it there. */
+            luaK_checkstack(fs, (base + 2) - fs->freereg);
+            luaK_codeABC(fs, OP_CALLBUILTIN1, base, rkarg, builtin);
+        } /* else */
+        initExp(f, VNONRELOC, base);  /* always exactly one result. */
+    } /* else */
+    luaK_fixline(fs, line);
+    fs->freereg = base+1;  /* call leaves one result where the function was. */
+
+    return (sym != NULL) ? sym->vtype.type : TOBYTYPE_UNKNOWN;
+} /* functionCall */
+
+
+/* Parse "[expr]..." array subscripts after a variable. */
+static TobyType subscripts(TobyParser *P, expdesc *v, const TobyVarType *vt)
+{
+    FuncState *fs = &P->tfs->fs;
+    int dims = 0;
+
+    while (P->token.type == '[')
+    {
+        expdesc key;
+        const int line = P->token.line;
+        nextToken(P);
+        if ((vt != NULL) && (vt->type != TOBYTYPE_UNKNOWN))
+        {
+            if (vt->type != TOBYTYPE_ARRAY)
+                failLine(P, line, "Variable is not an array");
+            else if (dims >= vt->dimensions)
+                failLine(P, line, "Too many array subscripts");
+        } /* if */
+        luaK_exp2anyreg(fs, v);
+        checkType(P, line, TOBYTYPE_NUMBER, expr(P, &key));
+        luaK_exp2val(fs, &key);
+        luaK_indexed(fs, v, &key);
+        checkNext(P, ']');
+        dims++;
+    } /* while */
+
+    if ((vt == NULL) || (vt->type != TOBYTYPE_ARRAY))
+        return (vt == NULL) ? TOBYTYPE_UNKNOWN : vt->type;
+    else if (dims == 0)
+        return TOBYTYPE_ARRAY;
+    else if (dims < vt->dimensions)
+        return TOBYTYPE_ARRAY;
+    return vt->elementType;
+} /* subscripts */
+
+
+/* a name: a variable, an array element, or a function call. */
+static TobyType primaryExpr(TobyParser *P, expdesc *v, int *isCall)
+{
+    TString *spelling = tokenSpelling(P);
+    TString *name = checkIdentifier(P);
+    const TobyVarType *vt = NULL;
+
+    *isCall = (P->token.type == '(');
+    if (*isCall)
+        return functionCall(P, name, spelling, v);
+
+    singleVar(P, name, v, &vt);
+    return subscripts(P, v, vt);
+} /* primaryExpr */
+
+
+static TobyType simpleExpr(TobyParser *P, expdesc *v)
+{
+    FuncState *fs = &P->tfs->fs;
+    TobyType retval;
+    int isCall = 0;
+
+    switch (P->token.type)
+    {
+        case TOKEN_NUMBER:
+            initExp(v, VKNUM, 0);
+            v->u.nval = P->token.num;
+            retval = TOBYTYPE_NUMBER;
+            break;
+
+        case TOKEN_STRING:
+            initExp(v, VK, luaK_stringK(fs, P->token.ts));
+            retval = TOBYTYPE_STRING;
+            break;
+
+        case TOKEN_TRUE:
+            initExp(v, VTRUE, 0);
+            retval = TOBYTYPE_BOOLEAN;
+            break;
+
+        case TOKEN_FALSE:
+            initExp(v, VFALSE, 0);
+            retval = TOBYTYPE_BOOLEAN;
+            break;
+
+        case '(':
+        {
+            const int line = P->token.line;
+            nextToken(P);
+            retval = expr(P, v);
+            if (P->token.type != ')')
+                failLine(P, P->token.line, "Expected ')' to match '(' on line %d", line);
+            nextToken(P);
+            luaK_dischargevars(fs, v);
+            return retval;
+        } /* case */
+
+        case TOKEN_IDENTIFIER:
+            retval = primaryExpr(P, v, &isCall);
+            if ((isCall) && (retval == TOBYTYPE_NOTHING))
+                fail(P, "Function doesn't return a value");
+            return retval;
+
+        default:
+            expected(P, "an expression");
+            return TOBYTYPE_UNKNOWN;  /* shouldn't hit this. */
+    } /* switch */
+
+    nextToken(P);
+    return retval;
+} /* simpleExpr */
+
+
+static UnOpr getUnaryOp(const int type)
+{
+    switch (type)
+    {
+        case TOKEN_NOT: return OPR_NOT;
+        case '-': return OPR_MINUS;
+    } /* switch */
+    return OPR_NOUNOPR;
+} /* getUnaryOp */
+
+
+static BinOpr getBinaryOp(const int type)
+{
+    switch (type)
+    {
+        case '+': return OPR_ADD;
+        case '-': return OPR_SUB;
+        case '*': return OPR_MUL;
+        case '/': return OPR_DIV;
+        case '%': return OPR_MOD;
+        case TOKEN_NE: return OPR_NE;
+        case TOKEN_EQ: return OPR_EQ;
+        case '<': return OPR_LT;
+        case TOKEN_LE: return OPR_LE;
+        case '>': return OPR_GT;
+        case TOKEN_GE: return OPR_GE;
+        case TOKEN_AND: return OPR_AND;
+        case TOKEN_OR: return OPR_OR;
+    } /* switch */
+    return OPR_NOBINOPR;
+} /* getBinaryOp */
+
+
+static const struct
+{
+    lu_byte left;  /* left priority for each binary operator */
+    lu_byte right;  /* right priority */
+} priority[] =  /* ORDER OPR */
+{
+    {6, 6}, {6, 6}, {7, 7}, {7, 7}, {7, 7},  /* `+' `-' `*' `/' `%' */
+    {10, 9}, {5, 4},  /* power and concat (not in Toby) */
+    {3, 3}, {3, 3},  /* equality and inequality */
+    {3, 3}, {3, 3}, {3, 3}, {3, 3},  /* order */
+    {2, 2}, {1, 1}  /* logical (and/or) */
+};
+
+#define UNARY_PRIORITY 8
+
+
+static TobyType binaryResultType(TobyParser *P, BinOpr op, TobyType t1,
+                                 TobyType t2, int line)
+{
+    switch (op)
+    {
+        case OPR_ADD: case OPR_SUB: case OPR_MUL: case OPR_DIV: case OPR_MOD:
+            checkType(P, line, TOBYTYPE_NUMBER, t1);
+            checkType(P, line, TOBYTYPE_NUMBER, t2);
+            return TOBYTYPE_NUMBER;
+
+        case OPR_AND: case OPR_OR:
+            checkType(P, line, TOBYTYPE_BOOLEAN, t1);
+            checkType(P, line, TOBYTYPE_BOOLEAN, t2);
+            return TOBYTYPE_BOOLEAN;
+
+        default:  /* comparisons. */
+            checkType(P, line, t1, t2);
+            return TOBYTYPE_BOOLEAN;
+    } /* switch */
+} /* binaryResultType */
+
+
+/*
+ * subexpr -> (simpleexp | unop subexpr) { binop subexpr }
+ *  where `binop' is any binary operator with a priority higher than `limit'
+ */
+static BinOpr subExpr(TobyParser *P, expdesc *v, unsigned int limit,
+                      TobyType *type)
+{
+    FuncState *fs = &P->tfs->fs;
+    BinOpr op;
+    UnOpr uop;
+
+    enterLevel(P);
+    uop = getUnaryOp(P->token.type);
+    if (uop == OPR_NOUNOPR)
+        *type = simpleExpr(P, v);
+    else
+    {
+        const int line = P->token.line;
+        const TobyType want = (uop == OPR_NOT) ? TOBYTYPE_BOOLEAN : TOBYTYPE_NUMBER;
+        nextToken(P);
+        subExpr(P, v, UNARY_PRIORITY, type);
+        checkType(P, line, want, *type);
+        *type = want;
+        luaK_prefix(fs, uop, v);
+    } /* else */
+
+    /* expand while operators have priorities higher than `limit' */
+    op = getBinaryOp(P->token.type);
+    while ((op != OPR_NOBINOPR) && (priority[op].left > limit))
+    {
+        const int line = P->token.line;
+        TobyType type2;
+        expdesc v2;
+        BinOpr nextop;
+        nextToken(P);
+        luaK_infix(fs, op, v);
+        /* read sub-expression with higher priority */
+        nextop = subExpr(P, &v2, priority[op].right, &type2);
+        luaK_posfix(fs, op, v, &v2);
+        *type = binaryResultType(P, op, *type, type2, line);
+        op = nextop;
+    } /* while */
+
+    leaveLevel(P);
+    return op;  /* return first untreated operator */
+} /* subExpr */
+
+
+static TobyType expr(TobyParser *P, expdesc *v)
+{
+    TobyType type = TOBYTYPE_UNKNOWN;
+    subExpr(P, v, 0, &type);
+    return type;
+} /* expr */
+
+
+/* Parse an expression into the next free register. */
+static TobyType exprToNextReg(TobyParser *P, TobyType want)
+{
+    const int line = P->token.line;
+    expdesc e;
+    const TobyType type = expr(P, &e);
+    checkType(P, line, want, type);
+    luaK_exp2nextreg(&P->tfs->fs, &e);
+    return type;
+} /* exprToNextReg */
+
+
+
+/* Statements... */
+
+static void block(TobyParser *P);
+
+
+static int blockFollows(const int type)
+{
+    switch (type)
+    {
+        case TOKEN_ELSE: case TOKEN_ELSEIF: case TOKEN_ENDIF:
+        case TOKEN_ENDWHILE: case TOKEN_ENDFOR: case TOKEN_ENDFUNCTION:
+        case TOKEN_EOI:
+            return 1;
+    } /* switch */
+    return 0;
+} /* blockFollows */
+
+
+static void checkMatch(TobyParser *P, int what, int who, int where)
+{
+    if (P->token.type != what)
+    {
+        if (where == P->token.line)
+            expected(P, tokenName(P, what));
+        else
+        {
+            failLine(P, P->token.line,
+                     "Expected %s (to close %s on line %d), found %s",
+                     tokenName(P, what), tokenName(P, who), where,
+                     tokenName(P, P->token.type));
+        } /* else */
+    } /* if */
+    nextToken(P);
+} /* checkMatch */
+
+
+static int condition(TobyParser *P)
+{
+    const int line = P->token.line;
+    expdesc v;
+    checkType(P, line, TOBYTYPE_BOOLEAN, expr(P, &v));
+    luaK_goiftrue(&P->tfs->fs, &v);
+    return v.f;
+} /* condition */
+
+
+static int testThenBlock(TobyParser *P)
+{
+    int condexit;
+    nextToken(P);  /* skip IF or ELSEIF */
+    condexit = condition(P);
+    block(P);  /* `then' part */
+    return condexit;
+} /* testThenBlock */
+
+
+static void ifStatement(TobyParser *P, int line)
+{
+    /* if cond block {elseif cond block} [else block] endif */
+    FuncState *fs = &P->tfs->fs;
+    int escapelist = NO_JUMP;
+    int flist = testThenBlock(P);
+
+    while (P->token.type == TOKEN_ELSEIF)
+    {
+        luaK_concat(fs, &escapelist, luaK_jump(fs));
+        luaK_patchtohere(fs, flist);
+        flist = testThenBlock(P);
+    } /* while */
+
+    if (P->token.type == TOKEN_ELSE)
+    {
+        luaK_concat(fs, &escapelist, luaK_jump(fs));
+        luaK_patchtohere(fs, flist);
+        nextToken(P);  /* skip ELSE (after patch, for correct line info) */
+        block(P);
+    } /* if */
+    else
+    {
+        luaK_concat(fs, &escapelist, flist);
+    } /* else */
+
+    luaK_patchtohere(fs, escapelist);
+    checkMatch(P, TOKEN_ENDIF, TOKEN_IF, line);
+} /* ifStatement */
+
+
+static void whileStatement(TobyParser *P, int line)
+{
+    /* while cond block endwhile */
+    FuncState *fs = &P->tfs->fs;
+    int whileinit, condexit;
+
+    nextToken(P);  /* skip WHILE */
+    whileinit = luaK_getlabel(fs);
+    condexit = condition(P);
+    block(P);
+    luaK_patchlist(fs, luaK_jump(fs), whileinit);
+    checkMatch(P, TOKEN_ENDWHILE, TOKEN_WHILE, line);
+    luaK_patchtohere(fs, condexit);  /* false conditions finish the loop */
+} /* whileStatement */
+
+
+/*
+ * for var = expr (to|downto) expr [step expr] block endfor
+ *
+ * This compiles to Lua's numeric for loop, so the VM does the counting. The
+ *  loop variable is a variable the program declared elsewhere, though, so
+ *  we copy the hidden loop counter into it at the top of each iteration.
+ */
+static void forStatement(TobyParser *P, int line)
+{
+    FuncState *fs = &P->tfs->fs;
+    const TobyVarType *vt = NULL;
+    TobyBlock bl;
+    TString *name;
+    int base, prep, endfor, downto;
+    expdesc var, counter;
+
+    nextToken(P);  /* skip FOR */
+    enterBlock(P, &bl);  /* scope for loop control variables. */
+
+    name = checkIdentifier(P);
+    checkType(P, line, TOBYTYPE_NUMBER, singleVar(P, name, &var, &vt));
+    if (P->token.type == '[')
+        fail(P, "Loop variable can't be an array element");
+
+    base = fs->freereg;
+    newHiddenVar(P, "(for index)", 0);
+    newHiddenVar(P, "(for limit)", 1);
+    newHiddenVar(P, "(for step)", 2);
+    newHiddenVar(P, "(for value)", 3);
+
+    checkNext(P, '=');
+    exprToNextReg(P, TOBYTYPE_NUMBER);  /* initial value. */
+    downto = (P->token.type == TOKEN_DOWNTO);
+    if ((!downto) && (P->token.type != TOKEN_TO))
+        expected(P, "'to' or 'downto'");
+    nextToken(P);
+    exprToNextReg(P, TOBYTYPE_NUMBER);  /* limit. */
+    if (testNext(P, TOKEN_STEP))
+        exprToNextReg(P, TOBYTYPE_NUMBER);
+    else
+    {
+        const lua_Number step = downto ? cast_num(-1) : cast_num(1);
+        luaK_codeABx(fs, OP_LOADK, fs->freereg, luaK_numberK(fs, step));
+        luaK_reserveregs(fs, 1);
+    } /* else */
+
+    adjustLocalVars(P, 4);
+    luaK_reserveregs(fs, 1);  /* the (for value) register. */
+    prep = luaK_codeAsBx(fs, OP_FORPREP, base, NO_JUMP);
+
+    /*
+     * Copying the counter out is the first thing the loop jumps back to, so
+     *  tag it with the body's first line; otherwise debuggers would see a
+     *  second visit to the "for" line each time around.
+     */
+    initExp(&counter, VNONRELOC, base+3);
+    luaK_storevar(fs, &var, &counter);
+    luaK_fixline(fs, P->token.line);
+    block(P);
+
+    luaK_patchtohere(fs, prep);
+    endfor = luaK_codeAsBx(fs, OP_FORLOOP, base, NO_JUMP);
+    luaK_fixline(fs, line);  /* pretend that `OP_FOR' starts the loop */
+    luaK_patchlist(fs, endfor, prep + 1);
+
+    checkMatch(P, TOKEN_ENDFOR, TOKEN_FOR, line);
+    leaveBlock(P);
+} /* forStatement */
+
+
+static void returnStatement(TobyParser *P)
+{
+    TobyFuncState *tfs = P->tfs;
+    FuncState *fs = &tfs->fs;
+    const int line = P->token.line;
+
+    nextToken(P);  /* skip RETURN */
+
+    if (tfs->returnType == TOBYTYPE_NOTHING)
+        luaK_ret(fs, 0, 0);
+    else
+    {
+        expdesc e;
+        checkType(P, line, tfs->returnType, expr(P, &e));
+        luaK_ret(fs, luaK_exp2anyreg(fs, &e), 1);
+    } /* else */
+} /* returnStatement */
+
+
+static void localStatement(TobyParser *P)
+{
+    FuncState *fs = &P->tfs->fs;
+    TobyVarType vtype;
+    TString *name, *spelling;
+
+    parseType(P, &vtype);
+    spelling = tokenSpelling(P);
+    name = checkIdentifier(P);
+
+    if (testNext(P, '='))
+    {
+        if (vtype.type == TOBYTYPE_ARRAY)
+            fail(P, "Arrays can't be assigned to");
+        exprToNextReg(P, vtype.type);
+    } /* if */
+    else
+    {
+        initialValue(P, &vtype);
+    } /* else */
+
+    /* the variable only comes into scope after its initializer. */
+    newLocalVar(P, name, spelling, &vtype, 0);
+    adjustLocalVars(P, 1);
+    lua_assert(fs->freereg == fs->nactvar);
+    (void) fs;
+} /* localStatement */
+
+
+static void exprStatement(TobyParser *P)
+{
+    FuncState *fs = &P->tfs->fs;
+    const int line = P->token.line;
+    int isCall = 0;
+    expdesc v;
+    TobyType type = primaryExpr(P, &v, &isCall);
+
+    if (isCall)
+    {
+        if (P->token.type == '=')
+            fail(P, "Can't assign to a function call");
+        if (v.k == VCALL)  /* builtins' result is just left there. */
+            SETARG_C(getcode(fs, &v), 1);  /* call statement uses no results */
+    } /* if */
+
+    else if (P->token.type != '=')
+    {
+        expected(P, "'=' or a function call");
+    } /* else if */
+
+    else
+    {
+        expdesc e;
+        nextToken(P);
+        if (type == TOBYTYPE_ARRAY)
+            failLine(P, line, "Arrays can't be assigned to");
+        checkType(P, line, type, expr(P, &e));
+        luaK_setoneret(fs, &e);
+        luaK_storevar(fs, &v, &e);
+    } /* else */
+} /* exprStatement */
+
+
+static void statement(TobyParser *P)
+{
+    const int line = P->token.line;
+    switch (P->token.type)
+    {
+        case TOKEN_IF: ifStatement(P, line); return;
+        case TOKEN_WHILE: whileStatement(P, line); return;
+        case TOKEN_FOR: forStatement(P, line); return;
+        case TOKEN_RETURN: returnStatement(P); return;
+        case TOKEN_IDENTIFIER: exprStatement(P); return;
+        case TOKEN_FUNCTION: fail(P, "Functions can't be defined inside other functions"); return;
+    } /* switch */
+
+    if (isTypeToken(P->token.type))
+        localStatement(P);
+    else
+        expected(P, "a statement");
+} /* statement */
+
+
+static void block(TobyParser *P)
+{
+    FuncState *fs = &P->tfs->fs;
+    TobyBlock bl;
+    enterBlock(P, &bl);
+    while (!blockFollows(P->token.type))
+    {
+        enterLevel(P);
+        statement(P);
+        lua_assert(fs->f->maxstacksize >= fs->freereg &&
+                   fs->freereg >= fs->nactvar);
+        fs->freereg = fs->nactvar;  /* free registers */
+        leaveLevel(P);
+    } /* while */
+    leaveBlock(P);
+} /* block */
+
+
+
+/* Top-level things... */
+
+static void pushClosure(TobyParser *P, Proto *func, expdesc *v)
+{
+    FuncState *fs = &P->tfs->fs;
+    Proto *f = fs->f;
+    int oldsize = f->sizep;
+    luaM_growvector(P->L, f->p, fs->np, f->sizep, Proto *,
+                    MAXARG_Bx, "constant table overflow");
+    while (oldsize < f->sizep)
+        f->p[oldsize++] = NULL;
+    f->p[fs->np++] = func;
+    luaC_objbarrier(P->L, f, func);
+    initExp(v, VRELOCABLE, luaK_codeABx(fs, OP_CLOSURE, 0, fs->np-1));
+} /* pushClosure */
+
+
+/*
+ * Parses "name([type name, ...]) returns (type|nothing)", after FUNCTION.
+ *  Returns the number of parameters.
+ */
+static int functionHeader(TobyParser *P, TString **name, TString **spelling,
+                          TobyVarType *vtype, TobyVarType *params,
+                          TString **paramNames, TString **paramSpellings)
+{
+    int paramCount = 0;
+    int i;
+
+    *spelling = tokenSpelling(P);
+    *name = checkIdentifier(P);
+
+    checkNext(P, '(');
+    if (P->token.type != ')')
+    {
+        do
+        {
+            if (paramCount >= LUAI_MAXVARS)
+                fail(P, "Too many parameters");
+            parseType(P, &params[paramCount]);
+            paramSpellings[paramCount] = tokenSpelling(P);
+            paramNames[paramCount] = checkIdentifier(P);
+            for (i = 0; i < paramCount; i++)
+            {
+                if (paramNames[i] == paramNames[paramCount])
+                    fail(P, "Two parameters have the same name");
+            } /* for */
+            paramCount++;
+        } while (testNext(P, ','));
+    } /* if */
+    checkNext(P, ')');
+
+    memset(vtype, '\0', sizeof (TobyVarType));
+    checkNext(P, TOKEN_RETURNS);
+    if (testNext(P, TOKEN_NOTHING))
+        vtype->type = TOBYTYPE_NOTHING;
+    else
+        vtype->type = parseBasicType(P);
+
+    return paramCount;
+} /* functionHeader */
+
+
+static TobySymbol *declareFunction(TobyParser *P, TString *name,
+                                   TString *spelling, const TobyVarType *vtype,
+                                   const TobyVarType *params, int paramCount)
+{
+    TobySymbol *sym = addSymbol(P, name, spelling, 1, vtype);
+    sym->params = luaM_newvector(P->L, paramCount, TobyVarType);
+    if (paramCount > 0)
+        memcpy(sym->params, params, sizeof (TobyVarType) * paramCount);
+    sym->paramCount = paramCount;
+    return sym;
+} /* declareFunction */
+
+
+static void declareFunctionsProtected(lua_State *L, void *ud)
+{
+    TobyParser *P = (TobyParser *) ud;
+    TobyVarType vtype;
+    TobyVarType params[LUAI_MAXVARS];
+    TString *paramNames[LUAI_MAXVARS];
+    TString *paramSpellings[LUAI_MAXVARS];
+    TString *name, *spelling;
+    int paramCount;
+
+    P->line = 1;
+    P->token.line = 1;
+    nextToken(P);  /* read first token. */
+
+    while (P->token.type != TOKEN_EOI)
+    {
+        if (!testNext(P, TOKEN_FUNCTION))
+            nextToken(P);
+        else
+        {
+            paramCount = functionHeader(P, &name, &spelling, &vtype, params,
+                                        paramNames, paramSpellings);
+            declareFunction(P, name, spelling, &vtype, params,
+                            paramCount)->predeclared = 1;
+        } /* else */
+    } /* while */
+} /* declareFunctionsProtected */
+
+
+/*
+ * Skim the whole program for function signatures before compiling it, so
+ *  calls to functions defined further down get checked too. If this hits
+ *  a syntax error, we stop declaring things and let the real pass report
+ *  it, so errors still come out in the order they appear in the program.
+ */
+static void declareFunctions(TobyParser *P)
+{
+    lua_State *L = P->L;
+    const ptrdiff_t top = savestack(L, L->top);
+    const char *start = P->ptr;
+    const int status = luaD_pcall(L, declareFunctionsProtected, P, top,
+                                  L->errfunc);
+
+    if (status == LUA_ERRMEM)
+        luaD_throw(L, status);
+
+    L->top = restorestack(L, top);  /* drop any error message. */
+    P->ptr = start;
+} /* declareFunctions */
+
+
+/*
+ * function name([type name, ...]) returns (type|nothing)
+ *     statements
+ * endfunction
+ */
+static void functionDefinition(TobyParser *P)
+{
+    TobyFuncState *parent = P->tfs;
+    TobyFuncState tfs;
+    const int line = P->token.line;
+    TString *name, *spelling;
+    TobySymbol *sym;
+    TobyVarType vtype;
+    TobyVarType params[LUAI_MAXVARS];
+    TString *paramNames[LUAI_MAXVARS];
+    TString *paramSpellings[LUAI_MAXVARS];
+    int paramCount;
+    expdesc var, closure;
+    int i;
+
+    nextToken(P);  /* skip FUNCTION */
+    paramCount = functionHeader(P, &name, &spelling, &vtype, params,
+                                paramNames, paramSpellings);
+
+    /* Add this before compiling the body, so recursion can check types. */
+    sym = findSymbol(P, name);
+    if ((sym != NULL) && (sym->predeclared))
+        sym->predeclared = 0;
+    else
+        sym = declareFunction(P, name, spelling, &vtype, params, paramCount);
+
+    openFunction(P, &tfs);
+    tfs.returnType = vtype.type;
+    tfs.fs.f->linedefined = line;
+    tfs.fs.f->numparams = cast_byte(paramCount);
+    for (i = 0; i < paramCount; i++)
+        newLocalVar(P, paramNames[i], paramSpellings[i], &params[i], i);
+    adjustLocalVars(P, paramCount);
+    luaK_reserveregs(&tfs.fs, paramCount);
+
+    block(P);
+
+    /* Falling off the end of a function returns a default value. */
+    if (vtype.type != TOBYTYPE_NOTHING)
+    {
+        expdesc e;
+        defaultValue(P, vtype.type, &e);
+        luaK_ret(&tfs.fs, luaK_exp2anyreg(&tfs.fs, &e), 1);
+    } /* if */
+
+    tfs.fs.f->lastlinedefined = P->token.line;
+    checkMatch(P, TOKEN_ENDFUNCTION, TOKEN_FUNCTION, line);
+
+    closeFunction(P, parent);
+    pushClosure(P, tfs.fs.f, &closure);
+
+    initExp(&var, VGLOBAL, NO_REG);
+    var.u.s.info = luaK_stringK(&parent->fs, name);
+    luaK_storevar(&parent->fs, &var, &closure);
+} /* functionDefinition */
+
+
+/* A global variable declaration, outside of any function. */
+static void globalDeclaration(TobyParser *P)
+{
+    FuncState *fs = &P->tfs->fs;
+    TobyVarType vtype;
+    TString *name, *spelling;
+    expdesc var, e;
+
+    parseType(P, &vtype);
+    spelling = tokenSpelling(P);
+    name = checkIdentifier(P);
+
+    if (!testNext(P, '='))
+        initialValue(P, &vtype);
+    else
+    {
+        if (vtype.type == TOBYTYPE_ARRAY)
+            fail(P, "Arrays can't be assigned to");
+        exprToNextReg(P, vtype.type);
+    } /* else */
+
+    addSymbol(P, name, spelling, 0, &vtype);
+
+    initExp(&e, VNONRELOC, fs->freereg - 1);
+    initExp(&var, VGLOBAL, NO_REG);
+    var.u.s.info = luaK_stringK(fs, name);
+    luaK_storevar(fs, &var, &e);
+    fs->freereg = fs->nactvar;
+} /* globalDeclaration */
+
+
+static Proto *compileProgram(TobyParser *P)
+{
+    FuncState *fs;
+    TobyFuncState tfs;
+    TobySymbol *sym;
+    TString *mainName;
+    expdesc e;
+
+    openFunction(P, &tfs);
+    fs = &tfs.fs;
+    mainName = luaS_newliteral(P->L, "main");
+    luaK_stringK(fs, mainName);  /* anchor it. */
+
+    declareFunctions(P);
+
+    P->line = 1;
+    P->token.line = 1;
+    nextToken(P);  /* read first token. */
+
+    while (P->token.type != TOKEN_EOI)
+    {
+        if (P->token.type == TOKEN_FUNCTION)
+            functionDefinition(P);
+        else if (isTypeToken(P->token.type))
+            globalDeclaration(P);
+        else
+            expected(P, "a function or global variable");
+    } /* while */
+
+    sym = findSymbol(P, mainName);
+    if ((sym == NULL) || (!sym->isFunction))
+        failLine(P, P->line, "Program has no main() function");
+    else if (sym->paramCount != 0)
+        failLine(P, P->line, "main() can't have parameters");
+
+    /* the chunk ends by calling main(). */
+    initExp(&e, VGLOBAL, NO_REG);
+    e.u.s.info = luaK_stringK(fs, mainName);
+    luaK_exp2nextreg(fs, &e);
+    luaK_codeABC(fs, OP_CALL, e.u.s.info, 1, 1);
+
+    closeFunction(P, NULL);
+    return tfs.fs.f;
+} /* compileProgram */
+
+
+static void compileProtected(lua_State *L, void *ud)
+{
+    TobyParser *P = (TobyParser *) ud;
+    Closure *cl;
+    Proto *f;
+
+    luaC_checkGC(L);
+    f = compileProgram(P);
+    cl = luaF_newLclosure(L, 0, hvalue(gt(L)));
+    cl->l.p = f;
+    setclvalue(L, L->top, cl);
+    incr_top(L);
+} /* compileProtected */
+
+
+void TOBY_setBuiltins(lua_State *L, const lua_CFunction *funcs,
+                      const TobyFastPath *fast, int fastCount)
+{
+    lua_Builtin *info;
+    int i;
+
+    lua_createtable(L, BUILTIN_COUNT, 0);
+    for (i = 0; i < BUILTIN_COUNT; i++)
+    {
+        lua_pushcfunction(L, funcs[i]);
+        lua_rawseti(L, -2, i + 1);
+    } /* for */
+
+    info = (lua_Builtin *) lua_newuserdata(L, sizeof (lua_Builtin) *
+                                              BUILTIN_COUNT);
+    memset(info, '\0', sizeof (lua_Builtin) * BUILTIN_COUNT);
+    for (i = 0; i < BUILTIN_COUNT; i++)
+        info[i].name = builtinNames[i];
+
+    for (i = 0; i < fastCount; i++)
+    {
+        const int builtin = findBuiltin(fast[i].name);
+        lua_assert(builtin >= 0);
+        lua_assert(fast[i].nargs <= LUA_MAXFASTARGS);
+        if ((builtin >= 0) && (fast[i].nargs <= LUA_MAXFASTARGS))
+        {
+            info[builtin].fast = fast[i].fast;
+            info[builtin].nargs = fast[i].nargs;
+        } /* if */
+    } /* for */
+
+    G(L)->builtins = hvalue(L->top - 2);
+    G(L)->builtininfo = info;
+    G(L)->nbuiltins = BUILTIN_COUNT;
+    lua_setfield(L, LUA_REGISTRYINDEX, builtinInfoRegistryKey);
+    lua_setfield(L, LUA_REGISTRYINDEX, builtinsRegistryKey);
+} /* TOBY_setBuiltins */
+
+
+int TOBY_compile(lua_State *L, const char *source, const char *chunkname)
+{
+    TobyParser P;
+    int status;
+
+    memset(&P, '\0', sizeof (P));
+    P.L = L;
+    P.ptr = source;
+
+    /* skip UTF-8 byte order mark, if there is one. */
+    if (strncmp(source, "\xEF\xBB\xBF", 3) == 0)
+        P.ptr += 3;
+
+    /* the bits of LexState that lcode.c and friends look at. */
+    P.ls.L = L;
+    P.ls.buff = &P.buff;
+    P.ls.t.token = 0;  /* so Lua's own syntax errors don't report a token. */
+    P.ls.linenumber = P.ls.lastline = 1;
+    P.ls.decpoint = '.';
+
+    luaZ_initbuffer(L, &P.buff);
+    P.ls.source = luaS_new(L, chunkname);
+    setsvalue2s(L, L->top, P.ls.source);  /* anchor it while we work. */
+    incr_top(L);
+
+    status = luaD_pcall(L, compileProtected, &P, savestack(L, L->top),
+                        L->errfunc);
+
+    /* move the new function (or error message) down over the anchor. */
+    setobjs2s(L, L->top - 2, L->top - 1);
+    L->top--;
+
+    luaZ_freebuffer(L, &P.buff);
+    freeSymbols(&P);
+    return status;
+} /* TOBY_compile */
+
+/* end of toby_compiler.c ... */
+
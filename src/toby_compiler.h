@@ -0,0 +1,144 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+#ifndef _INCL_TOBY_COMPILER_H_
+#define _INCL_TOBY_COMPILER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lua.h"
+
+/*
+ * The types a Toby program can declare. The compiler keeps these on every
+ *  variable, parameter and function it sees, so it can fill in default
+ *  values, catch obvious mismatches at compile time, and so later passes
+ *  over the program have something better than "it's a Lua value" to
+ *  work with.
+ */
+typedef enum TobyType
+{
+    TOBYTYPE_UNKNOWN=0,  /* not declared anywhere we've seen yet. */
+    TOBYTYPE_NOTHING,    /* only valid as a function's return type. */
+    TOBYTYPE_NUMBER,
+    TOBYTYPE_BOOLEAN,
+    TOBYTYPE_STRING,
+    TOBYTYPE_ARRAY,
+} TobyType;
+
+#define TOBY_MAX_ARRAY_DIMENSIONS 8
+
+typedef struct TobyVarType
+{
+    TobyType type;
+    TobyType elementType;  /* only valid if (type == TOBYTYPE_ARRAY). */
+    int dimensions;  /* only valid if (type == TOBYTYPE_ARRAY). */
+    int lower[TOBY_MAX_ARRAY_DIMENSIONS];
+    int upper[TOBY_MAX_ARRAY_DIMENSIONS];
+} TobyVarType;
+
+
+/*
+ * Every builtin function, in the order the VM numbers them. Calls to these
+ *  compile to OP_CALLBUILTIN, which calls the function by that number
+ *  instead of looking its name up in the globals, so programs can't use
+ *  these names for anything else. Compiled programs (and the bytecode
+ *  cache) have the numbers baked in, so only ever add to the end.
+ *  Expand with TOBY_BUILTINS(X), where X(sym) is called for each one.
+ */
+#define TOBY_BUILTINS(X) \
+    X(showturtle) X(hideturtle) X(hometurtle) X(enablefence) \
+    X(disablefence) X(drawstring) X(random) X(getturtlespacewidth) \
+    X(getturtlespaceheight) X(getturtlex) X(getturtley) \
+    X(cleanupturtlespace) X(setpencolorrgb) X(setpenup) X(setpendown) \
+    X(addturtle) X(useturtle) X(round) X(stringlength) X(rightstring) \
+    X(leftstring) X(substring) X(uppercasestring) X(lowercasestring) \
+    X(joinstrings) X(pause) X(setangle) X(goforward) X(gobackward) \
+    X(turnright) X(turnleft) X(drawarc) X(drawcircle) X(drawpolygon) \
+    X(fillrect) X(startpolygon) X(fillpolygon) X(floodfill) X(plot) \
+    X(plotrow) X(colorrgb) X(goforwardall) X(gobackwardall) \
+    X(turnrightall) X(turnleftall) X(setangleall) X(setpencolor) \
+    X(setturtlexy) X(print)
+
+/*
+ * A builtin's fast path. When a call passes it exactly (nargs) numbers, the
+ *  VM calls this instead of the builtin's lua_CFunction, with the numbers
+ *  in (args), and without a call frame or anything on the Lua stack, so it
+ *  mustn't use the stack (or lua_getstack() its caller) except to throw an
+ *  error. Set (*ret) and return 1 to return a number, or return 0.
+ */
+typedef int (*TobyFastBuiltin)(lua_State *L, const lua_Number *args,
+                               lua_Number *ret);
+
+#define TOBY_MAX_FAST_ARGS 4
+
+typedef struct TobyFastPath
+{
+    const char *name;  /* as in TOBY_BUILTINS. */
+    TobyFastBuiltin fast;
+    int nargs;  /* at most TOBY_MAX_FAST_ARGS. */
+} TobyFastPath;
+
+/*
+ * Hand (L) the functions behind the builtins, one per TOBY_BUILTINS entry
+ *  and in that order, and the fast paths for (fastCount) of them, in any
+ *  order. Call this once, right after creating (L).
+ */
+void TOBY_setBuiltins(lua_State *L, const lua_CFunction *funcs,
+                      const TobyFastPath *fast, int fastCount);
+
+
+/*
+ * Compile Toby source code straight to a Lua function, without ever
+ *  producing Lua source text. This works like luaL_loadbuffer(): on success,
+ *  the compiled chunk is pushed onto (L)'s stack and zero is returned. On
+ *  failure, an error message is pushed instead, and LUA_ERRSYNTAX or
+ *  LUA_ERRMEM is returned.
+ *
+ * Running the chunk defines the program's functions and global variables,
+ *  then calls its main() function.
+ *
+ * (chunkname) follows Lua's rules: prefix it with '=' to have it show up
+ *  in error messages as-is.
+ */
+int TOBY_compile(lua_State *L, const char *source, const char *chunkname);
+
+
+/*
+ * Same as TOBY_compile(), but checks the bytecode cache first (see
+ *  TOBY_setBytecodeCacheDir()). On a hit, the source isn't parsed at all.
+ *  On a miss, the freshly compiled chunk is written to the cache.
+ */
+int TOBY_compileCached(lua_State *L, const char *source, const char *chunkname);
+
+
+/*
+ * Breakpoint traps. TOBY_attachTraps() takes the compiled program at stack
+ *  index (idx), and makes (callback) run whenever the program reaches a
+ *  trapped line. TOBY_setLineTraps() patches a trap over the first
+ *  instruction of each stretch of code on (line), returning how many it
+ *  placed or -1 if out of memory. The clear functions put the original
+ *  instructions back. Call TOBY_detachTraps() before closing (L).
+ *  All of these must be called from the thread running the program.
+ */
+typedef void (*TobyTrapCallback)(lua_State *L, int line);
+int TOBY_attachTraps(lua_State *L, int idx, TobyTrapCallback callback);
+void TOBY_detachTraps(lua_State *L);
+int TOBY_setLineTraps(lua_State *L, int line);
+void TOBY_clearLineTraps(lua_State *L, int line);
+void TOBY_clearAllTraps(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of toby_compiler.h ... */
+
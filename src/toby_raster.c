@@ -0,0 +1,750 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "toby_raster.h"
+
+/*
+ * Span writers: set (count) pixels, starting at (p), to (pval). Lines and
+ *  fills spend most of their time in here, so there's one for each x86
+ *  vector unit, and the best one the CPU has gets picked the first time
+ *  through. Build with TOBY_SIMD_SPANS set to zero to only use plain C.
+ */
+#ifndef TOBY_SIMD_SPANS
+#define TOBY_SIMD_SPANS 1
+#endif
+
+#if TOBY_SIMD_SPANS && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#define SUPPORT_SSE2_SPANS 1
+#include <emmintrin.h>
+#endif
+
+/* AVX2 needs a runtime check, and a compiler that can target one function. */
+#if SUPPORT_SSE2_SPANS && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SUPPORT_AVX2_SPANS 1
+#include <immintrin.h>
+#endif
+
+
+TobyRaster *TOBY_createRaster(int size)
+{
+    TobyRaster *retval = (TobyRaster *) malloc(sizeof (TobyRaster));
+    if (retval != NULL)
+    {
+        retval->size = size;
+        retval->pixelsWritten = 0;
+        retval->pixels = (unsigned int *)
+                            calloc((size_t) size * size, sizeof (unsigned int));
+        if (retval->pixels == NULL)
+        {
+            free(retval);
+            retval = NULL;
+        } /* if */
+    } /* if */
+    return retval;
+} /* TOBY_createRaster */
+
+
+void TOBY_destroyRaster(TobyRaster *raster)
+{
+    if (raster != NULL)
+    {
+        free(raster->pixels);
+        free(raster);
+    } /* if */
+} /* TOBY_destroyRaster */
+
+
+static inline unsigned int mapRGB(int r, int g, int b)
+{
+    return (((unsigned int) r) << 16) | (((unsigned int) g) << 8) |
+           ((unsigned int) b);
+} /* mapRGB */
+
+
+static inline void scaleXY(const TobyRaster *raster,
+                           lua_Number *x, lua_Number *y)
+{
+    *x = raster->size * (*x / N(1000));
+    *y = raster->size * (*y / N(1000));
+} /* scaleXY */
+
+
+/* Spans shorter than this are written inline, skipping the dispatch. */
+#define SHORT_SPAN 8
+
+typedef void (*SpanWriterFn)(unsigned int *p, int count, unsigned int pval);
+
+static void writeSpanScalar(unsigned int *p, int count, unsigned int pval)
+{
+    while (count-- > 0)
+        *(p++) = pval;
+} /* writeSpanScalar */
+
+
+#if SUPPORT_SSE2_SPANS
+static void writeSpanSSE2(unsigned int *p, int count, unsigned int pval)
+{
+    const __m128i vec = _mm_set1_epi32((int) pval);
+    for (; count >= 4; count -= 4, p += 4)
+        _mm_storeu_si128((__m128i *) p, vec);
+    while (count-- > 0)
+        *(p++) = pval;
+} /* writeSpanSSE2 */
+#endif
+
+
+#if SUPPORT_AVX2_SPANS
+__attribute__((target("avx2")))
+static void writeSpanAVX2(unsigned int *p, int count, unsigned int pval)
+{
+    const __m256i vec = _mm256_set1_epi32((int) pval);
+    for (; count >= 8; count -= 8, p += 8)
+        _mm256_storeu_si256((__m256i *) p, vec);
+    while (count-- > 0)
+        *(p++) = pval;
+} /* writeSpanAVX2 */
+#endif
+
+
+static void writeSpanFirst(unsigned int *p, int count, unsigned int pval);
+
+/*
+ * Every thread picks the same writer, so racing to set this is harmless.
+ *  It starts out pointing at the function that does the picking.
+ */
+static SpanWriterFn writeSpan = writeSpanFirst;
+static TobySpanWriter spanWriter = TOBY_SPANWRITER_SCALAR;
+
+int TOBY_spanWriterAvailable(TobySpanWriter writer)
+{
+    switch (writer)
+    {
+        case TOBY_SPANWRITER_SCALAR:
+            return 1;
+        #if SUPPORT_SSE2_SPANS
+        case TOBY_SPANWRITER_SSE2:
+            return 1;  /* we were built for a CPU that always has it. */
+        #endif
+        #if SUPPORT_AVX2_SPANS
+        case TOBY_SPANWRITER_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        #endif
+        default:
+            break;
+    } /* switch */
+    return 0;
+} /* TOBY_spanWriterAvailable */
+
+
+int TOBY_setSpanWriter(TobySpanWriter writer)
+{
+    SpanWriterFn fn = writeSpanScalar;
+
+    if (!TOBY_spanWriterAvailable(writer))
+        return 0;
+
+    #if SUPPORT_SSE2_SPANS
+    if (writer == TOBY_SPANWRITER_SSE2)
+        fn = writeSpanSSE2;
+    #endif
+    #if SUPPORT_AVX2_SPANS
+    if (writer == TOBY_SPANWRITER_AVX2)
+        fn = writeSpanAVX2;
+    #endif
+
+    spanWriter = writer;
+    writeSpan = fn;
+    return 1;
+} /* TOBY_setSpanWriter */
+
+
+static void pickSpanWriter(void)
+{
+    if (!TOBY_setSpanWriter(TOBY_SPANWRITER_AVX2))
+    {
+        if (!TOBY_setSpanWriter(TOBY_SPANWRITER_SSE2))
+            TOBY_setSpanWriter(TOBY_SPANWRITER_SCALAR);
+    } /* if */
+} /* pickSpanWriter */
+
+
+TobySpanWriter TOBY_getSpanWriter(void)
+{
+    if (writeSpan == writeSpanFirst)
+        pickSpanWriter();
+    return spanWriter;
+} /* TOBY_getSpanWriter */
+
+
+static void writeSpanFirst(unsigned int *p, int count, unsigned int pval)
+{
+    pickSpanWriter();
+    writeSpan(p, count, pval);
+} /* writeSpanFirst */
+
+
+/* A polygon edge, top to bottom, for the scanline filler. */
+typedef struct SpanEdge
+{
+    lua_Number y1;
+    lua_Number y2;
+    lua_Number x1;
+    lua_Number slope;  /* x change per row. */
+} SpanEdge;
+
+typedef struct SpanSeed { int x; int y; } SpanSeed;
+
+static int cmpSpanEdge(const void *_a, const void *_b)
+{
+    const lua_Number a = ((const SpanEdge *) _a)->y1;
+    const lua_Number b = ((const SpanEdge *) _b)->y1;
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+} /* cmpSpanEdge */
+
+
+/*
+ * Fill in (edges) for the polygon's non-flat sides, sorted by their tops,
+ *  and the rows (of (h)) it covers. Returns how many edges there are.
+ */
+static int buildSpanEdges(const TurtlePoint *pts, int count, SpanEdge *edges,
+                          int h, int *ystart, int *yend)
+{
+    lua_Number miny = pts[0].y;
+    lua_Number maxy = pts[0].y;
+    int total = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const TurtlePoint *a = &pts[i];
+        const TurtlePoint *b = &pts[(i + 1) % count];
+        SpanEdge *edge = &edges[total];
+        if (a->y < miny) miny = a->y;
+        if (a->y > maxy) maxy = a->y;
+        if (a->y == b->y)
+            continue;  /* flat edges never cross a row's middle. */
+        else if (a->y > b->y)
+        {
+            const TurtlePoint *tmp = a;
+            a = b;
+            b = tmp;
+        } /* else if */
+        edge->y1 = a->y;
+        edge->y2 = b->y;
+        edge->x1 = a->x;
+        edge->slope = (b->x - a->x) / (b->y - a->y);
+        total++;
+    } /* for */
+
+    qsort(edges, total, sizeof (SpanEdge), cmpSpanEdge);
+
+    /* negated compares, so NaN clamps instead of reaching the int casts. */
+    if (!(miny >= N(0)))
+        *ystart = 0;
+    else
+        *ystart = (miny >= (lua_Number) h) ? h : (int) miny;
+
+    if (!(maxy < (lua_Number) h))
+        *yend = h - 1;
+    else
+        *yend = (maxy <= N(-1)) ? -1 : (int) maxy;
+    return total;
+} /* buildSpanEdges */
+
+
+/* 24-bit pixels are three bytes in the machine's byte order, as SDL does. */
+static inline int isBigEndian(void)
+{
+    const unsigned int one = 1;
+    return (*((const unsigned char *) &one) == 0);
+} /* isBigEndian */
+
+
+static inline unsigned int get24(const unsigned char *p)
+{
+    if (isBigEndian())
+        return (((unsigned int) p[0]) << 16) | (((unsigned int) p[1]) << 8) |
+               ((unsigned int) p[2]);
+    return (((unsigned int) p[2]) << 16) | (((unsigned int) p[1]) << 8) |
+           ((unsigned int) p[0]);
+} /* get24 */
+
+
+static inline void put24(unsigned char *p, unsigned int pval)
+{
+    if (isBigEndian())
+    {
+        p[0] = (unsigned char) (pval >> 16);
+        p[1] = (unsigned char) (pval >> 8);
+        p[2] = (unsigned char) pval;
+    } /* if */
+    else
+    {
+        p[0] = (unsigned char) pval;
+        p[1] = (unsigned char) (pval >> 8);
+        p[2] = (unsigned char) (pval >> 16);
+    } /* else */
+} /* put24 */
+
+
+/* Now stamp out the span functions for each size of pixel. */
+#define SPAN_BPP 1
+#define SPANFN(fn) fn##8
+#include "toby_spans.h"
+
+#define SPAN_BPP 2
+#define SPANFN(fn) fn##16
+#include "toby_spans.h"
+
+#define SPAN_BPP 3
+#define SPANFN(fn) fn##24
+#include "toby_spans.h"
+
+#define SPAN_BPP 4
+#define SPANFN(fn) fn##32
+#include "toby_spans.h"
+
+
+const TobySpanFuncs *TOBY_getSpanFuncs(int bpp)
+{
+    switch (bpp)
+    {
+        case 1: return &spanFuncs8;
+        case 2: return &spanFuncs16;
+        case 3: return &spanFuncs24;
+        case 4: return &spanFuncs32;
+    } /* switch */
+    return NULL;
+} /* TOBY_getSpanFuncs */
+
+
+/* The canvas is just a span target with 32-bit pixels. */
+static inline void rasterTarget(const TobyRaster *raster, TobySpanTarget *t)
+{
+    t->pixels = raster->pixels;
+    t->w = t->h = raster->size;
+    t->pitch = raster->size * (int) sizeof (unsigned int);
+    t->bpp = 4;
+} /* rasterTarget */
+
+
+void TOBY_rasterClear(TobyRaster *raster, int r, int g, int b)
+{
+    const unsigned int pval = mapRGB(r, g, b);
+    const int size = raster->size;
+    unsigned int *p = raster->pixels;
+    int y;
+
+    raster->pixelsWritten += (unsigned long) size * size;
+    for (y = 0; y < size; y++, p += size)
+        putSpan32((unsigned char *) p, size, pval);
+} /* TOBY_rasterClear */
+
+
+/* Clipping can leave a hair below zero; the int cast truncates that to 0. */
+static inline int onCanvas(const TobyRaster *raster, lua_Number v)
+{
+    return ((v > N(-1)) && (v < (lua_Number) raster->size));  /* NaN fails. */
+} /* onCanvas */
+
+
+/* Endpoints should be clipped already; anything else is dropped. */
+static void drawLine(TobyRaster *raster, lua_Number x1, lua_Number y1,
+                     lua_Number x2, lua_Number y2, const unsigned int pval)
+{
+    TobySpanTarget target;
+    rasterTarget(raster, &target);
+    scaleXY(raster, &x1, &y1);
+    scaleXY(raster, &x2, &y2);
+    if ( (!onCanvas(raster, x1)) || (!onCanvas(raster, y1)) ||
+         (!onCanvas(raster, x2)) || (!onCanvas(raster, y2)) )
+        return;
+    raster->pixelsWritten += drawLine32(&target, (int) x1, (int) y1,
+                                        (int) x2, (int) y2, pval);
+} /* drawLine */
+
+
+void TOBY_rasterDrawLines(TobyRaster *raster, const TobyLineSegment *segs,
+                          int count)
+{
+    const TobyLineSegment *end = segs + count;
+    TurtleRGB color = { -1, -1, -1 };
+    unsigned int pval = 0;
+
+    for (; segs != end; segs++)
+    {
+        const TurtleRGB *c = &segs->color;
+        if ((c->r != color.r) || (c->g != color.g) || (c->b != color.b))
+        {
+            color = *c;
+            pval = mapRGB(color.r, color.g, color.b);
+        } /* if */
+        drawLine(raster, segs->x1, segs->y1, segs->x2, segs->y2, pval);
+    } /* for */
+} /* TOBY_rasterDrawLines */
+
+
+/*
+ * Where the TurtleSpace unit holding (v) starts on an axis of (size) pixels,
+ *  and how many pixels it covers, so neighbouring units meet without gaps.
+ *  (v) is in TurtleSpace, so it's never negative.
+ */
+static inline void pointCell(int size, lua_Number v, int *start, int *len)
+{
+    const lua_Number scale = ((lua_Number) size) / N(1000);
+    const int end = (int) (((lua_Number) (((int) v) + 1)) * scale);
+    *start = (int) (v * scale);
+    if (*start >= size)  /* rounding right at the edge. */
+        *start = size - 1;
+    *len = (end > *start) ? (end - *start) : 1;
+} /* pointCell */
+
+
+void TOBY_rasterDrawPoints(TobyRaster *raster, const TobyPoint *pts,
+                           int count)
+{
+    const TobyPoint *end = pts + count;
+    const int size = raster->size;
+    TobySpanTarget target;
+
+    rasterTarget(raster, &target);
+
+    /* points are always inside TurtleSpace, so they're always on the canvas. */
+    for (; pts != end; pts++)
+    {
+        const TurtleRGB *c = &pts->color;
+        int x, y, w, h;
+        pointCell(size, pts->x, &x, &w);
+        pointCell(size, pts->y, &y, &h);
+        raster->pixelsWritten += fillRect32(&target, x, y, w, h,
+                                            mapRGB(c->r, c->g, c->b));
+    } /* for */
+} /* TOBY_rasterDrawPoints */
+
+
+/* Scanline fill of a triangle in canvas coordinates, clipped to the canvas. */
+static void fillTriangle(TobyRaster *raster, const TurtlePoint *pts,
+                         const unsigned int pval)
+{
+    const int size = raster->size;
+    lua_Number miny = pts[0].y;
+    lua_Number maxy = pts[0].y;
+    int y, ystart, yend;
+    int i;
+
+    for (i = 1; i < 3; i++)
+    {
+        if (pts[i].y < miny) miny = pts[i].y;
+        if (pts[i].y > maxy) maxy = pts[i].y;
+    } /* for */
+
+    /* negated compares, so a NaN turtle clamps instead of reaching casts. */
+    if (!(miny >= N(0)))
+        ystart = 0;
+    else
+        ystart = (miny >= (lua_Number) size) ? size : (int) miny;
+
+    if (!(maxy < (lua_Number) size))
+        yend = size - 1;
+    else
+        yend = (maxy <= N(-1)) ? -1 : (int) maxy;
+
+    for (y = ystart; y <= yend; y++)
+    {
+        const lua_Number cy = ((lua_Number) y) + ((lua_Number) 0.5);
+        lua_Number minx = (lua_Number) size;
+        lua_Number maxx = N(-1);
+        int xstart, xend;
+
+        for (i = 0; i < 3; i++)
+        {
+            const TurtlePoint *a = &pts[i];
+            const TurtlePoint *b = &pts[(i + 1) % 3];
+            if ((a->y <= cy) != (b->y <= cy))  /* edge crosses this row. */
+            {
+                const lua_Number t = (cy - a->y) / (b->y - a->y);
+                const lua_Number ex = a->x + ((b->x - a->x) * t);
+                if (ex < minx) minx = ex;
+                if (ex > maxx) maxx = ex;
+            } /* if */
+        } /* for */
+
+        if ((maxx < minx) || (maxx <= N(-1)) || (minx >= (lua_Number) size))
+            continue;  /* row misses the triangle, or the canvas. */
+
+        xstart = (minx < N(0)) ? 0 : (int) minx;
+        xend = (maxx >= (lua_Number) size) ? size - 1 : (int) maxx;
+        if (xend >= xstart)
+        {
+            raster->pixelsWritten += (xend - xstart) + 1;
+            unsigned int *p = raster->pixels + ((y * size) + xstart);
+            putSpan32((unsigned char *) p, (xend - xstart) + 1, pval);
+        } /* if */
+    } /* for */
+} /* fillTriangle */
+
+
+void TOBY_rasterDrawTurtle(TobyRaster *raster, const Turtle *turtle)
+{
+    const lua_Number tx = turtle->pos.x;
+    const lua_Number ty = turtle->pos.y;
+    lua_Number x1, y1, x2, y2;
+    TurtlePoint tpts[3];
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        tpts[i].x = turtle->points[i].x + tx;
+        tpts[i].y = turtle->points[i].y + ty;
+        scaleXY(raster, &tpts[i].x, &tpts[i].y);
+    } /* for */
+
+    fillTriangle(raster, tpts, mapRGB(0, 255, 0));  /* full green. */
+
+    x1 = turtle->points[0].x + tx;
+    y1 = turtle->points[0].y + ty;
+    x2 = turtle->points[3].x + tx;
+    y2 = turtle->points[3].y + ty;
+    if (TOBY_clipLine(&x1, &y1, &x2, &y2, N(999), N(999)))
+        drawLine(raster, x1, y1, x2, y2, mapRGB(0, 0, 255));  /* full blue. */
+} /* TOBY_rasterDrawTurtle */
+
+
+void TOBY_rasterFillPolygon(TobyRaster *raster, const TurtlePoint *pts,
+                            int count, int r, int g, int b)
+{
+    TobySpanTarget target;
+    TurtlePoint *scaled;
+    int i;
+
+    scaled = (TurtlePoint *) malloc(sizeof (TurtlePoint) * count);
+    if (scaled == NULL)
+        return;
+
+    for (i = 0; i < count; i++)
+    {
+        scaled[i] = pts[i];
+        scaleXY(raster, &scaled[i].x, &scaled[i].y);
+    } /* for */
+
+    rasterTarget(raster, &target);
+    raster->pixelsWritten += fillPolygon32(&target, scaled, count,
+                                           mapRGB(r, g, b));
+    free(scaled);
+} /* TOBY_rasterFillPolygon */
+
+
+void TOBY_rasterFloodFill(TobyRaster *raster, lua_Number x, lua_Number y,
+                          int r, int g, int b)
+{
+    TobySpanTarget target;
+    rasterTarget(raster, &target);
+    scaleXY(raster, &x, &y);
+    raster->pixelsWritten += floodFill32(&target, (int) x, (int) y,
+                                         mapRGB(r, g, b));
+} /* TOBY_rasterFloodFill */
+
+
+int TOBY_rasterWritePPM(const TobyRaster *raster, const char *path)
+{
+    const int size = raster->size;
+    const unsigned int *p = raster->pixels;
+    unsigned char *row = NULL;
+    int retval = 0;
+    FILE *io = NULL;
+    int y;
+
+    row = (unsigned char *) malloc(size * 3);
+    if (row == NULL)
+        return 0;
+
+    io = fopen(path, "wb");
+    if (io != NULL)
+    {
+        retval = (fprintf(io, "P6\n%d %d\n255\n", size, size) > 0);
+        for (y = 0; (retval) && (y < size); y++)
+        {
+            unsigned char *dst = row;
+            int x;
+            for (x = 0; x < size; x++)
+            {
+                const unsigned int pval = *(p++);
+                *(dst++) = (unsigned char) (pval >> 16);
+                *(dst++) = (unsigned char) (pval >> 8);
+                *(dst++) = (unsigned char) pval;
+            } /* for */
+            retval = (fwrite(row, size * 3, 1, io) == 1);
+        } /* for */
+
+        if (fclose(io) != 0)
+            retval = 0;
+    } /* if */
+
+    free(row);
+    return retval;
+} /* TOBY_rasterWritePPM */
+
+
+/*
+ * PNG output doesn't bother compressing: the image goes into "stored"
+ *  deflate blocks, which any PNG reader handles, and it means we don't need
+ *  zlib. Run the result through an optimizer if size matters.
+ */
+
+static unsigned int crc32Update(unsigned int crc, const unsigned char *buf,
+                                size_t len)
+{
+    static const unsigned int table[16] =
+    {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    while (len--)
+    {
+        crc ^= *(buf++);
+        crc = (crc >> 4) ^ table[crc & 0xF];
+        crc = (crc >> 4) ^ table[crc & 0xF];
+    } /* while */
+    return crc;
+} /* crc32Update */
+
+
+static inline unsigned char *putBE32(unsigned char *ptr, unsigned int val)
+{
+    *(ptr++) = (unsigned char) (val >> 24);
+    *(ptr++) = (unsigned char) (val >> 16);
+    *(ptr++) = (unsigned char) (val >> 8);
+    *(ptr++) = (unsigned char) val;
+    return ptr;
+} /* putBE32 */
+
+
+static int writePNGChunk(FILE *io, const char *type,
+                         const unsigned char *data, size_t len)
+{
+    unsigned char buf[8];
+    unsigned int crc = 0xFFFFFFFF;
+
+    crc = crc32Update(crc, (const unsigned char *) type, 4);
+    crc = crc32Update(crc, data, len);
+
+    putBE32(buf, (unsigned int) len);
+    memcpy(buf + 4, type, 4);
+    if (fwrite(buf, sizeof (buf), 1, io) != 1)
+        return 0;
+    else if ((len > 0) && (fwrite(data, len, 1, io) != 1))
+        return 0;
+
+    putBE32(buf, crc ^ 0xFFFFFFFF);
+    return (fwrite(buf, 4, 1, io) == 1);
+} /* writePNGChunk */
+
+
+int TOBY_rasterWritePNG(const TobyRaster *raster, const char *path)
+{
+    static const unsigned char signature[8] =
+    {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    const int size = raster->size;
+    const size_t rowlen = 1 + ((size_t) size * 3);  /* filter byte + RGB. */
+    const size_t rawlen = rowlen * size;
+    const size_t blockmax = 0xFFFF;
+    const size_t blocks = (rawlen + blockmax - 1) / blockmax;
+    const size_t zlen = 2 + rawlen + (blocks * 5) + 4;
+    const unsigned int *p = raster->pixels;
+    unsigned char *raw = NULL;
+    unsigned char *zbuf = NULL;
+    unsigned char *dst = NULL;
+    unsigned char ihdr[13];
+    unsigned int s1 = 1;
+    unsigned int s2 = 0;
+    size_t i;
+    int retval = 0;
+    FILE *io = NULL;
+    int x, y;
+
+    raw = (unsigned char *) malloc(rawlen);
+    zbuf = (unsigned char *) malloc(zlen);
+    if ((raw == NULL) || (zbuf == NULL))
+    {
+        free(raw);
+        free(zbuf);
+        return 0;
+    } /* if */
+
+    dst = raw;
+    for (y = 0; y < size; y++)
+    {
+        *(dst++) = 0;  /* filter type: none. */
+        for (x = 0; x < size; x++)
+        {
+            const unsigned int pval = *(p++);
+            *(dst++) = (unsigned char) (pval >> 16);
+            *(dst++) = (unsigned char) (pval >> 8);
+            *(dst++) = (unsigned char) pval;
+        } /* for */
+    } /* for */
+
+    dst = zbuf;
+    *(dst++) = 0x78;  /* deflate, 32k window... */
+    *(dst++) = 0x01;  /* ...no dictionary, header checksum. */
+    for (i = 0; i < rawlen; i += blockmax)
+    {
+        const size_t len = ((rawlen - i) < blockmax) ? (rawlen - i) : blockmax;
+        *(dst++) = ((i + len) == rawlen) ? 1 : 0;  /* final block? */
+        *(dst++) = (unsigned char) (len & 0xFF);
+        *(dst++) = (unsigned char) (len >> 8);
+        *(dst++) = (unsigned char) (~len & 0xFF);
+        *(dst++) = (unsigned char) ((~len >> 8) & 0xFF);
+        memcpy(dst, raw + i, len);
+        dst += len;
+    } /* for */
+
+    for (i = 0; i < rawlen; i++)  /* Adler-32 of the uncompressed data. */
+    {
+        s1 = (s1 + raw[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    } /* for */
+    putBE32(dst, (s2 << 16) | s1);
+
+    putBE32(ihdr, (unsigned int) size);
+    putBE32(ihdr + 4, (unsigned int) size);
+    ihdr[8] = 8;  /* bits per channel. */
+    ihdr[9] = 2;  /* truecolor. */
+    ihdr[10] = 0;  /* deflate. */
+    ihdr[11] = 0;  /* adaptive filtering. */
+    ihdr[12] = 0;  /* no interlace. */
+
+    io = fopen(path, "wb");
+    if (io != NULL)
+    {
+        retval = ( (fwrite(signature, sizeof (signature), 1, io) == 1) &&
+                   (writePNGChunk(io, "IHDR", ihdr, sizeof (ihdr))) &&
+                   (writePNGChunk(io, "IDAT", zbuf, zlen)) &&
+                   (writePNGChunk(io, "IEND", NULL, 0)) );
+        if (fclose(io) != 0)
+            retval = 0;
+    } /* if */
+
+    free(zbuf);
+    free(raw);
+    return retval;
+} /* TOBY_rasterWritePNG */
+
+/* end of toby_raster.c ... */
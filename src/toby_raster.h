@@ -0,0 +1,133 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * A software canvas for TurtleSpace, for frontends that don't have a
+ *  display (or don't want to use it). It draws exactly what the SDL
+ *  frontend does, into plain memory, and can write the result out as an
+ *  image file.
+ */
+
+#ifndef _INCL_TOBY_RASTER_H_
+#define _INCL_TOBY_RASTER_H_
+
+#include "toby_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TobyRaster
+{
+    int size;  /* the canvas is (size) pixels on a side. */
+    unsigned int *pixels;  /* (size*size) pixels, each 0xRRGGBB. */
+    unsigned long pixelsWritten;  /* running count, for profiling. */
+} TobyRaster;
+
+/* Make a black, square canvas. Returns NULL if out of memory. */
+TobyRaster *TOBY_createRaster(int size);
+void TOBY_destroyRaster(TobyRaster *raster);
+
+/* Blank the whole canvas to color r,g,b (0 to 255 each). */
+void TOBY_rasterClear(TobyRaster *raster, int r, int g, int b);
+
+/*
+ * Draw line segments, as handed to the drawLines callback. The segments
+ *  must already be clipped to TurtleSpace, which the backend guarantees.
+ */
+void TOBY_rasterDrawLines(TobyRaster *raster, const TobyLineSegment *segs,
+                          int count);
+
+/*
+ * Set pixels, as handed to the drawPoints callback. Each point fills all
+ *  the pixels of its TurtleSpace unit, so it's more than one pixel when
+ *  the canvas is bigger than TurtleSpace.
+ */
+void TOBY_rasterDrawPoints(TobyRaster *raster, const TobyPoint *pts,
+                           int count);
+
+/* Draw a turtle like the wxWidgets frontend does: a green triangle. */
+void TOBY_rasterDrawTurtle(TobyRaster *raster, const Turtle *turtle);
+
+/* Fill a polygon, as handed to the fillPolygon callback. */
+void TOBY_rasterFillPolygon(TobyRaster *raster, const TurtlePoint *pts,
+                            int count, int r, int g, int b);
+
+/* Flood fill from (x,y), as the floodFill callback asks. */
+void TOBY_rasterFloodFill(TobyRaster *raster, lua_Number x, lua_Number y,
+                          int r, int g, int b);
+
+/*
+ * The span functions behind those, which work on any buffer of pixels, so
+ *  other software frontends can share them. (pitch) is the distance
+ *  between rows, in bytes, and pixels are (bpp) bytes each: 1, 2, 3 or 4.
+ *  24-bit pixels are stored in the machine's byte order. Pixel values are
+ *  already in the buffer's format (SDL_MapRGB(), say), so channel order
+ *  is up to you.
+ */
+typedef struct TobySpanTarget
+{
+    void *pixels;
+    int w;
+    int h;
+    int pitch;
+    int bpp;
+} TobySpanTarget;
+
+/*
+ * Coordinates are whole pixels; polygon corners can be fractions of them.
+ *  Rects and both ends of lines must be on the buffer; polygons and flood
+ *  fills are clipped to it. These return how many pixels they wrote.
+ */
+typedef struct TobySpanFuncs
+{
+    unsigned long (*fillRect)(const TobySpanTarget *dst, int x, int y,
+                              int w, int h, unsigned int pval);
+    unsigned long (*drawLine)(const TobySpanTarget *dst, int x1, int y1,
+                              int x2, int y2, unsigned int pval);
+    unsigned long (*fillPolygon)(const TobySpanTarget *dst,
+                                 const TurtlePoint *pts, int count,
+                                 unsigned int pval);
+    unsigned long (*floodFill)(const TobySpanTarget *dst, int x, int y,
+                               unsigned int pval);
+} TobySpanFuncs;
+
+/*
+ * The span functions for (bpp) bytes per pixel, or NULL if we don't have
+ *  any. Pick these once, when you know what your buffer looks like.
+ */
+const TobySpanFuncs *TOBY_getSpanFuncs(int bpp);
+
+/*
+ * What fills runs of 32-bit pixels for all of the above. The fastest one
+ *  this CPU has is used unless you ask for another, which is only useful
+ *  for comparing them. TOBY_setSpanWriter() returns zero, and changes nothing,
+ *  if this CPU or build doesn't have (writer).
+ */
+typedef enum TobySpanWriter
+{
+    TOBY_SPANWRITER_SCALAR,
+    TOBY_SPANWRITER_SSE2,
+    TOBY_SPANWRITER_AVX2
+} TobySpanWriter;
+
+int TOBY_spanWriterAvailable(TobySpanWriter writer);
+int TOBY_setSpanWriter(TobySpanWriter writer);
+TobySpanWriter TOBY_getSpanWriter(void);
+
+/* Write the canvas to (path). These return zero on failure. */
+int TOBY_rasterWritePPM(const TobyRaster *raster, const char *path);
+int TOBY_rasterWritePNG(const TobyRaster *raster, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of toby_raster.h ... */
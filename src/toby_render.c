@@ -0,0 +1,533 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * A frontend with no display at all: it runs programs into software
+ *  canvases and writes out the final TurtleSpace as image files, several
+ *  programs at once, one per CPU core. Good for thumbnails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+#include "toby_app.h"
+#include "toby_raster.h"
+#include "toby_thread.h"
+
+typedef struct RenderJob
+{
+    TobyRaster *raster;
+    const char *fname;
+    long startTicks;
+    int failed;
+    int timedOut;
+} RenderJob;
+
+static int GSize = 600;
+static long GTimeout = 30000;
+static int GForPrinting = 0;
+static int GWritePPM = 0;
+static const char *GOutDir = NULL;
+static char **GPrograms = NULL;
+static int GProgramCount = 0;
+static int GNextProgram = 0;
+static int GFailures = 0;
+static TobyMutex *GMutex = NULL;
+
+
+static long tobyhook_getTicks(TobyContext *ctx)
+{
+    #if PLATFORM_WINDOWS
+    return (long) GetTickCount();
+    #else
+    static struct timeval start = { 0, 0 };
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if ((start.tv_sec == 0) && (start.tv_usec == 0))
+        start = now;  /* first call is from main(), before any threads. */
+    return ((now.tv_sec - start.tv_sec) * 1000) +
+           ((now.tv_usec - start.tv_usec) / 1000);
+    #endif
+} /* tobyhook_getTicks */
+
+
+static void tobyhook_yieldCPU(TobyContext *ctx, int ms)
+{
+    #if PLATFORM_WINDOWS
+    Sleep(ms);
+    #else
+    usleep(ms * 1000);
+    #endif
+} /* tobyhook_yieldCPU */
+
+
+static void tobyhook_startRun(TobyContext *ctx)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    job->startTicks = tobyhook_getTicks(ctx);
+} /* tobyhook_startRun */
+
+
+static void tobyhook_stopRun(TobyContext *ctx)
+{
+    /* no-op. */
+} /* tobyhook_stopRun */
+
+
+static void tobyhook_pumpEvents(TobyContext *ctx)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    if (GTimeout > 0)
+    {
+        if ((tobyhook_getTicks(ctx) - job->startTicks) > GTimeout)
+        {
+            job->timedOut = 1;
+            TOBY_haltProgram(ctx);
+        } /* if */
+    } /* if */
+} /* tobyhook_pumpEvents */
+
+
+static void tobyhook_putToScreen(TobyContext *ctx)
+{
+    /* no-op: there's no screen. The canvas is written out at the end. */
+} /* tobyhook_putToScreen */
+
+
+static void tobyhook_messageBox(TobyContext *ctx, const char *msg)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    fprintf(stderr, "%s: %s\n", job->fname, msg);
+    job->failed = 1;
+} /* tobyhook_messageBox */
+
+
+static void tobyhook_pauseReached(TobyContext *ctx, int line, int fullstop,
+                                  int breakpoint, int pauseTicks)
+{
+    /* no-op in this implementation: no debugging facilities. */
+} /* tobyhook_pauseReached */
+
+
+static void tobyhook_drawLines(TobyContext *ctx, const TobyLineSegment *segs,
+                               int count)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterDrawLines(job->raster, segs, count);
+} /* tobyhook_drawLines */
+
+
+static void tobyhook_drawPoints(TobyContext *ctx, const TobyPoint *pts,
+                                int count)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterDrawPoints(job->raster, pts, count);
+} /* tobyhook_drawPoints */
+
+
+static int tobyhook_drawString(TobyContext *ctx, lua_Number x, lua_Number y,
+                               const char *utf8str, lua_Number angle,
+                               int r, int g, int b)
+{
+    /*
+     * !!! FIXME: no font rasterizer yet. Leave the text out of the picture
+     * !!! FIXME:  instead of failing the whole program.
+     */
+    return 1;
+} /* tobyhook_drawString */
+
+
+static void tobyhook_drawTurtle(TobyContext *ctx, const Turtle *turtle,
+                                void *data)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterDrawTurtle(job->raster, turtle);
+} /* tobyhook_drawTurtle */
+
+
+static void tobyhook_fillPolygon(TobyContext *ctx, const TurtlePoint *pts,
+                                 int count, int r, int g, int b)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterFillPolygon(job->raster, pts, count, r, g, b);
+} /* tobyhook_fillPolygon */
+
+
+static int tobyhook_floodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                              int r, int g, int b)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterFloodFill(job->raster, x, y, r, g, b);
+    return 1;
+} /* tobyhook_floodFill */
+
+
+static void tobyhook_cleanup(TobyContext *ctx, int r, int g, int b)
+{
+    RenderJob *job = (RenderJob *) TOBY_getContextUserData(ctx);
+    TOBY_rasterClear(job->raster, r, g, b);
+} /* tobyhook_cleanup */
+
+
+static const TobyCallbacks callbacks =
+{
+    tobyhook_startRun,
+    tobyhook_stopRun,
+    tobyhook_pumpEvents,
+    tobyhook_putToScreen,
+    tobyhook_messageBox,
+    tobyhook_drawLines,
+    tobyhook_drawPoints,
+    tobyhook_drawString,
+    tobyhook_drawTurtle,
+    tobyhook_fillPolygon,
+    tobyhook_floodFill,
+    tobyhook_cleanup,
+    tobyhook_pauseReached,
+    tobyhook_getTicks,
+    tobyhook_yieldCPU,
+};
+
+
+static char *loadProgram(const char *fname)
+{
+    char *retval = NULL;
+    FILE *io = fopen(fname, "rb");
+    if (io == NULL)
+        fprintf(stderr, "Failed to open '%s': %s\n", fname, strerror(errno));
+    else
+    {
+        long len = 0;
+        if ( (fseek(io, 0, SEEK_END) == -1) ||
+             ((len = ftell(io)) == -1) ||
+             (fseek(io, 0, SEEK_SET) == -1) )
+        {
+            fprintf(stderr, "i/o error on '%s': %s\n", fname, strerror(errno));
+        } /* if */
+
+        else
+        {
+            retval = (char *) malloc(len + 1);
+            if (retval == NULL)
+                fprintf(stderr, "Out of memory.\n");
+            else
+            {
+                if (fread(retval, len, 1, io) == 1)
+                    retval[len] = '\0';
+                else
+                {
+                    fprintf(stderr, "Failed to read '%s': %s\n", fname,
+                            strerror(errno));
+                    free(retval);
+                    retval = NULL;
+                } /* else */
+            } /* else */
+        } /* else */
+        fclose(io);
+    } /* else */
+
+    return retval;
+} /* loadProgram */
+
+
+/*
+ * Where the image for (fname) goes: its name with the extension swapped,
+ *  either next to it or in GOutDir. Caller frees the result.
+ */
+static char *outputPath(const char *fname)
+{
+    const char *ext = GWritePPM ? ".ppm" : ".png";
+    const char *base = fname;
+    const char *dot = NULL;
+    const char *ptr;
+    size_t dirlen = 0;
+    size_t baselen;
+    char *retval;
+
+    for (ptr = fname; *ptr; ptr++)
+    {
+        if ((*ptr == '/') || (*ptr == '\\'))
+            base = ptr + 1;
+    } /* for */
+
+    dot = strrchr(base, '.');
+    baselen = (dot != NULL) ? (size_t) (dot - base) : strlen(base);
+
+    if (GOutDir != NULL)
+        dirlen = strlen(GOutDir) + 1;
+    else
+        dirlen = (size_t) (base - fname);
+
+    retval = (char *) malloc(dirlen + baselen + strlen(ext) + 1);
+    if (retval != NULL)
+    {
+        if (GOutDir == NULL)
+            memcpy(retval, fname, dirlen);
+        else
+        {
+            memcpy(retval, GOutDir, dirlen - 1);
+            retval[dirlen - 1] = '/';
+        } /* else */
+        memcpy(retval + dirlen, base, baselen);
+        strcpy(retval + dirlen + baselen, ext);
+    } /* if */
+
+    return retval;
+} /* outputPath */
+
+
+static void renderProgram(TobyContext *ctx, RenderJob *job)
+{
+    char *program = loadProgram(job->fname);
+    char *outpath = NULL;
+    long ms = 0;
+
+    job->failed = job->timedOut = 0;
+    if (program == NULL)
+        job->failed = 1;  /* error is output in loadProgram()... */
+    else
+    {
+        TOBY_rasterClear(job->raster, 0, 0, 0);
+        TOBY_runProgram(ctx, program, GForPrinting);
+        ms = tobyhook_getTicks(ctx) - job->startTicks;
+        free(program);
+    } /* else */
+
+    if (job->failed)
+        return;  /* already reported. */
+
+    outpath = outputPath(job->fname);
+    if (outpath == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", job->fname);
+        job->failed = 1;
+    } /* if */
+    else
+    {
+        const int rc = GWritePPM ? TOBY_rasterWritePPM(job->raster, outpath) :
+                                   TOBY_rasterWritePNG(job->raster, outpath);
+        if (!rc)
+        {
+            fprintf(stderr, "%s: Failed to write '%s'.\n", job->fname, outpath);
+            job->failed = 1;
+        } /* if */
+        else
+        {
+            printf("%s -> %s (%ld ms%s)\n", job->fname, outpath, ms,
+                   job->timedOut ? ", timed out" : "");
+        } /* else */
+        free(outpath);
+    } /* else */
+} /* renderProgram */
+
+
+static void renderThread(void *data)
+{
+    RenderJob job;
+    TobyContext *ctx = NULL;
+
+    memset(&job, '\0', sizeof (job));
+    job.raster = TOBY_createRaster(GSize);
+    if (job.raster != NULL)
+        ctx = TOBY_createContext(&callbacks, &job);
+
+    while (1)
+    {
+        int idx;
+        TOBY_lockMutex(GMutex);
+        idx = GNextProgram;
+        if (idx < GProgramCount)
+            GNextProgram++;
+        TOBY_unlockMutex(GMutex);
+
+        if (idx >= GProgramCount)
+            break;
+
+        job.fname = GPrograms[idx];
+        if (ctx == NULL)
+        {
+            fprintf(stderr, "%s: Out of memory.\n", job.fname);
+            job.failed = 1;
+        } /* if */
+        else
+        {
+            renderProgram(ctx, &job);
+        } /* else */
+
+        if (job.failed)
+        {
+            TOBY_lockMutex(GMutex);
+            GFailures++;
+            TOBY_unlockMutex(GMutex);
+        } /* if */
+    } /* while */
+
+    TOBY_destroyContext(ctx);
+    TOBY_destroyRaster(job.raster);
+} /* renderThread */
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "USAGE: %s [options] <program.toby> [more.toby ...]\n"
+        "\n"
+        "  --size <pixels>     Width and height of the image (600).\n"
+        "  --outdir <dir>      Write images here, not next to each program.\n"
+        "  --ppm               Write PPM files instead of PNG.\n"
+        "  --printing          White background, as if printing.\n"
+        "  --jobs <count>      Programs to run at once (one per CPU core).\n"
+        "  --timeout <ms>      Stop programs after this long, 0 for never\n"
+        "                       (30000). They still get an image.\n"
+        "  --cachedir <dir>    Keep compiled programs in this directory.\n"
+        "  --buildver          Print the build version and quit.\n"
+        "  --license           Print the license and quit.\n"
+        "\n", argv0);
+} /* usage */
+
+
+int main(int argc, char **argv)
+{
+    TobyThread **threads = NULL;
+    int jobs = 0;
+    int i;
+
+    GPrograms = (char **) malloc(sizeof (char *) * argc);
+    if (GPrograms == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    } /* if */
+
+    /* Parse command lines. */
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (*arg == '-')
+        {
+            while (*(++arg) == '-') { /* no-op. */ }
+            if (strcmp(arg, "ppm") == 0)
+                GWritePPM = 1;
+            else if (strcmp(arg, "png") == 0)
+                GWritePPM = 0;
+            else if (strcmp(arg, "printing") == 0)
+                GForPrinting = 1;
+            else if (strcmp(arg, "size") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GSize = atoi(arg);
+            } /* else if */
+            else if (strcmp(arg, "outdir") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GOutDir = arg;
+            } /* else if */
+            else if (strcmp(arg, "jobs") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    jobs = atoi(arg);
+            } /* else if */
+            else if (strcmp(arg, "timeout") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    GTimeout = atol(arg);
+            } /* else if */
+            else if (strcmp(arg, "cachedir") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                {
+                    if (!TOBY_setBytecodeCacheDir(arg))
+                    {
+                        fprintf(stderr, "Out of memory.\n");
+                        return 1;
+                    } /* if */
+                } /* if */
+            } /* else if */
+            else if (strcmp(arg, "buildver") == 0)
+            {
+                printf("%s\n", GBuildVer);
+                return 0;
+            } /* else if */
+            else if (strcmp(arg, "license") == 0)
+            {
+                printf("%s\n", GLicense);
+                return 0;
+            } /* else if */
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            } /* else */
+        } /* if */
+        else
+        {
+            GPrograms[GProgramCount++] = argv[i];
+        } /* else */
+    } /* for */
+
+    if (GProgramCount == 0)
+    {
+        usage(argv[0]);
+        return 3;
+    } /* if */
+
+    if (GSize <= 0)
+    {
+        fprintf(stderr, "Image size must be more than zero.\n");
+        return 1;
+    } /* if */
+
+    if (jobs <= 0)
+        jobs = TOBY_getCPUCount();
+    if (jobs > GProgramCount)
+        jobs = GProgramCount;
+
+    tobyhook_getTicks(NULL);  /* start the clock before any threads. */
+
+    GMutex = TOBY_createMutex();
+    threads = (TobyThread **) calloc(jobs, sizeof (TobyThread *));
+    if ((GMutex == NULL) || (threads == NULL))
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    } /* if */
+
+    /* main thread does a share of the work, too. */
+    for (i = 1; i < jobs; i++)
+    {
+        threads[i] = TOBY_createThread(renderThread, NULL);
+        if (threads[i] == NULL)
+            break;  /* run with what we have. */
+    } /* for */
+
+    renderThread(NULL);
+
+    for (i = 1; i < jobs; i++)
+    {
+        if (threads[i] != NULL)
+            TOBY_waitThread(threads[i]);
+    } /* for */
+
+    free(threads);
+    TOBY_destroyMutex(GMutex);
+    free(GPrograms);
+
+    return (GFailures > 0) ? 4 : 0;
+} /* main */
+
+/* end of toby_render.c ... */
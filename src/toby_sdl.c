@@ -13,26 +13,105 @@
 #include <assert.h>
 #include "SDL.h"
 #include "toby_app.h"
+#include "toby_worker.h"
+#include "toby_raster.h"
 
 static SDL_Surface *GScreen = NULL;
 static SDL_Surface *GBacking = NULL;
+static const TobySpanFuncs *GSpans = NULL;  /* matches GBacking's format. */
 static int GRequestingQuit = 0;
 static Uint32 GStopWatch = 0;
 static int GDelayAndQuit = -1;
+static int GPendingResize = 0;
+static int GFullRepaint = 1;  /* next putToScreen updates the whole window. */
+static TobyWorker *GWorker = NULL;
 
 #define TOBY_PROFILE 1
 
 
-void TOBY_putToScreen(void)
+static SDL_Surface *createBacking(int size);
+static void tobyhook_cleanup(TobyContext *ctx, int r, int g, int b);
+
+/*
+ * Redraw TurtleSpace at the new window size from the display list. The
+ *  program has to be done for that, so until then, we just remember the
+ *  size and keep drawing to the old backing store, centered.
+ */
+static void resizeBacking(TobyContext *ctx, int size)
+{
+    SDL_Surface *backing;
+
+    if (TOBY_workerIsRunning(GWorker))
+    {
+        GPendingResize = size;
+        return;
+    } /* if */
+    else if ((size <= 0) || (size == GBacking->w))
+        return;
+    else if ((backing = createBacking(size)) == NULL)
+        return;  /* just keep the old one, centered. */
+
+    if (SDL_MUSTLOCK(GBacking))
+        SDL_UnlockSurface(GBacking);
+    SDL_FreeSurface(GBacking);
+    GBacking = backing;
+    GSpans = TOBY_getSpanFuncs(GBacking->format->BytesPerPixel);
+
+    if (!TOBY_workerReplayDisplayList(GWorker, 0))
+    {
+        int r, g, b;
+        TOBY_background(ctx, &r, &g, &b);
+        tobyhook_cleanup(ctx, r, g, b);  /* nothing to replay; blank it. */
+    } /* if */
+} /* resizeBacking */
+
+
+/* Pixels of the backing store covering (rect), padded for rounding. */
+static void dirtyToBacking(const TobyRect *rect, SDL_Rect *r)
+{
+    const lua_Number size = (lua_Number) GBacking->w;
+    int x1 = ((int) ((rect->x1 / N(1000)) * size)) - 1;
+    int y1 = ((int) ((rect->y1 / N(1000)) * size)) - 1;
+    int x2 = ((int) ((rect->x2 / N(1000)) * size)) + 2;
+    int y2 = ((int) ((rect->y2 / N(1000)) * size)) + 2;
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > GBacking->w) x2 = GBacking->w;
+    if (y2 > GBacking->h) y2 = GBacking->h;
+    r->x = x1;
+    r->y = y1;
+    r->w = (x2 > x1) ? (x2 - x1) : 0;
+    r->h = (y2 > y1) ? (y2 - y1) : 0;
+} /* dirtyToBacking */
+
+
+static void tobyhook_putToScreen(TobyContext *ctx)
 {
     const int xoff = (GScreen->w - GBacking->w) / 2;
     const int yoff = (GScreen->h - GBacking->h) / 2;
-    SDL_Rect blitr = { xoff, yoff, GBacking->w, GBacking->h };
+    SDL_Rect srcr = { 0, 0, GBacking->w, GBacking->h };
+    SDL_Rect blitr;
+    TobyRect dirty;
+
+    /* Only copy what changed since the last frame, unless told otherwise. */
+    if (!GFullRepaint)
+    {
+        if (!TOBY_workerGetDirtyRect(GWorker, &dirty))
+            return;
+        dirtyToBacking(&dirty, &srcr);
+        if ((srcr.w == 0) || (srcr.h == 0))
+            return;
+    } /* if */
+
+    blitr.x = xoff + srcr.x;
+    blitr.y = yoff + srcr.y;
+    blitr.w = srcr.w;
+    blitr.h = srcr.h;
 
     if (SDL_MUSTLOCK(GBacking))
         SDL_UnlockSurface(GBacking);
 
-    SDL_BlitSurface(GBacking, NULL, GScreen, &blitr);
+    SDL_BlitSurface(GBacking, &srcr, GScreen, &blitr);
 
     if (SDL_MUSTLOCK(GBacking))
     {
@@ -40,27 +119,40 @@ void TOBY_putToScreen(void)
             SDL_Delay(10);
     } /* if */
 
-    TOBY_renderAllTurtles(GScreen);
-    SDL_Flip(GScreen);
+    if (GFullRepaint)
+        TOBY_workerRenderAllTurtles(GWorker, GScreen);
+    else  /* turtles anywhere else are still on the screen. */
+        TOBY_workerRenderTurtlesInRect(GWorker, GScreen, &dirty);
+
+    if (GFullRepaint)
+        SDL_Flip(GScreen);
+    else
+        SDL_UpdateRects(GScreen, 1, &blitr);
+    GFullRepaint = 0;
 } /* putToScreen */
 
 
-void TOBY_startRun(void)
+static void tobyhook_startRun(TobyContext *ctx)
 {
-    GRequestingQuit = 0;
     GStopWatch = SDL_GetTicks();
-} /* TOBY_startRun */
+} /* tobyhook_startRun */
 
 
-void TOBY_stopRun()
+static void tobyhook_stopRun(TobyContext *ctx)
 {
     #if TOBY_PROFILE
     printf("time execute: %ld\n", (unsigned long) (SDL_GetTicks()-GStopWatch));
     #endif
-} /* TOBY_stopRun */
+} /* tobyhook_stopRun */
 
 
-void TOBY_pumpEvents(void)
+static void tobyhook_pumpEvents(TobyContext *ctx)
+{
+    /* no-op: the worker never calls this; doProgram() pumps SDL itself. */
+} /* tobyhook_pumpEvents */
+
+
+static void pumpSDLEvents(TobyContext *ctx)
 {
     SDL_Event e;
     while (SDL_PollEvent(&e))
@@ -69,17 +161,23 @@ void TOBY_pumpEvents(void)
             GRequestingQuit = 1;
 
         else if (e.type == SDL_VIDEOEXPOSE)
-            TOBY_putToScreen();  /* in case we need to force a repaint... */
+        {
+            GFullRepaint = 1;
+            tobyhook_putToScreen(ctx);  /* in case we need to force a repaint */
+        } /* else if */
 
         else if (e.type == SDL_VIDEORESIZE)
         {
             int r, g, b;
             const SDL_ResizeEvent *re = &e.resize;
+            const int size = (re->h < re->w) ? re->h : re->w;
             GScreen = SDL_SetVideoMode(re->w, re->h, 0, GScreen->flags);
             /* !!! FIXME: what do we do if GScreen is NULL? */
-            TOBY_background(&r, &g, &b);
+            TOBY_background(ctx, &r, &g, &b);
             SDL_FillRect(GScreen, NULL, SDL_MapRGB(GScreen->format, r, g, b));
-            TOBY_putToScreen();
+            resizeBacking(ctx, size);
+            GFullRepaint = 1;
+            tobyhook_putToScreen(ctx);
         } /* else if */
 
         else if (e.type == SDL_KEYDOWN)
@@ -95,20 +193,21 @@ void TOBY_pumpEvents(void)
     } /* while */
 
     if (GRequestingQuit)
-        TOBY_haltProgram();
-} /* TOBY_pumpEvents */
+        TOBY_haltProgram(ctx);
+} /* pumpSDLEvents */
 
 
-void TOBY_messageBox(const char *msg)
+static void tobyhook_messageBox(TobyContext *ctx, const char *msg)
 {
     fprintf(stderr, "!!! FIXME: message box: '%s'\n", msg);
-} /* TOBY_messageBox */
+} /* tobyhook_messageBox */
 
 
-void TOBY_pauseReached(int line, int fullstop, int breakpoint, int pauseTicks)
+static void tobyhook_pauseReached(TobyContext *ctx, int line, int fullstop,
+                                  int breakpoint, int pauseTicks)
 {
     /* no-op in this implementation: no debugging facilities. */
-} /* TOBY_pauseReached */
+} /* tobyhook_pauseReached */
 
 
 #if 0
@@ -125,141 +224,188 @@ static inline void scaleXY(lua_Number *x, lua_Number *y)
 } /* scaleXY */
 
 
-void TOBY_drawLine(lua_Number x1, lua_Number y1, lua_Number x2, lua_Number y2,
-                   int r, int g, int b)
+/*
+ * Where the TurtleSpace unit holding (v) starts on a backing store axis of
+ *  (size) pixels, and how many it covers, so a plotted point fills its
+ *  whole unit when the window is bigger than TurtleSpace.
+ */
+static inline void pointCell(int size, lua_Number v, int *start, int *len)
 {
-    /*
-     * This is a standard Bresenham line-drawing algorithm, but the specific
-     *  implementation was borrowed, optimized, and mangled from
-     *  SGE's DoLine code:
-     *   http://www.etek.chalmers.se/~e8cal1/sge/
-     */
+    const int end = (int) (size * (((lua_Number) (((int) v) + 1)) / N(1000)));
+    *start = (int) (size * (v / N(1000)));
+    if (*start >= size)  /* rounding right at the edge. */
+        *start = size - 1;
+    *len = (end > *start) ? (end - *start) : 1;
+} /* pointCell */
 
-    int dx, dy, sdx, sdy, x, y, px, py;
-    const int w = GBacking->w;
-    const Uint32 pval = (b << 24) | (g << 16) | (r << 8) | 0xFF;
 
-    /* !!! FIXME: this is always 32-bpp at the moment. */
-    Uint32 *p = (Uint32 *) GBacking->pixels;
-
-    scaleXY(&x1, &y1);
-    scaleXY(&x2, &y2);
-
-    _D(("LFB: rendering line...(%d, %d)-(%d, %d), (%d, %d, %d)...\n",
-        (int) x1, (int) y1, (int) x2, (int) y2, (int) r, (int) g, (int) b));
-
-    dx = x2 - x1;
-    dy = y2 - y1;
+/* The backing store is in the screen's format, whatever that is. */
+static inline Uint32 mapPenColor(int r, int g, int b)
+{
+    return SDL_MapRGB(GBacking->format, (Uint8) r, (Uint8) g, (Uint8) b);
+} /* mapPenColor */
 
-    sdx = (dx < 0) ? -1 : 1;
-    sdy = (dy < 0) ? -1 : 1;
 
-    dx = sdx * dx + 1;
-    dy = sdy * dy + 1;
+/*
+ * We draw with the software canvas's span functions, picked to match the
+ *  backing store's pixel size when we made it.
+ */
+static inline void getBackingTarget(TobySpanTarget *target)
+{
+    target->pixels = GBacking->pixels;
+    target->w = GBacking->w;
+    target->h = GBacking->h;
+    target->pitch = GBacking->pitch;
+    target->bpp = GBacking->format->BytesPerPixel;
+} /* getBackingTarget */
 
-    x = y = 0;
 
-    px = (int) x1;
-    py = (int) y1;
+static void tobyhook_drawLines(TobyContext *ctx, const TobyLineSegment *segs,
+                               int count)
+{
+    const TobyLineSegment *end = segs + count;
+    TurtleRGB color = { -1, -1, -1 };
+    TobySpanTarget target;
+    Uint32 pval = 0;
 
-    if ((dx == 1) && (dy == 1))
+    getBackingTarget(&target);
+    for (; segs != end; segs++)
     {
-        _D(("LFB: Single pixel line fastpath.\n"));
-        *(((Uint32 *) p) + ((py * w) + px)) = pval;
-    } /* if */
+        const TurtleRGB *c = &segs->color;
+        lua_Number x1 = segs->x1;
+        lua_Number y1 = segs->y1;
+        lua_Number x2 = segs->x2;
+        lua_Number y2 = segs->y2;
 
-    else if (dx == 1)
-    {
-        Uint32 *linep = ((Uint32 *) p) + ((py * w) + px);
-        const int incr = w * sdy;
-        _D(("LFB: Vertical line fastpath.\n"));
-        for (y = 0; y < dy; y++)
+        if ((c->r != color.r) || (c->g != color.g) || (c->b != color.b))
         {
-            *linep = pval;
-            linep += incr;
-        } /* for */
-    } /* else if */
+            color = *c;
+            pval = mapPenColor(color.r, color.g, color.b);
+        } /* if */
 
-    else if (dy == 1)
-    {
-        Uint32 *linep = ((Uint32 *) p) + ((py * w) + px);
-        const int incr = sdx;
+        scaleXY(&x1, &y1);
+        scaleXY(&x2, &y2);
+        _D(("LFB: rendering line...(%d, %d)-(%d, %d), 0x%X...\n",
+            (int) x1, (int) y1, (int) x2, (int) y2, (unsigned int) pval));
+        GSpans->drawLine(&target, (int) x1, (int) y1, (int) x2, (int) y2,
+                         pval);
+    } /* for */
+} /* tobyhook_drawLines */
 
-        _D(("LFB: Horizontal line fastpath.\n"));
 
-        for (x = 0; x < dx; x++)
-        {
-            *linep = pval;
-            linep += incr;
-        } /* for */
-    } /* else if */
+static void tobyhook_drawPoints(TobyContext *ctx, const TobyPoint *pts,
+                                int count)
+{
+    const TobyPoint *end = pts + count;
+    TurtleRGB color = { -1, -1, -1 };
+    TobySpanTarget target;
+    Uint32 pval = 0;
 
-    else if (dx >= dy)
+    getBackingTarget(&target);
+    for (; pts != end; pts++)
     {
-        _D(("LFB: Line with major axis of X.\n"));
+        const TurtleRGB *c = &pts->color;
+        int x, y, w, h;
 
-        for (x = 0; x < dx; x++)
+        if ((c->r != color.r) || (c->g != color.g) || (c->b != color.b))
         {
-            *( ((Uint32 *) p) + ((py * w) + px) ) = pval;
-            y += dy;
-            if (y >= dx)   /* run length completed. */
-            {
-                y -= dx;
-                py += sdy;
-            } /* if */
-            px += sdx;
-        } /* for */
-    } /* else if */
-
-    else
-    {
-        _D(("LFB: Line with major axis of Y.\n"));
+            color = *c;
+            pval = mapPenColor(color.r, color.g, color.b);
+        } /* if */
 
-        for (y = 0; y < dy; y++)
-        {
-            *( ((Uint32 *) p) + ((py * w) + px) ) = pval;
-            x += dx;
-            if (x >= dy)  /* run length completed. */
-            {
-                x -= dy;
-                px += sdx;
-            } /* if */
-            py += sdy;
-        } /* for */
-    } /* else */
-} /* TOBY_drawLine */
+        pointCell(GBacking->w, pts->x, &x, &w);
+        pointCell(GBacking->h, pts->y, &y, &h);
+        GSpans->fillRect(&target, x, y, w, h, pval);
+    } /* for */
+} /* tobyhook_drawPoints */
 
 
-int TOBY_drawString(lua_Number x, lua_Number y, const char *utf8str,
-                    lua_Number angle, int r, int g, int b)
+static int tobyhook_drawString(TobyContext *ctx, lua_Number x, lua_Number y,
+                               const char *utf8str, lua_Number angle,
+                               int r, int g, int b)
 {
     return 0;  /* !!! FIXME: write me. */
-} /* TOBY_drawString */
+} /* tobyhook_drawString */
 
 
-void TOBY_drawTurtle(const Turtle *turtle, void *data)
+static void tobyhook_drawTurtle(TobyContext *ctx, const Turtle *turtle,
+                                void *data)
 {
     /*SDL_Surface *surf = ((data == NULL)) ? GBacking : (SDL_Surface *) data);*/
-} /* TOBY_drawTurtle */
+} /* tobyhook_drawTurtle */
 
 
-void TOBY_cleanup(int r, int g, int b)
+static void tobyhook_fillPolygon(TobyContext *ctx, const TurtlePoint *pts,
+                                 int count, int r, int g, int b)
+{
+    TurtlePoint *scaled = (TurtlePoint *) malloc(sizeof (TurtlePoint) * count);
+    TobySpanTarget target;
+    int i;
+
+    if (scaled == NULL)
+        return;
+
+    for (i = 0; i < count; i++)
+    {
+        scaled[i] = pts[i];
+        scaleXY(&scaled[i].x, &scaled[i].y);
+    } /* for */
+
+    getBackingTarget(&target);
+    GSpans->fillPolygon(&target, scaled, count, mapPenColor(r, g, b));
+    free(scaled);
+} /* tobyhook_fillPolygon */
+
+
+static int tobyhook_floodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                              int r, int g, int b)
+{
+    TobySpanTarget target;
+    getBackingTarget(&target);
+    scaleXY(&x, &y);
+    GSpans->floodFill(&target, (int) x, (int) y, mapPenColor(r, g, b));
+    return 1;
+} /* tobyhook_floodFill */
+
+
+static void tobyhook_cleanup(TobyContext *ctx, int r, int g, int b)
 {
     SDL_FillRect(GBacking, NULL, SDL_MapRGBA(GBacking->format, r, g, b, 0xFF));
     SDL_FillRect(GScreen, NULL, SDL_MapRGB(GScreen->format, r, g, b));
-} /* TOBY_cleanup */
+    GFullRepaint = 1;  /* the border around the backing store changed, too. */
+} /* tobyhook_cleanup */
 
 
-long TOBY_getTicks(void)
+static long tobyhook_getTicks(TobyContext *ctx)
 {
     return (long) SDL_GetTicks();
-} /* TOBY_getTicks */
+} /* tobyhook_getTicks */
 
 
-void TOBY_yieldCPU(int ms)
+static void tobyhook_yieldCPU(TobyContext *ctx, int ms)
 {
     SDL_Delay(ms);
-} /* TOBY_yieldCPU */
+} /* tobyhook_yieldCPU */
+
+
+static const TobyCallbacks callbacks =
+{
+    tobyhook_startRun,
+    tobyhook_stopRun,
+    tobyhook_pumpEvents,
+    tobyhook_putToScreen,
+    tobyhook_messageBox,
+    tobyhook_drawLines,
+    tobyhook_drawPoints,
+    tobyhook_drawString,
+    tobyhook_drawTurtle,
+    tobyhook_fillPolygon,
+    tobyhook_floodFill,
+    tobyhook_cleanup,
+    tobyhook_pauseReached,
+    tobyhook_getTicks,
+    tobyhook_yieldCPU,
+};
 
 
 static char *loadProgram(const char *fname)
@@ -303,9 +449,58 @@ static char *loadProgram(const char *fname)
 } /* loadProgram */
 
 
+/*
+ * Make a locked, black, square backing store, (size) pixels on a side, in
+ *  the screen's format, so putting it up is a straight copy instead of a
+ *  conversion every frame. If we can't draw in that format, we draw in 32
+ *  bits and let SDL convert.
+ */
+static SDL_Surface *createBacking(int size)
+{
+    const SDL_PixelFormat *fmt = GScreen->format;
+    SDL_Surface *retval = NULL;
+
+    if (TOBY_getSpanFuncs(fmt->BytesPerPixel) == NULL)
+    {
+        retval = SDL_CreateRGBSurface(0, size, size, 32,
+                                      0x0000FF00,  /* red */
+                                      0x00FF0000,  /* green */
+                                      0xFF000000,  /* blue */
+                                      0x000000FF); /* alpha */
+    } /* if */
+    else
+    {
+        retval = SDL_CreateRGBSurface(0, size, size, fmt->BitsPerPixel,
+                                      fmt->Rmask, fmt->Gmask, fmt->Bmask,
+                                      fmt->Amask);
+        if ((retval != NULL) && (fmt->palette != NULL))
+        {
+            SDL_SetColors(retval, fmt->palette->colors, 0,
+                          fmt->palette->ncolors);
+        } /* if */
+    } /* else */
+
+    if (retval == NULL)
+        return NULL;
+
+    SDL_SetAlpha(retval, 0, 0);
+    SDL_FillRect(retval, NULL, SDL_MapRGBA(retval->format, 0, 0, 0, 0xFF));
+
+    if (SDL_MUSTLOCK(retval))
+    {
+        while (SDL_LockSurface(retval) < 0)
+            SDL_Delay(10);
+    } /* if */
+
+    return retval;
+} /* createBacking */
+
+
 static int doProgram(const char *program, int w, int h, Uint32 flags)
 {
     const int size = (h < w) ? h : w;
+    TobyContext *ctx = NULL;
+    Uint32 stoppedTicks = 0;
 
     if (SDL_Init(SDL_INIT_VIDEO) == -1)
     {
@@ -327,39 +522,64 @@ static int doProgram(const char *program, int w, int h, Uint32 flags)
     SDL_FillRect(GScreen, NULL, SDL_MapRGB(GScreen->format, 0, 0, 0));
     SDL_Flip(GScreen);
 
-    GBacking = SDL_CreateRGBSurface(0, size, size, 32,
-                                   0x0000FF00,  /* red */
-                                   0x00FF0000,  /* green */
-                                   0xFF000000,  /* blue */
-                                   0x000000FF); /* alpha */
+    GBacking = createBacking(size);
     if (GBacking == NULL)
     {
         fprintf(stderr, "SDL_CreateRGBSurface() failed: %s\n", SDL_GetError());
         SDL_Quit();
         return 6;
     } /* if */
+    GSpans = TOBY_getSpanFuncs(GBacking->format->BytesPerPixel);
 
-    SDL_SetAlpha(GBacking, 0, 0);
-    SDL_FillRect(GBacking, NULL, SDL_MapRGBA(GBacking->format, 0, 0, 0, 0xFF));
+    GWorker = TOBY_createWorker(&callbacks, NULL);
+    if (GWorker == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        SDL_FreeSurface(GBacking);
+        SDL_Quit();
+        return 8;
+    } /* if */
 
-    if (SDL_MUSTLOCK(GBacking))
+    ctx = TOBY_getWorkerContext(GWorker);
+    if (!TOBY_workerRunProgram(GWorker, program, 0))
     {
-        while (SDL_LockSurface(GBacking) < 0)
-            SDL_Delay(10);
+        fprintf(stderr, "Couldn't start the program.\n");
+        GRequestingQuit = 1;
     } /* if */
 
-    TOBY_runProgram(program, 0);
+    stoppedTicks = SDL_GetTicks();
 
-    if (GDelayAndQuit >= 0)
-        TOBY_delay(GDelayAndQuit);
-    else
+    /* The program runs on its own thread; we just draw what it did. */
+    while (!GRequestingQuit)
     {
-        while (!GRequestingQuit)
-            TOBY_delay(100);
-    } /* else */
+        pumpSDLEvents(ctx);
+        if (TOBY_workerPump(GWorker, 8))
+            stoppedTicks = SDL_GetTicks();
+        else
+        {
+            if (GPendingResize)
+            {
+                resizeBacking(ctx, GPendingResize);
+                GPendingResize = 0;
+                GFullRepaint = 1;
+                tobyhook_putToScreen(ctx);
+            } /* if */
+
+            if (GDelayAndQuit >= 0)
+            {
+                if ((SDL_GetTicks() - stoppedTicks) >= GDelayAndQuit)
+                    break;
+            } /* if */
+        } /* else */
 
+        SDL_Delay(16);  /* about 60 frames a second. */
+    } /* while */
+
+    TOBY_destroyWorker(GWorker);
+    GWorker = NULL;
     SDL_FreeSurface(GBacking);
     GScreen = GBacking = NULL;
+    GSpans = NULL;
 
     SDL_Quit();
     return 0;
@@ -372,6 +592,7 @@ int main(int argc, char **argv)
     int h = 600;
     int set_dimension = 0;
     char *program = NULL;
+    const char *prewarm = NULL;
     Uint32 sdlflags = 0;
     int retval = 0;
     int i = 0;
@@ -408,6 +629,22 @@ int main(int argc, char **argv)
                     h = atoi(arg);
                 } /* if */
             } /* else if */
+            else if (strcmp(arg, "cachedir") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                {
+                    if (!TOBY_setBytecodeCacheDir(arg))
+                    {
+                        fprintf(stderr, "Out of memory.\n");
+                        return 1;
+                    } /* if */
+                } /* if */
+            } /* else if */
+            else if (strcmp(arg, "prewarm") == 0)
+            {
+                if ((arg = argv[++i]) != NULL)
+                    prewarm = arg;
+            } /* else if */
             else if (strcmp(arg, "buildver") == 0)
             {
                 printf("%s\n", GBuildVer);
@@ -433,6 +670,20 @@ int main(int argc, char **argv)
         } /* else */
     } /* for */
 
+    if (prewarm != NULL)
+    {
+        const int rc = TOBY_prewarmBytecodeCache(prewarm);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Couldn't prewarm cache from '%s'.\n", prewarm);
+            free(program);
+            return 7;
+        } /* if */
+        printf("%d programs cached.\n", rc);
+        if (program == NULL)
+            return 0;  /* just warming the cache is fine. */
+    } /* if */
+
     if (program == NULL)
     {
         fprintf(stderr, "No program specified.\n");
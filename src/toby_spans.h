@@ -0,0 +1,358 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * The span functions, for one size of pixel. This is only for
+ *  toby_raster.c, which includes it once per size, like a C++ template:
+ *  define SPAN_BPP as the bytes per pixel (1 to 4) and SPANFN(fn) to
+ *  paste a suffix onto (fn) first. Both are undefined again at the end.
+ *  Channel order doesn't matter here; the pixel values come mapped.
+ */
+
+#if !defined(SPAN_BPP) || !defined(SPANFN)
+#error Define SPAN_BPP and SPANFN before including this.
+#endif
+
+#if SPAN_BPP == 1
+#define SPAN_GET(p) ((unsigned int) *(p))
+#define SPAN_PUT(p, v) *(p) = (unsigned char) (v)
+#elif SPAN_BPP == 2
+#define SPAN_GET(p) ((unsigned int) *((const unsigned short *) (p)))
+#define SPAN_PUT(p, v) *((unsigned short *) (p)) = (unsigned short) (v)
+#elif SPAN_BPP == 3
+#define SPAN_GET(p) get24(p)
+#define SPAN_PUT(p, v) put24(p, v)
+#elif SPAN_BPP == 4
+#define SPAN_GET(p) (*((const unsigned int *) (p)))
+#define SPAN_PUT(p, v) *((unsigned int *) (p)) = (v)
+#else
+#error SPAN_BPP has to be 1, 2, 3 or 4.
+#endif
+
+static inline void SPANFN(putSpan)(unsigned char *p, int count,
+                                   unsigned int pval)
+{
+    #if SPAN_BPP == 4
+    if (count >= SHORT_SPAN)
+    {
+        writeSpan((unsigned int *) p, count, pval);
+        return;
+    } /* if */
+    #elif SPAN_BPP == 1
+    if (count >= SHORT_SPAN)
+    {
+        memset(p, (int) pval, count);
+        return;
+    } /* if */
+    #endif
+
+    for (; count > 0; count--, p += SPAN_BPP)
+        SPAN_PUT(p, pval);
+} /* putSpan */
+
+
+static unsigned long SPANFN(fillRect)(const TobySpanTarget *dst, int x, int y,
+                                      int w, int h, unsigned int pval)
+{
+    unsigned char *p = ((unsigned char *) dst->pixels) +
+                        ((((ptrdiff_t) y) * dst->pitch) + (x * SPAN_BPP));
+    int i;
+    for (i = 0; i < h; i++, p += dst->pitch)
+        SPANFN(putSpan)(p, w, pval);
+    return ((unsigned long) w) * ((unsigned long) h);
+} /* fillRect */
+
+
+/*
+ * This is the Bresenham line that toby_sdl.c has always used (borrowed,
+ *  optimized, and mangled from SGE's DoLine code), and it sets exactly the
+ *  same pixels, but it walks a pointer instead of working out each pixel's
+ *  offset, and writes shallow lines a whole row's run at a time.
+ */
+static unsigned long SPANFN(drawLine)(const TobySpanTarget *dst,
+                                      int x1, int y1, int x2, int y2,
+                                      unsigned int pval)
+{
+    int dx = x2 - x1;
+    int dy = y2 - y1;
+    const int sdx = (dx < 0) ? -SPAN_BPP : SPAN_BPP;  /* in bytes. */
+    const int sdy = (dy < 0) ? -1 : 1;
+    const ptrdiff_t rowstep = ((ptrdiff_t) dst->pitch) * sdy;
+    unsigned char *p = ((unsigned char *) dst->pixels) +
+                        ((((ptrdiff_t) y1) * dst->pitch) + (x1 * SPAN_BPP));
+    int err = 0;
+    int i;
+
+    dx = ((dx < 0) ? -dx : dx) + 1;
+    dy = ((dy < 0) ? -dy : dy) + 1;
+
+    if (dy == 1)  /* horizontal (or a single pixel): one span. */
+        SPANFN(putSpan)((sdx < 0) ? p + ((dx - 1) * sdx) : p, dx, pval);
+
+    else if (dx == 1)  /* vertical. */
+    {
+        for (i = 0; i < dy; i++, p += rowstep)
+            SPAN_PUT(p, pval);
+    } /* else if */
+
+    else if (dy > dx)  /* major axis of Y: one pixel per row. */
+    {
+        int px = 0;
+        for (i = 0; i < dy; i++, p += rowstep)
+        {
+            SPAN_PUT(p + px, pval);
+            err += dx;
+            if (err >= dy)  /* run length completed. */
+            {
+                err -= dy;
+                px += sdx;
+            } /* if */
+        } /* for */
+    } /* else if */
+
+    else if (dx < (dy * 2))  /* close to diagonal: runs are one or two. */
+    {
+        int px = 0;
+        for (i = 0; i < dx; i++, px += sdx)
+        {
+            SPAN_PUT(p + px, pval);
+            err += dy;
+            if (err >= dx)  /* run length completed. */
+            {
+                err -= dx;
+                p += rowstep;
+            } /* if */
+        } /* for */
+    } /* else if */
+
+    else  /* major axis of X: a run of pixels per row. */
+    {
+        /*
+         * Pixel by pixel, the error grows by (dy) and the row changes
+         *  after the pixel that takes it to (dx), so every run is either
+         *  (dx / dy) or one more than that, depending on the error so far.
+         */
+        const int minrun = dx / dy;
+        const int extra = dx % dy;
+        int left = dx;
+        while (left > 0)
+        {
+            int run = minrun;
+            if (err < extra)
+            {
+                run++;
+                err += dy - extra;
+            } /* if */
+            else
+            {
+                err -= extra;
+            } /* else */
+
+            if (run > left)
+                run = left;
+            SPANFN(putSpan)((sdx < 0) ? p + ((run - 1) * sdx) : p, run, pval);
+            p += (run * sdx) + rowstep;
+            left -= run;
+        } /* while */
+    } /* else */
+
+    return (unsigned long) ((dx >= dy) ? dx : dy);
+} /* drawLine */
+
+
+/*
+ * Even-odd scanline fill. Each row is sampled through the middle of its
+ *  pixels, like fillTriangle(). Edges are sorted by their top, so each row
+ *  only looks at the edges that cross it.
+ */
+static unsigned long SPANFN(fillPolygon)(const TobySpanTarget *dst,
+                                         const TurtlePoint *pts, int count,
+                                         unsigned int pval)
+{
+    const int w = dst->w;
+    const int h = dst->h;
+    unsigned long retval = 0;
+    SpanEdge *edges = NULL;
+    int *active = NULL;
+    lua_Number *xs = NULL;
+    int total, y, ystart, yend;
+    int activeCount = 0;
+    int next = 0;
+    int i;
+
+    if (count < 3)
+        return 0;
+
+    edges = (SpanEdge *) malloc(sizeof (SpanEdge) * count);
+    active = (int *) malloc(sizeof (int) * count);
+    xs = (lua_Number *) malloc(sizeof (lua_Number) * count);
+    if ((edges == NULL) || (active == NULL) || (xs == NULL))
+        goto fillPolygonDone;
+
+    total = buildSpanEdges(pts, count, edges, h, &ystart, &yend);
+
+    for (y = ystart; y <= yend; y++)
+    {
+        const lua_Number cy = ((lua_Number) y) + ((lua_Number) 0.5);
+        unsigned char *row = ((unsigned char *) dst->pixels) +
+                                (((ptrdiff_t) y) * dst->pitch);
+        int crossings = 0;
+
+        while ((next < total) && (edges[next].y1 <= cy))
+            active[activeCount++] = next++;
+
+        for (i = 0; i < activeCount; i++)
+        {
+            const SpanEdge *edge = &edges[active[i]];
+            lua_Number ex;
+            int j;
+
+            if (edge->y2 <= cy)  /* done with this one. */
+            {
+                active[i--] = active[--activeCount];
+                continue;
+            } /* if */
+
+            ex = edge->x1 + ((cy - edge->y1) * edge->slope);
+            for (j = crossings++; (j > 0) && (xs[j - 1] > ex); j--)
+                xs[j] = xs[j - 1];  /* insertion sort; there are few. */
+            xs[j] = ex;
+        } /* for */
+
+        for (i = 0; i + 1 < crossings; i += 2)
+        {
+            const lua_Number minx = xs[i];
+            const lua_Number maxx = xs[i + 1];
+            int xstart, xend;
+            if (!(maxx >= N(0)) || !(minx < (lua_Number) w))
+                continue;  /* written this way so NaN is skipped, too. */
+            xstart = (minx < N(0)) ? 0 : (int) minx;
+            xend = (maxx >= (lua_Number) w) ? w - 1 : (int) maxx;
+            retval += (unsigned long) ((xend - xstart) + 1);
+            SPANFN(putSpan)(row + (xstart * SPAN_BPP), (xend - xstart) + 1,
+                            pval);
+        } /* for */
+    } /* for */
+
+fillPolygonDone:
+    free(xs);
+    free(active);
+    free(edges);
+    return retval;
+} /* fillPolygon */
+
+
+/*
+ * Span flood fill: fill the whole run of matching pixels on a row at once,
+ *  then remember one seed per matching run on the rows above and below it.
+ */
+static unsigned long SPANFN(floodFill)(const TobySpanTarget *dst, int x,
+                                       int y, unsigned int pval)
+{
+    const int w = dst->w;
+    const int h = dst->h;
+    const ptrdiff_t pitch = (ptrdiff_t) dst->pitch;
+    unsigned char *pixels = (unsigned char *) dst->pixels;
+    unsigned int target;
+    unsigned long retval = 0;
+    SpanSeed *stack = NULL;
+    int stackCount = 0;
+    int stackAllocated = 0;
+
+    if ((x < 0) || (y < 0) || (x >= w) || (y >= h))
+        return 0;
+
+    target = SPAN_GET(pixels + (y * pitch) + (x * SPAN_BPP));
+    if (target == pval)
+        return 0;  /* already done, and we'd never stop otherwise. */
+
+    stackAllocated = 256;
+    stack = (SpanSeed *) malloc(sizeof (SpanSeed) * stackAllocated);
+    if (stack == NULL)
+        return 0;
+
+    stack[stackCount].x = x;
+    stack[stackCount].y = y;
+    stackCount++;
+
+    while (stackCount > 0)
+    {
+        unsigned char *row;
+        int left, right, i, dir;
+
+        stackCount--;
+        x = stack[stackCount].x;
+        y = stack[stackCount].y;
+        row = pixels + (y * pitch);
+        if (SPAN_GET(row + (x * SPAN_BPP)) != target)
+            continue;  /* filled since this was pushed. */
+
+        left = right = x;
+        while ((left > 0) &&
+               (SPAN_GET(row + ((left - 1) * SPAN_BPP)) == target))
+            left--;
+        while ((right < w - 1) &&
+               (SPAN_GET(row + ((right + 1) * SPAN_BPP)) == target))
+            right++;
+
+        SPANFN(putSpan)(row + (left * SPAN_BPP), (right - left) + 1, pval);
+        retval += (unsigned long) ((right - left) + 1);
+
+        for (dir = -1; dir <= 1; dir += 2)
+        {
+            const int ny = y + dir;
+            const unsigned char *nrow = pixels + (((ptrdiff_t) ny) * pitch);
+            int inrun = 0;
+            if ((ny < 0) || (ny >= h))
+                continue;
+
+            for (i = left; i <= right; i++)
+            {
+                if (SPAN_GET(nrow + (i * SPAN_BPP)) != target)
+                    inrun = 0;
+                else if (!inrun)
+                {
+                    inrun = 1;
+                    if (stackCount == stackAllocated)
+                    {
+                        const int newalloc = stackAllocated * 2;
+                        void *ptr = realloc(stack,
+                                            sizeof (SpanSeed) * newalloc);
+                        if (ptr == NULL)
+                            goto floodFillDone;  /* oh well. */
+                        stack = (SpanSeed *) ptr;
+                        stackAllocated = newalloc;
+                    } /* if */
+                    stack[stackCount].x = i;
+                    stack[stackCount].y = ny;
+                    stackCount++;
+                } /* else if */
+            } /* for */
+        } /* for */
+    } /* while */
+
+floodFillDone:
+    free(stack);
+    return retval;
+} /* floodFill */
+
+
+static const TobySpanFuncs SPANFN(spanFuncs) =
+{
+    SPANFN(fillRect),
+    SPANFN(drawLine),
+    SPANFN(fillPolygon),
+    SPANFN(floodFill)
+};
+
+#undef SPAN_GET
+#undef SPAN_PUT
+#undef SPAN_BPP
+#undef SPANFN
+
+/* end of toby_spans.h ... */
@@ -0,0 +1,353 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+#include <stdlib.h>
+
+#if PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+#include "toby_thread.h"
+
+#if PLATFORM_WINDOWS
+
+struct TobyThread
+{
+    HANDLE handle;
+    TobyThreadFn fn;
+    void *data;
+};
+
+struct TobyEvent
+{
+    HANDLE handle;
+};
+
+struct TobyMutex
+{
+    CRITICAL_SECTION cs;
+};
+
+static DWORD WINAPI threadEntry(LPVOID arg)
+{
+    TobyThread *thread = (TobyThread *) arg;
+    thread->fn(thread->data);
+    return 0;
+} /* threadEntry */
+
+
+TobyThread *TOBY_createThread(TobyThreadFn fn, void *data)
+{
+    TobyThread *retval = (TobyThread *) malloc(sizeof (TobyThread));
+    if (retval != NULL)
+    {
+        retval->fn = fn;
+        retval->data = data;
+        retval->handle = CreateThread(NULL, 0, threadEntry, retval, 0, NULL);
+        if (retval->handle == NULL)
+        {
+            free(retval);
+            retval = NULL;
+        } /* if */
+    } /* if */
+    return retval;
+} /* TOBY_createThread */
+
+
+void TOBY_waitThread(TobyThread *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+} /* TOBY_waitThread */
+
+
+TobyEvent *TOBY_createEvent(void)
+{
+    TobyEvent *retval = (TobyEvent *) malloc(sizeof (TobyEvent));
+    if (retval != NULL)
+    {
+        retval->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (retval->handle == NULL)
+        {
+            free(retval);
+            retval = NULL;
+        } /* if */
+    } /* if */
+    return retval;
+} /* TOBY_createEvent */
+
+
+void TOBY_destroyEvent(TobyEvent *event)
+{
+    CloseHandle(event->handle);
+    free(event);
+} /* TOBY_destroyEvent */
+
+
+void TOBY_signalEvent(TobyEvent *event)
+{
+    SetEvent(event->handle);
+} /* TOBY_signalEvent */
+
+
+int TOBY_waitEvent(TobyEvent *event, long ms)
+{
+    return (WaitForSingleObject(event->handle, (DWORD) ms) == WAIT_OBJECT_0);
+} /* TOBY_waitEvent */
+
+
+TobyMutex *TOBY_createMutex(void)
+{
+    TobyMutex *retval = (TobyMutex *) malloc(sizeof (TobyMutex));
+    if (retval != NULL)
+        InitializeCriticalSection(&retval->cs);
+    return retval;
+} /* TOBY_createMutex */
+
+
+void TOBY_destroyMutex(TobyMutex *mutex)
+{
+    DeleteCriticalSection(&mutex->cs);
+    free(mutex);
+} /* TOBY_destroyMutex */
+
+
+void TOBY_lockMutex(TobyMutex *mutex)
+{
+    EnterCriticalSection(&mutex->cs);
+} /* TOBY_lockMutex */
+
+
+void TOBY_unlockMutex(TobyMutex *mutex)
+{
+    LeaveCriticalSection(&mutex->cs);
+} /* TOBY_unlockMutex */
+
+
+int TOBY_getCPUCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (info.dwNumberOfProcessors > 0)
+        return (int) info.dwNumberOfProcessors;
+    return 1;
+} /* TOBY_getCPUCount */
+
+
+unsigned int TOBY_atomicGet(volatile unsigned int *ptr)
+{
+    const unsigned int retval = *ptr;
+    MemoryBarrier();
+    return retval;
+} /* TOBY_atomicGet */
+
+
+void TOBY_atomicSet(volatile unsigned int *ptr, unsigned int val)
+{
+    MemoryBarrier();
+    *ptr = val;
+} /* TOBY_atomicSet */
+
+#else  /* pthreads. */
+
+struct TobyThread
+{
+    pthread_t thread;
+    TobyThreadFn fn;
+    void *data;
+};
+
+struct TobyEvent
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int signaled;
+};
+
+struct TobyMutex
+{
+    pthread_mutex_t mutex;
+};
+
+static void *threadEntry(void *arg)
+{
+    TobyThread *thread = (TobyThread *) arg;
+    thread->fn(thread->data);
+    return NULL;
+} /* threadEntry */
+
+
+TobyThread *TOBY_createThread(TobyThreadFn fn, void *data)
+{
+    TobyThread *retval = (TobyThread *) malloc(sizeof (TobyThread));
+    if (retval != NULL)
+    {
+        retval->fn = fn;
+        retval->data = data;
+        if (pthread_create(&retval->thread, NULL, threadEntry, retval) != 0)
+        {
+            free(retval);
+            retval = NULL;
+        } /* if */
+    } /* if */
+    return retval;
+} /* TOBY_createThread */
+
+
+void TOBY_waitThread(TobyThread *thread)
+{
+    pthread_join(thread->thread, NULL);
+    free(thread);
+} /* TOBY_waitThread */
+
+
+TobyEvent *TOBY_createEvent(void)
+{
+    TobyEvent *retval = (TobyEvent *) malloc(sizeof (TobyEvent));
+    if (retval != NULL)
+    {
+        retval->signaled = 0;
+        if (pthread_mutex_init(&retval->mutex, NULL) != 0)
+        {
+            free(retval);
+            return NULL;
+        } /* if */
+
+        if (pthread_cond_init(&retval->cond, NULL) != 0)
+        {
+            pthread_mutex_destroy(&retval->mutex);
+            free(retval);
+            return NULL;
+        } /* if */
+    } /* if */
+    return retval;
+} /* TOBY_createEvent */
+
+
+void TOBY_destroyEvent(TobyEvent *event)
+{
+    pthread_cond_destroy(&event->cond);
+    pthread_mutex_destroy(&event->mutex);
+    free(event);
+} /* TOBY_destroyEvent */
+
+
+void TOBY_signalEvent(TobyEvent *event)
+{
+    pthread_mutex_lock(&event->mutex);
+    event->signaled = 1;
+    pthread_cond_signal(&event->cond);
+    pthread_mutex_unlock(&event->mutex);
+} /* TOBY_signalEvent */
+
+
+int TOBY_waitEvent(TobyEvent *event, long ms)
+{
+    struct timeval now;
+    struct timespec timeout;
+    int rc = 0;
+    int retval;
+
+    gettimeofday(&now, NULL);
+    timeout.tv_sec = now.tv_sec + (ms / 1000);
+    timeout.tv_nsec = (now.tv_usec * 1000) + ((ms % 1000) * 1000000);
+    if (timeout.tv_nsec >= 1000000000)
+    {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000;
+    } /* if */
+
+    pthread_mutex_lock(&event->mutex);
+    while ((!event->signaled) && (rc == 0))  /* rc is ETIMEDOUT at the end. */
+        rc = pthread_cond_timedwait(&event->cond, &event->mutex, &timeout);
+    retval = event->signaled;
+    event->signaled = 0;
+    pthread_mutex_unlock(&event->mutex);
+
+    return retval;
+} /* TOBY_waitEvent */
+
+
+TobyMutex *TOBY_createMutex(void)
+{
+    TobyMutex *retval = (TobyMutex *) malloc(sizeof (TobyMutex));
+    if ((retval != NULL) && (pthread_mutex_init(&retval->mutex, NULL) != 0))
+    {
+        free(retval);
+        retval = NULL;
+    } /* if */
+    return retval;
+} /* TOBY_createMutex */
+
+
+void TOBY_destroyMutex(TobyMutex *mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+} /* TOBY_destroyMutex */
+
+
+void TOBY_lockMutex(TobyMutex *mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+} /* TOBY_lockMutex */
+
+
+void TOBY_unlockMutex(TobyMutex *mutex)
+{
+    pthread_mutex_unlock(&mutex->mutex);
+} /* TOBY_unlockMutex */
+
+
+int TOBY_getCPUCount(void)
+{
+    #ifdef _SC_NPROCESSORS_ONLN
+    const long rc = sysconf(_SC_NPROCESSORS_ONLN);
+    if (rc > 0)
+        return (int) rc;
+    #endif
+    return 1;
+} /* TOBY_getCPUCount */
+
+
+#if defined(__GNUC__)
+#define memoryBarrier() __sync_synchronize()
+#else
+/* Locking a mutex is a full barrier everywhere pthreads is. Slow, but safe. */
+static pthread_mutex_t barrierMutex = PTHREAD_MUTEX_INITIALIZER;
+static void memoryBarrier(void)
+{
+    pthread_mutex_lock(&barrierMutex);
+    pthread_mutex_unlock(&barrierMutex);
+} /* memoryBarrier */
+#endif
+
+unsigned int TOBY_atomicGet(volatile unsigned int *ptr)
+{
+    const unsigned int retval = *ptr;
+    memoryBarrier();
+    return retval;
+} /* TOBY_atomicGet */
+
+
+void TOBY_atomicSet(volatile unsigned int *ptr, unsigned int val)
+{
+    memoryBarrier();
+    *ptr = val;
+} /* TOBY_atomicSet */
+
+#endif
+
+/* end of toby_thread.c ... */
+
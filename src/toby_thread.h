@@ -0,0 +1,67 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * Just enough threading for the backend. This wraps pthreads or Win32,
+ *  depending on the platform.
+ */
+
+#ifndef _INCL_TOBY_THREAD_H_
+#define _INCL_TOBY_THREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TobyThread TobyThread;
+typedef struct TobyEvent TobyEvent;
+typedef struct TobyMutex TobyMutex;
+
+typedef void (*TobyThreadFn)(void *data);
+
+/* Start (fn) on a new thread. Returns NULL on failure. */
+TobyThread *TOBY_createThread(TobyThreadFn fn, void *data);
+
+/* Block until (thread) returns, then free it. */
+void TOBY_waitThread(TobyThread *thread);
+
+/*
+ * An auto-reset event: TOBY_waitEvent() returns non-zero and clears the
+ *  event if it was signaled within (ms) milliseconds, or zero on timeout.
+ */
+TobyEvent *TOBY_createEvent(void);
+void TOBY_destroyEvent(TobyEvent *event);
+void TOBY_signalEvent(TobyEvent *event);
+int TOBY_waitEvent(TobyEvent *event, long ms);
+
+/* A plain, non-recursive mutex. */
+TobyMutex *TOBY_createMutex(void);
+void TOBY_destroyMutex(TobyMutex *mutex);
+void TOBY_lockMutex(TobyMutex *mutex);
+void TOBY_unlockMutex(TobyMutex *mutex);
+
+/* Number of CPU cores available to the process; at least 1. */
+int TOBY_getCPUCount(void);
+
+/*
+ * Read or write an unsigned int such that everything one thread wrote
+ *  before a TOBY_atomicSet() is visible to another thread once
+ *  TOBY_atomicGet() returns the new value. That's all a single-producer,
+ *  single-consumer queue needs.
+ */
+unsigned int TOBY_atomicGet(volatile unsigned int *ptr);
+void TOBY_atomicSet(volatile unsigned int *ptr, unsigned int val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of toby_thread.h ... */
+
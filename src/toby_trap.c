@@ -0,0 +1,214 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * Breakpoints, done as OP_TRAP instructions patched over the first
+ *  instruction of each run of code on a line. The VM hands trapped
+ *  instructions to trapReached(), which reports the line and gives back the
+ *  original instruction to execute, so lines without a breakpoint don't
+ *  cost anything at all.
+ */
+
+#include <stdlib.h>
+
+#include "toby_compiler.h"
+
+#include "ldebug.h"
+#include "lobject.h"
+#include "lfunc.h"
+#include "lopcodes.h"
+#include "lstate.h"
+
+typedef struct TobyTrap
+{
+    Proto *proto;
+    int pc;
+    int line;
+    Instruction original;
+} TobyTrap;
+
+typedef struct TobyTraps
+{
+    TobyTrapCallback callback;
+    Proto *program;
+    TobyTrap *traps;
+    int count;
+    int allocated;
+} TobyTraps;
+
+/* the program's main function lives here, so its code can't go away. */
+static const char *programRegistryKey = "toby.program";
+
+
+static inline TobyTraps *getTraps(lua_State *L)
+{
+    return (TobyTraps *) G(L)->trapud;
+} /* getTraps */
+
+
+static Instruction trapReached(lua_State *L, const Instruction *pc)
+{
+    const TobyTraps *traps = getTraps(L);
+    int i;
+
+    for (i = 0; i < traps->count; i++)
+    {
+        const TobyTrap *trap = &traps->traps[i];
+        if (&trap->proto->code[trap->pc] == pc)
+        {
+            /* callback might clear this trap, so grab what we need now. */
+            const Instruction original = trap->original;
+            traps->callback(L, trap->line);
+            return original;
+        } /* if */
+    } /* for */
+
+    lua_assert(0 && "OP_TRAP without a trap");
+    luaG_runerror(L, "unknown breakpoint");
+    return 0;  /* shouldn't hit this. */
+} /* trapReached */
+
+
+int TOBY_attachTraps(lua_State *L, int idx, TobyTrapCallback callback)
+{
+    const Closure *cl;
+    TobyTraps *traps;
+
+    lua_assert(getTraps(L) == NULL);
+    if ((!lua_isfunction(L, idx)) || (lua_iscfunction(L, idx)))
+        return 0;
+    cl = (const Closure *) lua_topointer(L, idx);
+
+    traps = (TobyTraps *) calloc(1, sizeof (TobyTraps));
+    if (traps == NULL)
+        return 0;
+
+    traps->callback = callback;
+    traps->program = cl->l.p;
+    lua_pushvalue(L, idx);
+    lua_setfield(L, LUA_REGISTRYINDEX, programRegistryKey);
+
+    G(L)->trapud = traps;
+    G(L)->trap = trapReached;
+    return 1;
+} /* TOBY_attachTraps */
+
+
+void TOBY_detachTraps(lua_State *L)
+{
+    TobyTraps *traps = getTraps(L);
+    if (traps != NULL)
+    {
+        TOBY_clearAllTraps(L);
+        free(traps->traps);
+        free(traps);
+        G(L)->trap = NULL;
+        G(L)->trapud = NULL;
+        lua_pushnil(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, programRegistryKey);
+    } /* if */
+} /* TOBY_detachTraps */
+
+
+static int isTrapped(const TobyTraps *traps, const Proto *f, int pc)
+{
+    int i;
+    for (i = 0; i < traps->count; i++)
+    {
+        if ((traps->traps[i].proto == f) && (traps->traps[i].pc == pc))
+            return 1;
+    } /* for */
+    return 0;
+} /* isTrapped */
+
+
+static int setTraps(TobyTraps *traps, Proto *f, int line)
+{
+    int retval = 0;
+    int pc;
+
+    for (pc = 0; pc < f->sizecode; pc++)
+    {
+        if (f->lineinfo[pc] != line)
+            continue;
+        else if ((pc > 0) && (f->lineinfo[pc-1] == line))
+            continue;  /* not the start of a run of this line's code. */
+        else if ((pc > 0) && (testTMode(GET_OPCODE(f->code[pc-1]))))
+            continue;  /* the VM reads this jump directly; leave it alone. */
+        else if (isTrapped(traps, f, pc))
+            continue;
+
+        if (traps->count >= traps->allocated)
+        {
+            const int newalloc = (traps->allocated + 1) * 2;
+            void *ptr = realloc(traps->traps, sizeof (TobyTrap) * newalloc);
+            if (ptr == NULL)
+                return -1;
+            traps->traps = (TobyTrap *) ptr;
+            traps->allocated = newalloc;
+        } /* if */
+
+        traps->traps[traps->count].proto = f;
+        traps->traps[traps->count].pc = pc;
+        traps->traps[traps->count].line = line;
+        traps->traps[traps->count].original = f->code[pc];
+        traps->count++;
+        f->code[pc] = CREATE_ABx(OP_TRAP, 0, 0);
+        retval++;
+    } /* for */
+
+    for (pc = 0; pc < f->sizep; pc++)
+    {
+        const int rc = setTraps(traps, f->p[pc], line);
+        if (rc < 0)
+            return -1;
+        retval += rc;
+    } /* for */
+
+    return retval;
+} /* setTraps */
+
+
+int TOBY_setLineTraps(lua_State *L, int line)
+{
+    TobyTraps *traps = getTraps(L);
+    if (traps == NULL)
+        return 0;
+    return setTraps(traps, traps->program, line);
+} /* TOBY_setLineTraps */
+
+
+void TOBY_clearLineTraps(lua_State *L, int line)
+{
+    TobyTraps *traps = getTraps(L);
+    int i = 0;
+
+    if (traps == NULL)
+        return;
+
+    while (i < traps->count)
+    {
+        TobyTrap *trap = &traps->traps[i];
+        if ((line >= 0) && (trap->line != line))
+            i++;
+        else
+        {
+            trap->proto->code[trap->pc] = trap->original;
+            *trap = traps->traps[--traps->count];
+        } /* else */
+    } /* while */
+} /* TOBY_clearLineTraps */
+
+
+void TOBY_clearAllTraps(lua_State *L)
+{
+    TOBY_clearLineTraps(L, -1);
+} /* TOBY_clearAllTraps */
+
+/* end of toby_trap.c ... */
+
@@ -0,0 +1,815 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "toby_worker.h"
+#include "toby_thread.h"
+
+/* Must be a power of two. Line commands carry up to a batch of segments. */
+#define RING_SIZE 1024
+
+/* How often, in commands, TOBY_workerPump() checks the clock. */
+#define PUMP_CLOCK_CHECK 64
+
+typedef enum WorkerCommandType
+{
+    WORKERCMD_STARTRUN,
+    WORKERCMD_STOPRUN,
+    WORKERCMD_PUTTOSCREEN,
+    WORKERCMD_MESSAGEBOX,
+    WORKERCMD_DRAWLINES,
+    WORKERCMD_DRAWPOINTS,
+    WORKERCMD_DRAWSTRING,
+    WORKERCMD_DRAWTURTLE,
+    WORKERCMD_TURTLES,
+    WORKERCMD_FILLPOLYGON,
+    WORKERCMD_FLOODFILL,
+    WORKERCMD_CLEANUP,
+    WORKERCMD_PAUSEREACHED,
+    WORKERCMD_DONE,
+} WorkerCommandType;
+
+/* Pointers in here are malloc()'d by the program's thread, freed by the UI. */
+typedef struct WorkerCommand
+{
+    WorkerCommandType type;
+    union
+    {
+        struct { TobyLineSegment *segs; int count; } lines;
+        struct { TobyPoint *pts; int count; } points;
+        struct { lua_Number x, y, angle; char *str; int r, g, b; } string;
+        struct { Turtle *turtles; int count; } turtles;
+        struct { TurtlePoint *pts; int count, r, g, b; } polygon;
+        struct { lua_Number x, y; int r, g, b; } floodfill;
+        struct { int r, g, b; } cleanup;
+        struct { int line, fullstop, breakpoint, ticks; } pause;
+        struct { TobyRect rect; int dirty; } present;
+        char *message;
+    } u;
+} WorkerCommand;
+
+struct TobyWorker
+{
+    TobyCallbacks callbacks;  /* the UI's. */
+    void *userdata;
+    TobyContext *ctx;
+    TobyThread *thread;
+    TobyEvent *handled;  /* signaled when a command the program waits on is done. */
+    char *source;
+    int runForPrinting;
+
+    /*
+     * The ring. Only the program's thread writes (tail), only the UI (head).
+     *  They only ever count up, and are unsigned so they can wrap around.
+     */
+    WorkerCommand ring[RING_SIZE];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+
+    /* Program's thread only: turtles that changed in the next frame. */
+    Turtle *gathering;
+    int gatheringCount;
+    int gatheringAllocated;
+
+    /* UI thread only. */
+    Turtle *turtles;  /* all of them, by index, as of the last frame. */
+    int turtleCount;
+    int turtlesAllocated;
+    int running;
+    int pumping;
+    int presenting;  /* in the putToScreen callback. */
+    int dirty;  /* (dirtyRect) is set. */
+    TobyRect dirtyRect;
+    int direct;  /* replaying on the UI thread: skip the ring. */
+};
+
+
+/* Program's thread: wait for room, then publish (cmd). */
+static void pushCommand(TobyWorker *worker, const WorkerCommand *cmd)
+{
+    const unsigned int tail = worker->tail;  /* only we write it. */
+    while ((tail - TOBY_atomicGet(&worker->head)) >= RING_SIZE)
+        worker->callbacks.yieldCPU(worker->ctx, 1);  /* UI is behind. */
+    memcpy(&worker->ring[tail & (RING_SIZE - 1)], cmd, sizeof (*cmd));
+    TOBY_atomicSet(&worker->tail, tail + 1);
+} /* pushCommand */
+
+
+/* Program's thread: publish (cmd) and block until the UI has handled it. */
+static void pushCommandAndWait(TobyWorker *worker, const WorkerCommand *cmd)
+{
+    pushCommand(worker, cmd);
+    while (!TOBY_waitEvent(worker->handled, 100))
+        { /* spin. */ }
+} /* pushCommandAndWait */
+
+
+/* UI thread: take the oldest command, if there is one. */
+static int popCommand(TobyWorker *worker, WorkerCommand *cmd)
+{
+    const unsigned int head = worker->head;  /* only we write it. */
+    if (head == TOBY_atomicGet(&worker->tail))
+        return 0;
+    memcpy(cmd, &worker->ring[head & (RING_SIZE - 1)], sizeof (*cmd));
+    TOBY_atomicSet(&worker->head, head + 1);
+    return 1;
+} /* popCommand */
+
+
+static void pushSimpleCommand(TobyWorker *worker, WorkerCommandType type)
+{
+    WorkerCommand cmd;
+    cmd.type = type;
+    pushCommand(worker, &cmd);
+} /* pushSimpleCommand */
+
+
+static char *copyString(const char *str)
+{
+    char *retval = (char *) malloc(strlen(str) + 1);
+    if (retval != NULL)
+        strcpy(retval, str);
+    return retval;
+} /* copyString */
+
+
+static inline TobyWorker *getWorker(TobyContext *ctx)
+{
+    return (TobyWorker *) TOBY_getContextUserData(ctx);
+} /* getWorker */
+
+
+/*
+ * These are the callbacks the context actually gets, on the program's
+ *  thread. They just queue up commands for the UI. If an allocation fails,
+ *  that bit of drawing is lost; there's no good way to report it here.
+ */
+
+static void workerhook_startRun(TobyContext *ctx)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+    cmd.type = WORKERCMD_STARTRUN;
+    pushCommandAndWait(worker, &cmd);
+} /* workerhook_startRun */
+
+
+static void workerhook_stopRun(TobyContext *ctx)
+{
+    pushSimpleCommand(getWorker(ctx), WORKERCMD_STOPRUN);
+} /* workerhook_stopRun */
+
+
+static void workerhook_pumpEvents(TobyContext *ctx)
+{
+    /* no-op: the UI runs its own event loop. */
+} /* workerhook_pumpEvents */
+
+
+static void workerhook_drawTurtle(TobyContext *ctx, const Turtle *turtle,
+                                  void *data)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.drawTurtle(ctx, turtle, data);
+        return;
+    } /* if */
+
+    else if (data == worker)  /* gathering turtles for a new frame. */
+    {
+        if (worker->gatheringCount == worker->gatheringAllocated)
+        {
+            const int total = (worker->gatheringAllocated * 2) + 4;
+            void *ptr = realloc(worker->gathering, sizeof (Turtle) * total);
+            if (ptr == NULL)
+                return;
+            worker->gathering = (Turtle *) ptr;
+            worker->gatheringAllocated = total;
+        } /* if */
+        worker->gathering[worker->gatheringCount++] = *turtle;
+        return;
+    } /* else if */
+
+    /* Otherwise, it's going to the backing store. */
+    cmd.type = WORKERCMD_DRAWTURTLE;
+    cmd.u.turtles.count = 1;
+    cmd.u.turtles.turtles = (Turtle *) malloc(sizeof (Turtle));
+    if (cmd.u.turtles.turtles != NULL)
+    {
+        *cmd.u.turtles.turtles = *turtle;
+        pushCommand(worker, &cmd);
+    } /* if */
+} /* workerhook_drawTurtle */
+
+
+static void workerhook_putToScreen(TobyContext *ctx)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.putToScreen(ctx);
+        return;
+    } /* if */
+
+    /*
+     * The UI draws turtles on top of the frame whenever it repaints, and it
+     *  can't look at the program's turtles while they move, so send along
+     *  a copy of the ones that changed since the last frame.
+     */
+    worker->gatheringCount = 0;
+    TOBY_renderChangedTurtles(ctx, worker);  /* see workerhook_drawTurtle(). */
+
+    cmd.type = WORKERCMD_TURTLES;
+    cmd.u.turtles.count = worker->gatheringCount;
+    cmd.u.turtles.turtles = NULL;
+    if (worker->gatheringCount > 0)
+    {
+        const size_t len = sizeof (Turtle) * worker->gatheringCount;
+        cmd.u.turtles.turtles = (Turtle *) malloc(len);
+        if (cmd.u.turtles.turtles == NULL)
+            cmd.u.turtles.count = 0;
+        else
+            memcpy(cmd.u.turtles.turtles, worker->gathering, len);
+    } /* if */
+    pushCommand(worker, &cmd);
+
+    cmd.type = WORKERCMD_PUTTOSCREEN;
+    cmd.u.present.dirty = TOBY_getDirtyRect(ctx, &cmd.u.present.rect);
+    pushCommand(worker, &cmd);
+} /* workerhook_putToScreen */
+
+
+static void workerhook_messageBox(TobyContext *ctx, const char *msg)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+    cmd.type = WORKERCMD_MESSAGEBOX;
+    cmd.u.message = copyString(msg);
+    if (cmd.u.message != NULL)
+        pushCommand(worker, &cmd);
+} /* workerhook_messageBox */
+
+
+static void workerhook_drawLines(TobyContext *ctx, const TobyLineSegment *segs,
+                                 int count)
+{
+    TobyWorker *worker = getWorker(ctx);
+    const size_t len = sizeof (TobyLineSegment) * count;
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.drawLines(ctx, segs, count);
+        return;
+    } /* if */
+
+    cmd.type = WORKERCMD_DRAWLINES;
+    cmd.u.lines.count = count;
+    cmd.u.lines.segs = (TobyLineSegment *) malloc(len);
+    if (cmd.u.lines.segs != NULL)
+    {
+        memcpy(cmd.u.lines.segs, segs, len);
+        pushCommand(worker, &cmd);
+    } /* if */
+} /* workerhook_drawLines */
+
+
+static void workerhook_drawPoints(TobyContext *ctx, const TobyPoint *pts,
+                                  int count)
+{
+    TobyWorker *worker = getWorker(ctx);
+    const size_t len = sizeof (TobyPoint) * count;
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.drawPoints(ctx, pts, count);
+        return;
+    } /* if */
+
+    cmd.type = WORKERCMD_DRAWPOINTS;
+    cmd.u.points.count = count;
+    cmd.u.points.pts = (TobyPoint *) malloc(len);
+    if (cmd.u.points.pts != NULL)
+    {
+        memcpy(cmd.u.points.pts, pts, len);
+        pushCommand(worker, &cmd);
+    } /* if */
+} /* workerhook_drawPoints */
+
+
+static int workerhook_drawString(TobyContext *ctx, lua_Number x, lua_Number y,
+                                 const char *utf8str, lua_Number angle,
+                                 int r, int g, int b)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.drawString(ctx, x, y, utf8str, angle, r, g, b);
+        return 1;
+    } /* if */
+
+    cmd.type = WORKERCMD_DRAWSTRING;
+    cmd.u.string.x = x;
+    cmd.u.string.y = y;
+    cmd.u.string.angle = angle;
+    cmd.u.string.r = r;
+    cmd.u.string.g = g;
+    cmd.u.string.b = b;
+    cmd.u.string.str = copyString(utf8str);
+    if (cmd.u.string.str != NULL)
+        pushCommand(worker, &cmd);
+    return 1;
+} /* workerhook_drawString */
+
+
+static void workerhook_fillPolygon(TobyContext *ctx, const TurtlePoint *pts,
+                                   int count, int r, int g, int b)
+{
+    TobyWorker *worker = getWorker(ctx);
+    const size_t len = sizeof (TurtlePoint) * count;
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.fillPolygon(ctx, pts, count, r, g, b);
+        return;
+    } /* if */
+
+    cmd.type = WORKERCMD_FILLPOLYGON;
+    cmd.u.polygon.count = count;
+    cmd.u.polygon.r = r;
+    cmd.u.polygon.g = g;
+    cmd.u.polygon.b = b;
+    cmd.u.polygon.pts = (TurtlePoint *) malloc(len);
+    if (cmd.u.polygon.pts != NULL)
+    {
+        memcpy(cmd.u.polygon.pts, pts, len);
+        pushCommand(worker, &cmd);
+    } /* if */
+} /* workerhook_fillPolygon */
+
+
+static int workerhook_floodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                                int r, int g, int b)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.floodFill(ctx, x, y, r, g, b);
+        return 1;
+    } /* if */
+
+    cmd.type = WORKERCMD_FLOODFILL;
+    cmd.u.floodfill.x = x;
+    cmd.u.floodfill.y = y;
+    cmd.u.floodfill.r = r;
+    cmd.u.floodfill.g = g;
+    cmd.u.floodfill.b = b;
+    pushCommand(worker, &cmd);
+    return 1;
+} /* workerhook_floodFill */
+
+
+static void workerhook_cleanup(TobyContext *ctx, int r, int g, int b)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+
+    if (worker->direct)
+    {
+        worker->callbacks.cleanup(ctx, r, g, b);
+        return;
+    } /* if */
+
+    cmd.type = WORKERCMD_CLEANUP;
+    cmd.u.cleanup.r = r;
+    cmd.u.cleanup.g = g;
+    cmd.u.cleanup.b = b;
+    pushCommand(worker, &cmd);
+} /* workerhook_cleanup */
+
+
+static void workerhook_pauseReached(TobyContext *ctx, int line, int fullstop,
+                                    int breakpoint, int pauseTicks)
+{
+    TobyWorker *worker = getWorker(ctx);
+    WorkerCommand cmd;
+    cmd.type = WORKERCMD_PAUSEREACHED;
+    cmd.u.pause.line = line;
+    cmd.u.pause.fullstop = fullstop;
+    cmd.u.pause.breakpoint = breakpoint;
+    cmd.u.pause.ticks = pauseTicks;
+    pushCommandAndWait(worker, &cmd);
+} /* workerhook_pauseReached */
+
+
+static long workerhook_getTicks(TobyContext *ctx)
+{
+    return getWorker(ctx)->callbacks.getTicks(ctx);
+} /* workerhook_getTicks */
+
+
+static void workerhook_yieldCPU(TobyContext *ctx, int ms)
+{
+    getWorker(ctx)->callbacks.yieldCPU(ctx, ms);
+} /* workerhook_yieldCPU */
+
+
+static const TobyCallbacks workerCallbacks =
+{
+    workerhook_startRun,
+    workerhook_stopRun,
+    workerhook_pumpEvents,
+    workerhook_putToScreen,
+    workerhook_messageBox,
+    workerhook_drawLines,
+    workerhook_drawPoints,
+    workerhook_drawString,
+    workerhook_drawTurtle,
+    workerhook_fillPolygon,
+    workerhook_floodFill,
+    workerhook_cleanup,
+    workerhook_pauseReached,
+    workerhook_getTicks,
+    workerhook_yieldCPU,
+};
+
+
+static void workerThread(void *data)
+{
+    TobyWorker *worker = (TobyWorker *) data;
+    TOBY_runProgram(worker->ctx, worker->source, worker->runForPrinting);
+    pushSimpleCommand(worker, WORKERCMD_DONE);
+} /* workerThread */
+
+
+TobyWorker *TOBY_createWorker(const TobyCallbacks *callbacks, void *userdata)
+{
+    TobyWorker *worker = (TobyWorker *) calloc(1, sizeof (TobyWorker));
+    if (worker == NULL)
+        return NULL;
+
+    memcpy(&worker->callbacks, callbacks, sizeof (TobyCallbacks));
+    worker->userdata = userdata;
+    worker->handled = TOBY_createEvent();
+    if (worker->handled != NULL)
+        worker->ctx = TOBY_createContext(&workerCallbacks, worker);
+
+    if (worker->ctx == NULL)
+    {
+        if (worker->handled != NULL)
+            TOBY_destroyEvent(worker->handled);
+        free(worker);
+        return NULL;
+    } /* if */
+
+    return worker;
+} /* TOBY_createWorker */
+
+
+/* Copy each changed turtle into place, by index. */
+static void updateTurtles(TobyWorker *worker, const Turtle *turtles, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        const int index = turtles[i].index;
+        if (index >= worker->turtlesAllocated)
+        {
+            int total = (worker->turtlesAllocated * 2) + 4;
+            void *ptr;
+            if (total <= index)
+                total = index + 1;
+            ptr = realloc(worker->turtles, sizeof (Turtle) * total);
+            if (ptr == NULL)
+                continue;  /* oh well. */
+            worker->turtles = (Turtle *) ptr;
+            worker->turtlesAllocated = total;
+        } /* if */
+
+        /* turtles are only ever added, so there are no gaps to fill. */
+        worker->turtles[index] = turtles[i];
+        if (index >= worker->turtleCount)
+            worker->turtleCount = index + 1;
+    } /* for */
+} /* updateTurtles */
+
+
+/* UI thread: act on one command (or just clean it up), then free it. */
+static void dispatchCommand(TobyWorker *worker, WorkerCommand *cmd,
+                            int discard)
+{
+    TobyContext *ctx = worker->ctx;
+    const TobyCallbacks *cb = &worker->callbacks;
+
+    switch (cmd->type)
+    {
+        case WORKERCMD_STARTRUN:
+            worker->turtleCount = 0;  /* the new run starts with none. */
+            if (!discard)
+                cb->startRun(ctx);
+            TOBY_signalEvent(worker->handled);
+            break;
+
+        case WORKERCMD_STOPRUN:
+            if (!discard)
+                cb->stopRun(ctx);
+            break;
+
+        case WORKERCMD_PUTTOSCREEN:  /* TOBY_workerPump() does this later. */
+            if (cmd->u.present.dirty)
+            {
+                const TobyRect *rect = &cmd->u.present.rect;
+                TobyRect *dirty = &worker->dirtyRect;
+                if (!worker->dirty)
+                    *dirty = *rect;
+                else
+                {
+                    if (rect->x1 < dirty->x1) dirty->x1 = rect->x1;
+                    if (rect->y1 < dirty->y1) dirty->y1 = rect->y1;
+                    if (rect->x2 > dirty->x2) dirty->x2 = rect->x2;
+                    if (rect->y2 > dirty->y2) dirty->y2 = rect->y2;
+                } /* else */
+                worker->dirty = 1;
+            } /* if */
+            break;
+
+        case WORKERCMD_MESSAGEBOX:
+            if (!discard)
+                cb->messageBox(ctx, cmd->u.message);
+            free(cmd->u.message);
+            break;
+
+        case WORKERCMD_DRAWLINES:
+            if (!discard)
+                cb->drawLines(ctx, cmd->u.lines.segs, cmd->u.lines.count);
+            free(cmd->u.lines.segs);
+            break;
+
+        case WORKERCMD_DRAWPOINTS:
+            if (!discard)
+                cb->drawPoints(ctx, cmd->u.points.pts, cmd->u.points.count);
+            free(cmd->u.points.pts);
+            break;
+
+        case WORKERCMD_DRAWSTRING:
+            if (!discard)
+            {
+                cb->drawString(ctx, cmd->u.string.x, cmd->u.string.y,
+                               cmd->u.string.str, cmd->u.string.angle,
+                               cmd->u.string.r, cmd->u.string.g,
+                               cmd->u.string.b);
+            } /* if */
+            free(cmd->u.string.str);
+            break;
+
+        case WORKERCMD_DRAWTURTLE:
+            if (!discard)
+                cb->drawTurtle(ctx, cmd->u.turtles.turtles, NULL);
+            free(cmd->u.turtles.turtles);
+            break;
+
+        case WORKERCMD_TURTLES:  /* new frame's changes to the turtles. */
+            updateTurtles(worker, cmd->u.turtles.turtles,
+                          cmd->u.turtles.count);
+            free(cmd->u.turtles.turtles);
+            break;
+
+        case WORKERCMD_FILLPOLYGON:
+            if (!discard)
+            {
+                cb->fillPolygon(ctx, cmd->u.polygon.pts, cmd->u.polygon.count,
+                                cmd->u.polygon.r, cmd->u.polygon.g,
+                                cmd->u.polygon.b);
+            } /* if */
+            free(cmd->u.polygon.pts);
+            break;
+
+        case WORKERCMD_FLOODFILL:
+            if (!discard)
+            {
+                cb->floodFill(ctx, cmd->u.floodfill.x, cmd->u.floodfill.y,
+                              cmd->u.floodfill.r, cmd->u.floodfill.g,
+                              cmd->u.floodfill.b);
+            } /* if */
+            break;
+
+        case WORKERCMD_CLEANUP:
+            if (!discard)
+            {
+                cb->cleanup(ctx, cmd->u.cleanup.r, cmd->u.cleanup.g,
+                            cmd->u.cleanup.b);
+            } /* if */
+            break;
+
+        case WORKERCMD_PAUSEREACHED:
+            if (!discard)
+            {
+                cb->pauseReached(ctx, cmd->u.pause.line, cmd->u.pause.fullstop,
+                                 cmd->u.pause.breakpoint, cmd->u.pause.ticks);
+            } /* if */
+            TOBY_signalEvent(worker->handled);
+            break;
+
+        case WORKERCMD_DONE:
+            TOBY_waitThread(worker->thread);
+            worker->thread = NULL;
+            free(worker->source);
+            worker->source = NULL;
+            worker->running = 0;
+            break;
+    } /* switch */
+} /* dispatchCommand */
+
+
+void TOBY_destroyWorker(TobyWorker *worker)
+{
+    if (worker != NULL)
+    {
+        TobyContext *ctx = worker->ctx;
+        WorkerCommand cmd;
+
+        TOBY_haltProgram(ctx);
+        while (worker->running)  /* throw out everything until it stops. */
+        {
+            if (popCommand(worker, &cmd))
+                dispatchCommand(worker, &cmd, 1);
+            else
+                worker->callbacks.yieldCPU(ctx, 10);
+        } /* while */
+
+        TOBY_destroyContext(ctx);
+        TOBY_destroyEvent(worker->handled);
+        free(worker->gathering);
+        free(worker->turtles);
+        free(worker);
+    } /* if */
+} /* TOBY_destroyWorker */
+
+
+void *TOBY_getWorkerUserData(TobyWorker *worker)
+{
+    return worker->userdata;
+} /* TOBY_getWorkerUserData */
+
+
+TobyContext *TOBY_getWorkerContext(TobyWorker *worker)
+{
+    return worker->ctx;
+} /* TOBY_getWorkerContext */
+
+
+int TOBY_workerRunProgram(TobyWorker *worker, const char *source_code,
+                          int run_for_printing)
+{
+    if (worker->running)
+        return 0;
+
+    worker->source = copyString(source_code);
+    if (worker->source == NULL)
+        return 0;
+
+    worker->runForPrinting = run_for_printing;
+    worker->running = 1;
+    worker->thread = TOBY_createThread(workerThread, worker);
+    if (worker->thread == NULL)
+    {
+        free(worker->source);
+        worker->source = NULL;
+        worker->running = 0;
+        return 0;
+    } /* if */
+
+    return 1;
+} /* TOBY_workerRunProgram */
+
+
+int TOBY_workerPump(TobyWorker *worker, long ms)
+{
+    TobyContext *ctx = worker->ctx;
+    const long startTicks = worker->callbacks.getTicks(ctx);
+    WorkerCommand cmd;
+    int i = 0;
+
+    if (worker->pumping)
+        return worker->running;  /* a callback is running a modal loop. */
+
+    worker->pumping = 1;
+    while (popCommand(worker, &cmd))
+    {
+        dispatchCommand(worker, &cmd, 0);
+
+        if ((ms >= 0) && ((++i % PUMP_CLOCK_CHECK) == 0))
+        {
+            if ((worker->callbacks.getTicks(ctx) - startTicks) >= ms)
+                break;  /* finish up next time. */
+        } /* if */
+    } /* while */
+
+    if (worker->dirty)
+    {
+        worker->presenting = 1;
+        worker->callbacks.putToScreen(ctx);
+        worker->presenting = 0;
+        worker->dirty = 0;
+    } /* if */
+
+    worker->pumping = 0;
+    return worker->running;
+} /* TOBY_workerPump */
+
+
+int TOBY_workerGetDirtyRect(TobyWorker *worker, TobyRect *rect)
+{
+    if (worker->presenting)
+        *rect = worker->dirtyRect;
+    else
+    {
+        rect->x1 = rect->y1 = N(0);
+        rect->x2 = rect->y2 = N(1000);
+    } /* else */
+    return 1;
+} /* TOBY_workerGetDirtyRect */
+
+
+int TOBY_workerIsRunning(TobyWorker *worker)
+{
+    return worker->running;
+} /* TOBY_workerIsRunning */
+
+
+void TOBY_workerRenderAllTurtles(TobyWorker *worker, void *udata)
+{
+    int i;
+    for (i = 0; i < worker->turtleCount; i++)
+    {
+        const Turtle *turtle = &worker->turtles[i];
+        if (turtle->visible)
+            worker->callbacks.drawTurtle(worker->ctx, turtle, udata);
+    } /* for */
+} /* TOBY_workerRenderAllTurtles */
+
+
+void TOBY_workerRenderTurtlesInRect(TobyWorker *worker, void *udata,
+                                    const TobyRect *rect)
+{
+    int i, j;
+    for (i = 0; i < worker->turtleCount; i++)
+    {
+        const Turtle *turtle = &worker->turtles[i];
+        const lua_Number x = turtle->pos.x;
+        const lua_Number y = turtle->pos.y;
+        TobyRect bounds;
+
+        if (!turtle->visible)
+            continue;
+
+        bounds.x1 = bounds.x2 = turtle->points[0].x + x;
+        bounds.y1 = bounds.y2 = turtle->points[0].y + y;
+        for (j = 1; j < 3; j++)
+        {
+            const lua_Number px = turtle->points[j].x + x;
+            const lua_Number py = turtle->points[j].y + y;
+            if (px < bounds.x1) bounds.x1 = px;
+            if (px > bounds.x2) bounds.x2 = px;
+            if (py < bounds.y1) bounds.y1 = py;
+            if (py > bounds.y2) bounds.y2 = py;
+        } /* for */
+
+        if ( (bounds.x2 >= rect->x1) && (bounds.x1 <= rect->x2) &&
+             (bounds.y2 >= rect->y1) && (bounds.y1 <= rect->y2) )
+            worker->callbacks.drawTurtle(worker->ctx, turtle, udata);
+    } /* for */
+} /* TOBY_workerRenderTurtlesInRect */
+
+
+int TOBY_workerReplayDisplayList(TobyWorker *worker, int for_printing)
+{
+    int retval;
+
+    if (worker->running)
+        return 0;
+
+    worker->direct = 1;
+    retval = TOBY_replayDisplayList(worker->ctx, for_printing);
+    worker->direct = 0;
+    return retval;
+} /* TOBY_workerReplayDisplayList */
+
+/* end of toby_worker.c ... */
@@ -0,0 +1,114 @@
+/*
+ * Toby -- A programming language for learning.
+ * Copyright (C) 2007  Ryan C. Gordon.
+ *
+ * Please refer to LICENSE.txt in the root directory of the source
+ *  distribution for licensing details.
+ */
+
+/*
+ * Runs programs on a thread of their own, so the UI doesn't have to be
+ *  pumped from inside the interpreter. Everything the program does that the
+ *  UI needs to know about (drawing, pauses, errors) goes into a
+ *  single-producer, single-consumer lock-free ring; the UI drains it with
+ *  TOBY_workerPump() whenever it likes, usually on a timer, and your
+ *  TobyCallbacks get called from there, on the UI's thread.
+ */
+
+#ifndef _INCL_TOBY_WORKER_H_
+#define _INCL_TOBY_WORKER_H_
+
+#include "toby_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TobyWorker TobyWorker;
+
+/*
+ * Make a worker that calls back into (callbacks), which is copied. All of
+ *  them are called from TOBY_workerPump(), except getTicks and yieldCPU,
+ *  which the program's thread calls too, so they must be thread safe.
+ *  pumpEvents is never called; you're running your own event loop now.
+ *  drawString and floodFill can't report failure; their return values
+ *  are ignored.
+ *  Returns NULL on failure.
+ */
+TobyWorker *TOBY_createWorker(const TobyCallbacks *callbacks, void *userdata);
+
+/* Halts any running program, waits for it, and frees everything. */
+void TOBY_destroyWorker(TobyWorker *worker);
+
+void *TOBY_getWorkerUserData(TobyWorker *worker);
+
+/*
+ * The context programs run in. The control functions (TOBY_haltProgram(),
+ *  TOBY_stepProgram(), TOBY_continueProgram(), TOBY_isPaused(), etc) are
+ *  fine to use on it from the UI's thread. TOBY_getCallstack() and
+ *  TOBY_getVariables() are only safe while the program is paused, or from
+ *  inside the pauseReached callback. Don't use TOBY_renderAllTurtles() or
+ *  TOBY_replayDisplayList() on it; use the worker versions below. The
+ *  context's userdata is the worker.
+ */
+TobyContext *TOBY_getWorkerContext(TobyWorker *worker);
+
+/*
+ * Start running (source_code), which is copied, on a new thread. Returns
+ *  zero if a program is already running or the thread couldn't start.
+ *  Some commands make the program wait until they're pumped: startRun
+ *  (so you can set up stepping before the first line) and pauseReached
+ *  (so you can look at the callstack).
+ */
+int TOBY_workerRunProgram(TobyWorker *worker, const char *source_code,
+                          int run_for_printing);
+
+/*
+ * Hand everything the program did since the last pump to your callbacks,
+ *  for up to (ms) milliseconds (or until caught up if (ms) is negative),
+ *  then call putToScreen once if the program showed a new frame. Returns
+ *  non-zero if the run isn't over yet, as far as the UI is concerned: that
+ *  is, until the stopRun callback has been called and the thread is done.
+ *  Calling this from inside one of the callbacks does nothing.
+ */
+int TOBY_workerPump(TobyWorker *worker, long ms);
+
+/*
+ * TOBY_getDirtyRect() for a worker: inside the putToScreen callback made by
+ *  TOBY_workerPump(), everything the frames since the last one covered.
+ *  Anywhere else, it's all of TurtleSpace, so calling your putToScreen
+ *  yourself (after a resize, say) repaints it all.
+ */
+int TOBY_workerGetDirtyRect(TobyWorker *worker, TobyRect *rect);
+
+/* Same as what TOBY_workerPump() last returned. */
+int TOBY_workerIsRunning(TobyWorker *worker);
+
+/*
+ * Draw the visible turtles, as of the last frame that was pumped, through
+ *  your drawTurtle callback with (udata).
+ */
+void TOBY_workerRenderAllTurtles(TobyWorker *worker, void *udata);
+
+/*
+ * TOBY_workerRenderAllTurtles(), but only the turtles that overlap (rect),
+ *  in TurtleSpace coordinates, so repainting a small part of the screen
+ *  doesn't cost anything for the thousands of turtles elsewhere.
+ */
+void TOBY_workerRenderTurtlesInRect(TobyWorker *worker, void *udata,
+                                    const TobyRect *rect);
+
+/*
+ * TOBY_replayDisplayList() for a worker, with callbacks made directly.
+ *  Returns zero if a program is running, or if the display list was
+ *  dropped.
+ */
+int TOBY_workerReplayDisplayList(TobyWorker *worker, int for_printing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of toby_worker.h ... */
@@ -20,6 +20,7 @@
 #include <wx/printdlg.h>
 
 #include "toby_app.h"
+#include "toby_worker.h"
 
 // define something.
 #if ((!TOBY_WX_BUILD_STANDALONE) && (!TOBY_WX_BUILD_IDE))
@@ -46,12 +47,15 @@ public:
     inline const wxFont *getFont() const { return &this->font; }
     inline wxBitmap *getBacking() const;
     inline void scaleXY(lua_Number &x, lua_Number &y) const;
+    void refreshDirty(const TobyRect &dirty);
 
     bool drawString(lua_Number x, lua_Number y, const wxString &str,
                     lua_Number angle, int r, int g, int b);
-    void drawLine(lua_Number x1, lua_Number y1, lua_Number x2, lua_Number y2,
-                  int r, int g, int b);
+    void drawLines(const TobyLineSegment *segs, int count);
+    void drawPoints(const TobyPoint *pts, int count);
     void drawTurtle(const Turtle *turtle, void *data);
+    void fillPolygon(const TurtlePoint *pts, int count, int r, int g, int b);
+    bool floodFill(lua_Number x, lua_Number y, int r, int g, int b);
     void cleanup(int r, int g, int b, bool force=false);
 
     // wxWidgets event handlers...
@@ -120,6 +124,15 @@ enum TobyMenuCommands
     MENUCMD_License,
 };
 
+// Ids for things that aren't menu items.
+enum TobyTimers
+{
+    TIMER_Pump = wxID_HIGHEST + 100,
+};
+
+// How often the UI collects what the running program did, in milliseconds.
+#define TOBY_PUMP_INTERVAL 16
+
 // TobyFrame is a standard wxFrame, but adds an interface for getting
 //  the actual TurtleSpace canvas and other highlevel wankery...there are two
 //  subclasses of this: one is a standalone window that only contains a
@@ -138,9 +151,9 @@ public:
     void openFile(const wxString &path);
     void startRun();
     void stopRun();
-    inline void pumpEvents();
     inline void repaintTurtlespace();
     inline void runProgram(bool printing, bool _breakAtStart=false);
+    bool replayForPrinting();
     void toggleWidgetsRunnable(bool readyToRun);
     inline void requestQuit();
     inline bool isQuitting() const { return this->quitting; }
@@ -156,6 +169,7 @@ public:
 
     // wxWidgets event handlers...
     void onIdle(wxIdleEvent &evt);
+    void onPumpTimer(wxTimerEvent &evt);
     void onClose(wxCloseEvent &evt);
     void onResize(wxSizeEvent &evt);
     void onMove(wxMoveEvent &evt);
@@ -188,10 +202,12 @@ protected:
     bool runForPrinting;
     bool breakAtStart;
     char *execProgram;
+    char *lastProgram;  // source of the most recent run.
     wxMenu *fileMenu;
     wxMenu *runMenu;
     wxMenu *helpMenu;
     wxMenuBar *menuBar;
+    wxTimer pumpTimer;
 
 private:
     DECLARE_EVENT_TABLE()
@@ -199,6 +215,7 @@ private:
 
 BEGIN_EVENT_TABLE(TobyFrame, wxFrame)
     EVT_IDLE(TobyFrame::onIdle)
+    EVT_TIMER(TIMER_Pump, TobyFrame::onPumpTimer)
     EVT_CLOSE(TobyFrame::onClose)
     EVT_SIZE(TobyFrame::onResize)
     EVT_MOVE(TobyFrame::onMove)
@@ -303,100 +320,162 @@ END_EVENT_TABLE()
 class TobyWxApp : public wxApp
 {
 public:
-    TobyWxApp() : mainWindow(NULL), printData(NULL) { /* no-op. */ }
+    TobyWxApp() : mainWindow(NULL), printData(NULL), worker(NULL) {}
     virtual bool OnInit();
     virtual int OnExit();
     TobyFrame *getTobyFrame() const { return this->mainWindow; }
+    TobyWorker *getTobyWorker() const { return this->worker; }
+    inline TobyContext *getTobyContext() const;
+    inline bool isProgramRunning() const;
     inline wxPrintData *getPrintData();
     inline long getTicks() { return this->processStopwatch.Time(); }
 
 private:
     TobyFrame *mainWindow;
     wxPrintData *printData;
+    TobyWorker *worker;
     wxStopWatch processStopwatch;
 };
 
 DECLARE_APP(TobyWxApp)
 
+TobyContext *TobyWxApp::getTobyContext() const
+{
+    return TOBY_getWorkerContext(this->worker);
+} // TobyWxApp::getTobyContext
+
+// Whether there's a run in progress, as far as the UI has seen so far.
+bool TobyWxApp::isProgramRunning() const
+{
+    return (TOBY_workerIsRunning(this->worker) != 0);
+} // TobyWxApp::isProgramRunning
+
 
 
 
 // implementations of callbacks during execution of Toby programs...
 
-long TOBY_getTicks(void)
+static long tobyhook_getTicks(TobyContext *ctx)
 {
     return wxGetApp().getTicks();
-} // TOBY_getTicks
+} // tobyhook_getTicks
 
 
-void TOBY_yieldCPU(int ms)
+static void tobyhook_yieldCPU(TobyContext *ctx, int ms)
 {
     ::wxMilliSleep(ms);
-} // TOBY_yieldCPU
+} // tobyhook_yieldCPU
 
 
-void TOBY_startRun()
+static void tobyhook_startRun(TobyContext *ctx)
 {
     wxGetApp().getTobyFrame()->startRun();
-} // TOBY_startRun
+} // tobyhook_startRun
 
 
-void TOBY_stopRun()
+static void tobyhook_stopRun(TobyContext *ctx)
 {
     wxGetApp().getTobyFrame()->stopRun();
-} // TOBY_stopRun
+} // tobyhook_stopRun
 
 
-void TOBY_pumpEvents()
+static void tobyhook_pumpEvents(TobyContext *ctx)
 {
-    wxGetApp().getTobyFrame()->pumpEvents();
-} // TOBY_pumpEvents
+    // no-op: the program runs on a worker thread, so the wxWidgets event
+    //  loop keeps running on its own. See TobyFrame::onPumpTimer().
+} // tobyhook_pumpEvents
 
 
-void TOBY_putToScreen()
+static void tobyhook_putToScreen(TobyContext *ctx)
 {
     wxGetApp().getTobyFrame()->repaintTurtlespace();
-} // TOBY_putToScreen
+} // tobyhook_putToScreen
 
 
-int TOBY_drawString(lua_Number x, lua_Number y, const char *utf8str,
-                    lua_Number angle, int r, int g, int b)
+static int tobyhook_drawString(TobyContext *ctx, lua_Number x, lua_Number y,
+                               const char *utf8str, lua_Number angle,
+                               int r, int g, int b)
 {
     const wxString wxstr(utf8str, wxConvUTF8);
     TurtleSpace *tspace = wxGetApp().getTobyFrame()->getTurtleSpace();
     return tspace->drawString(x, y, wxstr, angle, r, g, b) ? 1 : 0;
-} // TOBY_drawString
+} // tobyhook_drawString
+
+
+static void tobyhook_drawLines(TobyContext *ctx, const TobyLineSegment *segs,
+                               int count)
+{
+    wxGetApp().getTobyFrame()->getTurtleSpace()->drawLines(segs, count);
+} // tobyhook_drawLines
 
 
-void TOBY_drawLine(lua_Number x1, lua_Number y1, lua_Number x2, lua_Number y2,
-                   int r, int g, int b)
+static void tobyhook_drawPoints(TobyContext *ctx, const TobyPoint *pts,
+                                int count)
 {
-    wxGetApp().getTobyFrame()->getTurtleSpace()->drawLine(x1,y1,x2,y2,r,g,b);
-} // TOBY_drawLine
+    wxGetApp().getTobyFrame()->getTurtleSpace()->drawPoints(pts, count);
+} // tobyhook_drawPoints
 
 
-void TOBY_drawTurtle(const Turtle *turtle, void *data)
+static void tobyhook_drawTurtle(TobyContext *ctx, const Turtle *turtle,
+                                void *data)
 {
     wxGetApp().getTobyFrame()->getTurtleSpace()->drawTurtle(turtle, data);
-} // TOBY_drawTurtle
+} // tobyhook_drawTurtle
+
+
+static void tobyhook_fillPolygon(TobyContext *ctx, const TurtlePoint *pts,
+                                 int count, int r, int g, int b)
+{
+    TurtleSpace *tspace = wxGetApp().getTobyFrame()->getTurtleSpace();
+    tspace->fillPolygon(pts, count, r, g, b);
+} // tobyhook_fillPolygon
 
 
-void TOBY_pauseReached(int line, int fullstop, int breakpoint, int ticks)
+static int tobyhook_floodFill(TobyContext *ctx, lua_Number x, lua_Number y,
+                              int r, int g, int b)
+{
+    TurtleSpace *tspace = wxGetApp().getTobyFrame()->getTurtleSpace();
+    return tspace->floodFill(x, y, r, g, b) ? 1 : 0;
+} // tobyhook_floodFill
+
+
+static void tobyhook_pauseReached(TobyContext *ctx, int line, int fullstop,
+                                  int breakpoint, int ticks)
 {
     wxGetApp().getTobyFrame()->pauseReached(line, fullstop, breakpoint, ticks);
-} // TOBY_pauseReached
+} // tobyhook_pauseReached
 
 
-void TOBY_cleanup(int r, int g, int b)
+static void tobyhook_cleanup(TobyContext *ctx, int r, int g, int b)
 {
     wxGetApp().getTobyFrame()->getTurtleSpace()->cleanup(r, g, b);
-} // TOBY_cleanup
+} // tobyhook_cleanup
 
 
-void TOBY_messageBox(const char *msg)
+static void tobyhook_messageBox(TobyContext *ctx, const char *msg)
 {
     ::wxMessageBox(wxString(msg, wxConvUTF8), wxString(wxT("Toby")));
-} // TOBY_messageBox
+} // tobyhook_messageBox
+
+
+static const TobyCallbacks tobyCallbacks =
+{
+    tobyhook_startRun,
+    tobyhook_stopRun,
+    tobyhook_pumpEvents,
+    tobyhook_putToScreen,
+    tobyhook_messageBox,
+    tobyhook_drawLines,
+    tobyhook_drawPoints,
+    tobyhook_drawString,
+    tobyhook_drawTurtle,
+    tobyhook_fillPolygon,
+    tobyhook_floodFill,
+    tobyhook_cleanup,
+    tobyhook_pauseReached,
+    tobyhook_getTicks,
+    tobyhook_yieldCPU,
+};
 
 
 
@@ -467,19 +546,97 @@ void TurtleSpace::clipDC(wxDC *dc, int xoff, int yoff) const
 } // TurtleSpace::clipDC
 
 
-void TurtleSpace::drawLine(lua_Number x1, lua_Number y1,
-                           lua_Number x2, lua_Number y2,
-                           int r, int g, int b)
+static inline bool sameColor(const TurtleRGB &a, const TurtleRGB &b)
+{
+    return ((a.r == b.r) && (a.g == b.g) && (a.b == b.b));
+} // sameColor
+
+
+void TurtleSpace::drawLines(const TobyLineSegment *segs, int count)
 {
     wxMemoryDC *dc = this->getBackingDC();
-    if (dc != NULL)
+    if (dc == NULL)
+        return;
+
+    // Set the pen once per run of segments that share a color, and send
+    //  each connected stretch of that run to the DC as a single polyline.
+    wxPoint points[128];
+    int i = 0;
+    while (i < count)
     {
-        this->scaleXY(x1, y1);
-        this->scaleXY(x2, y2);
-        dc->SetPen(wxPen(wxColour(r, g, b)));
-        dc->DrawLine((wxCoord) x1, (wxCoord) y1, (wxCoord) x2, (wxCoord) y2);
-    } // if
-} // TurtleSpace::drawLine
+        const TurtleRGB &color = segs[i].color;
+        dc->SetPen(wxPen(wxColour(color.r, color.g, color.b)));
+        do
+        {
+            lua_Number x = segs[i].x1;
+            lua_Number y = segs[i].y1;
+            this->scaleXY(x, y);
+            points[0] = wxPoint((wxCoord) x, (wxCoord) y);
+            int total = 1;
+            do
+            {
+                x = segs[i].x2;
+                y = segs[i].y2;
+                this->scaleXY(x, y);
+                points[total++] = wxPoint((wxCoord) x, (wxCoord) y);
+                i++;
+            } while ( (i < count) &&
+                      (total < (int) STATICARRAYLEN(points)) &&
+                      (segs[i].x1 == segs[i-1].x2) &&
+                      (segs[i].y1 == segs[i-1].y2) &&
+                      (sameColor(segs[i].color, color)) );
+
+            if (total == 2)
+                dc->DrawLine(points[0], points[1]);
+            else
+                dc->DrawLines(total, points);
+        } while ((i < count) && (sameColor(segs[i].color, color)));
+    } // while
+} // TurtleSpace::drawLines
+
+
+// Where the TurtleSpace unit holding (v) starts on a backing axis of (size)
+//  pixels, and how many it covers, so neighbouring units meet without gaps.
+static inline void pointCell(int size, lua_Number v,
+                             wxCoord &start, wxCoord &len)
+{
+    const lua_Number end = ((lua_Number) size) *
+                           (((lua_Number) (((int) v) + 1)) / N(1000));
+    start = (wxCoord) (((lua_Number) size) * (v / N(1000)));
+    if (start >= size)  // rounding right at the edge.
+        start = size - 1;
+    len = (((wxCoord) end) > start) ? (((wxCoord) end) - start) : 1;
+} // pointCell
+
+
+void TurtleSpace::drawPoints(const TobyPoint *pts, int count)
+{
+    wxMemoryDC *dc = this->getBackingDC();
+    if (dc == NULL)
+        return;
+
+    // Set the pen and brush once per run of points that share a color.
+    //  Each point fills its whole TurtleSpace unit, which is more than one
+    //  pixel when the backing store is bigger than TurtleSpace (printing!).
+    for (int i = 0; i < count; i++)
+    {
+        const TurtleRGB &color = pts[i].color;
+        if ((i == 0) || (!sameColor(color, pts[i-1].color)))
+        {
+            const wxColour c(color.r, color.g, color.b);
+            dc->SetPen(wxPen(c));
+            dc->SetBrush(wxBrush(c));
+        } // if
+
+        wxCoord x, y, w, h;
+        pointCell(this->backingW, pts[i].x, x, w);
+        pointCell(this->backingH, pts[i].y, y, h);
+        if ((w == 1) && (h == 1))
+            dc->DrawPoint(x, y);
+        else
+            dc->DrawRectangle(x, y, w, h);
+    } // for
+} // TurtleSpace::drawPoints
 
 
 bool TurtleSpace::drawString(lua_Number x, lua_Number y, const wxString &str,
@@ -552,6 +709,48 @@ void TurtleSpace::drawTurtle(const Turtle *turtle, void *data)
 } // TurtleSpace::drawTurtle
 
 
+void TurtleSpace::fillPolygon(const TurtlePoint *pts, int count,
+                              int r, int g, int b)
+{
+    wxMemoryDC *dc = this->getBackingDC();
+    if (dc == NULL)
+        return;
+
+    wxPoint *points = new wxPoint[count];
+    for (int i = 0; i < count; i++)
+    {
+        lua_Number x = pts[i].x;
+        lua_Number y = pts[i].y;
+        this->scaleXY(x, y);
+        points[i] = wxPoint((wxCoord) x, (wxCoord) y);
+    } // for
+
+    const wxColour color(r, g, b);
+    dc->SetPen(wxPen(color));
+    dc->SetBrush(wxBrush(color));
+    dc->DrawPolygon(count, points, 0, 0, wxODDEVEN_RULE);
+    delete[] points;
+} // TurtleSpace::fillPolygon
+
+
+bool TurtleSpace::floodFill(lua_Number x, lua_Number y, int r, int g, int b)
+{
+    wxMemoryDC *dc = this->getBackingDC();
+    if (dc == NULL)
+        return true;  // nothing to fill.
+
+    this->scaleXY(x, y);
+    const wxCoord px = (wxCoord) x;
+    const wxCoord py = (wxCoord) y;
+    wxColour target;
+    if (!dc->GetPixel(px, py, &target))
+        return false;
+
+    dc->SetBrush(wxBrush(wxColour(r, g, b)));
+    return dc->FloodFill(px, py, target, wxFLOOD_SURFACE);
+} // TurtleSpace::floodFill
+
+
 void TurtleSpace::cleanup(int r, int g, int b, bool force)
 {
     wxMemoryDC *dc = this->backingDC;
@@ -613,6 +812,7 @@ void TurtleSpace::startRun(bool runForPrinting)
     } // if
 
     this->constructBackingDC();
+    this->Refresh(false);  // the background around the backing may change.
 } // TurtleSpace::startRun
 
 
@@ -622,6 +822,26 @@ void TurtleSpace::stopRun()
 } // TurtleSpace::stopRun
 
 
+// Repaint just the part of the window covering (dirty), in TurtleSpace
+//  coordinates, padded a little for rounding.
+void TurtleSpace::refreshDirty(const TobyRect &dirty)
+{
+    int xoff, yoff;
+    this->calcOffset(xoff, yoff);
+
+    lua_Number x1 = dirty.x1, y1 = dirty.y1;
+    lua_Number x2 = dirty.x2, y2 = dirty.y2;
+    this->scaleXY(x1, y1);
+    this->scaleXY(x2, y2);
+
+    const int left = ((int) x1) + xoff - 1;
+    const int top = ((int) y1) + yoff - 1;
+    const int right = ((int) x2) + xoff + 2;
+    const int bottom = ((int) y2) + yoff + 2;
+    this->RefreshRect(wxRect(left, top, right - left, bottom - top), false);
+} // TurtleSpace::refreshDirty
+
+
 void TurtleSpace::onResize(wxSizeEvent &evt)
 {
     // Just cache the dimensions, since we're spending an enormous amount of
@@ -647,7 +867,7 @@ void TurtleSpace::onPaint(wxPaintEvent &evt)
     this->calcOffset(xoff, yoff);
 
     int r, g, b;
-    TOBY_background(&r, &g, &b);
+    TOBY_background(wxGetApp().getTobyContext(), &r, &g, &b);
     dc.SetBackground(wxBrush(wxColour(r, g, b)));
     
     if (this->backing == NULL)
@@ -655,13 +875,40 @@ void TurtleSpace::onPaint(wxPaintEvent &evt)
     else
     {
         // !!! FIXME: clear to something other than the background color?
-        // delete in-progress backingDC to force flush of rendered data...
-        const bool hasBackingDC = (this->backingDC != NULL);
-        this->nukeDC(&this->backingDC);
-        dc.DrawBitmap(*this->backing, xoff, yoff, false);
-        TOBY_renderAllTurtles(&dc);
-        if (hasBackingDC)
-            this->constructBackingDC();
+        // During a run, copy just what needs repainting straight out of the
+        //  DC we're drawing into, instead of flushing it to the bitmap.
+        if (this->backingDC == NULL)
+            dc.DrawBitmap(*this->backing, xoff, yoff, false);
+        else
+        {
+            wxRect area(this->GetUpdateRegion().GetBox());
+            area.Intersect(wxRect(xoff, yoff, this->backingW, this->backingH));
+            if (!area.IsEmpty())
+            {
+                dc.Blit(area.x, area.y, area.width, area.height,
+                        this->backingDC, area.x - xoff, area.y - yoff);
+            } // if
+        } // else
+
+        // Only turtles touching the part of the window being repainted
+        //  matter; there might be thousands of them elsewhere.
+        if ((this->backingW > 0) && (this->backingH > 0))
+        {
+            const wxRect box(this->GetUpdateRegion().GetBox());
+            const lua_Number w = (lua_Number) this->backingW;
+            const lua_Number h = (lua_Number) this->backingH;
+            const int left = box.x - xoff - 1;
+            const int top = box.y - yoff - 1;
+            const int right = box.GetRight() - xoff + 2;
+            const int bottom = box.GetBottom() - yoff + 2;
+            TobyRect area;
+            area.x1 = (((lua_Number) left) / w) * N(1000);
+            area.y1 = (((lua_Number) top) / h) * N(1000);
+            area.x2 = (((lua_Number) right) / w) * N(1000);
+            area.y2 = (((lua_Number) bottom) / h) * N(1000);
+            TOBY_workerRenderTurtlesInRect(wxGetApp().getTobyWorker(), &dc,
+                                           &area);
+        } // if
 
         // If there's some space in the window that isn't covered by the
         //  bitmap, blank it out. We do a lot of tapdancing to try and clip
@@ -698,7 +945,7 @@ void TurtleSpace::onPaint(wxPaintEvent &evt)
 bool TobyPrintout::OnPrintPage(int page)
 {
     const TobyFrame *tframe = wxGetApp().getTobyFrame();
-    wxASSERT(!TOBY_isRunning());
+    wxASSERT(!wxGetApp().isProgramRunning());
 
     wxBitmap *bmp = tframe->getTurtleSpace()->getBacking();
     if (bmp != NULL)
@@ -749,10 +996,12 @@ TobyFrame::TobyFrame()
     , runForPrinting(false)
     , breakAtStart(false)
     , execProgram(NULL)
+    , lastProgram(NULL)
     , fileMenu(new wxMenu)
     , runMenu(new wxMenu)
     , helpMenu(new wxMenu)
     , menuBar(new wxMenuBar)
+    , pumpTimer(this, TIMER_Pump)
 {
     this->GetPosition(&this->nonMaximizedX, &this->nonMaximizedY);
     this->GetSize(&this->nonMaximizedWidth, &this->nonMaximizedHeight);
@@ -789,12 +1038,14 @@ TobyFrame::TobyFrame()
         this->Maximize();
 
     this->updateTitleBar();
+    this->pumpTimer.Start(TOBY_PUMP_INTERVAL);
 } // TobyFrame::TobyFrame
 
 
 TobyFrame::~TobyFrame()
 {
     delete[] this->execProgram;
+    delete[] this->lastProgram;
 
     // this->turtleSpace should be deleted by the subclass (because it usually
     //  wants to be killed by a wxSizer ...)
@@ -849,18 +1100,15 @@ const wxSize TobyFrame::getPreviousSize()
 } // TobyFrame::getPreviousSize
 
 
-void TobyFrame::pumpEvents()
-{
-    while (wxGetApp().Pending())
-        wxGetApp().Dispatch();
-} // TobyFrame::pumpEvents
-
-
 void TobyFrame::repaintTurtlespace()
 {
     TurtleSpace *tspace = this->turtleSpace;
-    tspace->Refresh(false);
-    tspace->Update();  // force repaint.
+    TobyRect dirty;
+    if (TOBY_workerGetDirtyRect(wxGetApp().getTobyWorker(), &dirty))
+    {
+        tspace->refreshDirty(dirty);
+        tspace->Update();  // force repaint.
+    } // if
 } // TobyFrame::repaintTurtlespace
 
 
@@ -880,11 +1128,11 @@ void TobyFrame::toggleWidgetsRunnable(bool readyToRun)
 
 void TobyFrame::startRun()
 {
-    wxASSERT(!TOBY_isRunning());
+    wxASSERT(wxGetApp().isProgramRunning());
     this->toggleWidgetsRunnable(false);
     this->turtleSpace->startRun(this->runForPrinting);
     if (this->breakAtStart)
-        TOBY_stepProgram();
+        TOBY_stepProgram(wxGetApp().getTobyContext());
     this->SetStatusText(wxT("Now running..."));
     this->profileStopwatch.Start(0);
 } // TobyFrame::startRun
@@ -892,7 +1140,7 @@ void TobyFrame::startRun()
 
 void TobyFrame::stopRun()
 {
-    wxASSERT(TOBY_isRunning());
+    wxASSERT(wxGetApp().isProgramRunning());
     const long ms = this->profileStopwatch.Time();
     this->SetStatusText(wxString::Format(wxT("...ran %ld milliseconds."), ms));
     this->toggleWidgetsRunnable(true);
@@ -902,14 +1150,15 @@ void TobyFrame::stopRun()
 
 void TobyFrame::requestQuit()
 {
-    TOBY_haltProgram();
+    TOBY_haltProgram(wxGetApp().getTobyContext());
     this->quitting = true;
 } // TobyFrame::requestQuit
 
 
 void TobyFrame::runProgram(bool _runForPrinting, bool _breakAtStart)
 {
-    TOBY_haltProgram();  // stop the current run as soon as possible.
+    // stop the current run as soon as possible.
+    TOBY_haltProgram(wxGetApp().getTobyContext());
     // This gets kicked off in the next idle event.
     this->runForPrinting = _runForPrinting;
     delete[] this->execProgram;
@@ -918,12 +1167,45 @@ void TobyFrame::runProgram(bool _runForPrinting, bool _breakAtStart)
 } // TobyFrame::runProgram
 
 
+// If the program hasn't changed since it last ran to the end, redraw that
+//  run at print size from the backend's display list instead of running
+//  the whole thing again. Returns false if it has to be rerun.
+bool TobyFrame::replayForPrinting()
+{
+    TobyContext *ctx = wxGetApp().getTobyContext();
+    if ((this->lastProgram == NULL) || (!TOBY_displayListComplete(ctx)))
+        return false;
+
+    char *prog = this->getProgramImpl();
+    const bool unchanged = ((prog != NULL) && (strcmp(prog, this->lastProgram) == 0));
+    delete[] prog;
+    if (!unchanged)
+        return false;
+
+    wxStopWatch stopwatch;
+    this->turtleSpace->startRun(true);
+    TobyWorker *worker = wxGetApp().getTobyWorker();
+    const bool retval = (TOBY_workerReplayDisplayList(worker, 1) != 0);
+    this->turtleSpace->stopRun();
+
+    if (retval)
+    {
+        const long ms = stopwatch.Time();
+        this->SetStatusText(wxString::Format(wxT("...redrew in %ld milliseconds."), ms));
+        this->turtleSpace->Refresh(false);  // all of it, not just the dirty rect.
+    } // if
+
+    return retval;
+} // TobyFrame::replayForPrinting
+
+
 void TobyFrame::onIdle(wxIdleEvent &evt)
 {
+    TobyContext *ctx = wxGetApp().getTobyContext();
     if (this->isQuitting())
     {
-        if (TOBY_isRunning())
-            TOBY_haltProgram();
+        if (wxGetApp().isProgramRunning())
+            TOBY_haltProgram(ctx);
         else
         {
             this->quitting = false;
@@ -933,19 +1215,29 @@ void TobyFrame::onIdle(wxIdleEvent &evt)
 
     else if (this->execProgram != NULL)
     {
-        if (TOBY_isRunning())
-            TOBY_haltProgram();
+        if (wxGetApp().isProgramRunning())
+            TOBY_haltProgram(ctx);
         else
         {
+            TobyWorker *worker = wxGetApp().getTobyWorker();
             char *prog = this->execProgram;
             this->execProgram = NULL;
-            TOBY_runProgram(prog, this->runForPrinting);
-            delete[] prog;
+            TOBY_workerRunProgram(worker, prog, this->runForPrinting);
+            delete[] this->lastProgram;
+            this->lastProgram = prog;  // keep it to check for replays.
         } // else
     } // else if
 } // TobyFrame::onIdle
 
 
+void TobyFrame::onPumpTimer(wxTimerEvent &evt)
+{
+    // Hand whatever the program did since last time to the tobyhooks, but
+    //  leave some of the frame for the user's events.
+    TOBY_workerPump(wxGetApp().getTobyWorker(), TOBY_PUMP_INTERVAL / 2);
+} // TobyFrame::onPumpTimer
+
+
 void TobyFrame::updateTitleBar()
 {
     wxString fnstr;
@@ -968,7 +1260,7 @@ void TobyFrame::openFile(const wxString &path)
         char *buf = new char[len + 1];
         if (!strm.Read(buf, len).IsOk())
         {
-            TOBY_messageBox("Could not read file");
+            ::wxMessageBox(wxT("Could not read file"), wxT("Toby"));
             delete[] buf;
         } // if
         else
@@ -985,8 +1277,9 @@ void TobyFrame::openFile(const wxString &path)
 
 void TobyFrame::onMenuOpen(wxCommandEvent& evt)
 {
-    wxASSERT(!TOBY_isRunning());
-    TOBY_haltProgram();  // just in case.
+    TobyContext *ctx = wxGetApp().getTobyContext();
+    wxASSERT(!wxGetApp().isProgramRunning());
+    TOBY_haltProgram(ctx);  // just in case.
 
     // !!! FIXME: localization.
     wxFileDialog dlg(this, wxT("Choose a file to open"), wxT(""), wxT(""),
@@ -1093,27 +1386,29 @@ void TobyFrame::onMenuPrint(wxCommandEvent &event)
 
 void TobyFrame::onMenuRun(wxCommandEvent &evt)
 {
-    if (!TOBY_isRunning())
+    TobyContext *ctx = wxGetApp().getTobyContext();
+    if (!wxGetApp().isProgramRunning())
         this->runProgram(false);  // Run will kick off in next idle event.
-    else if (TOBY_isPaused())
+    else if (TOBY_isPaused(ctx))
     {
         this->menuBar->FindItem(MENUCMD_Run)->Enable(false);
         this->onContinueImpl();
-        TOBY_continueProgram();
+        TOBY_continueProgram(ctx);
     } // else if
 } // TobyFrame::onMenuRun
 
 
 void TobyFrame::onMenuStop(wxCommandEvent &evt)
 {
-    TOBY_haltProgram();
+    TOBY_haltProgram(wxGetApp().getTobyContext());
 } // TobyFrame::onMenuStop
 
 
 void TobyFrame::onMenuStep(wxCommandEvent &evt)
 {
-    if (TOBY_isRunning())
-        TOBY_stepProgram();
+    TobyContext *ctx = wxGetApp().getTobyContext();
+    if (wxGetApp().isProgramRunning())
+        TOBY_stepProgram(ctx);
     else
     {
         // if it's not running, start it and break at startup.
@@ -1124,9 +1419,9 @@ void TobyFrame::onMenuStep(wxCommandEvent &evt)
 
 void TobyFrame::onMenuRunForPrinting(wxCommandEvent &evt)
 {
-    // Run will kick off in next idle event.
-    wxASSERT(!TOBY_isRunning());
-    this->runProgram(true);
+    wxASSERT(!wxGetApp().isProgramRunning());
+    if (!this->replayForPrinting())
+        this->runProgram(true);  // Run will kick off in next idle event.
 } // TobyFrame::onMenuRunForPrinting
 
 
@@ -1232,7 +1527,7 @@ void TobyFrame::onMove(wxMoveEvent &evt)
 
 void TobyFrame::onClose(wxCloseEvent &evt)
 {
-    if (TOBY_isRunning())
+    if (wxGetApp().isProgramRunning())
     {
         this->requestQuit();  // try it again later so program can halt...
         evt.Veto();  // ...this time, though, no deal.
@@ -1443,7 +1738,8 @@ void TobyIDEFrame::pauseReached(int line, int fullstop,
         this->SetStatusText(status);
 
         int frames = 0;
-        const TobyDebugInfo *cs = TOBY_getCallstack(&frames);
+        TobyContext *ctx = wxGetApp().getTobyContext();
+        const TobyDebugInfo *cs = TOBY_getCallstack(ctx, &frames);
 
         // if you're on the (global variables) selection, stick there,
         //  otherwise always view the top stackframe by default.
@@ -1498,7 +1794,7 @@ void TobyIDEFrame::openFileImpl(char *prog)
     delete[] prog;  // don't need this anymore.
     this->toggleWidgetsRunnable(true);
     this->textCtrl->SetFocus();
-    TOBY_clearAllBreakpoints();
+    TOBY_clearAllBreakpoints(wxGetApp().getTobyContext());
 } // TobyIDEFrame::openFileImpl
 
 
@@ -1510,8 +1806,12 @@ void TobyIDEFrame::updateVariablesCtrl(int frame)
             frame = -1;  // Requesting global variables, not a stack frame.
     } // if
 
+    // The program's thread only leaves its Lua state alone while paused.
+    TobyContext *ctx = wxGetApp().getTobyContext();
     int varCount = 0;
-    const TobyDebugInfo *vars = TOBY_getVariables(frame, &varCount);
+    const TobyDebugInfo *vars = NULL;
+    if (TOBY_isPaused(ctx))
+        vars = TOBY_getVariables(ctx, frame, &varCount);
     if ((varCount <= 0) || (vars == NULL))
         this->variablesCtrl->Clear();
     else
@@ -1556,7 +1856,7 @@ void TobyIDEFrame::onMenuSave(wxCommandEvent &evt)
         if (strm.IsOk())
         {
             if (!strm.Write(buf, strlen(buf)).IsOk())
-                TOBY_messageBox("Could not write file");
+                ::wxMessageBox(wxT("Could not write file"), wxT("Toby"));
             else
             {
                 this->modified = false;
@@ -1677,6 +1977,13 @@ bool TobyWxApp::OnInit()
 
     this->processStopwatch.Start(0);
 
+    this->worker = TOBY_createWorker(&tobyCallbacks, NULL);
+    if (this->worker == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        return false;
+    } // if
+
     tobyInitAllImageHandlers();
 
     if (standalone)
@@ -1715,6 +2022,8 @@ int TobyWxApp::OnExit()
     mainWindow = NULL;  // this is probably deleted already.
     delete this->printData;
     this->printData = NULL;
+    TOBY_destroyWorker(this->worker);
+    this->worker = NULL;
     return wxApp::OnExit();
 } // TobyWxApp::OnExit
 